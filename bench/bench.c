@@ -0,0 +1,462 @@
+/*
+ * bench.c
+ *
+ * Benchmark driver. Generates a synthetic image with genimage, then times
+ * each read path of the reader against it, first with the image (and its
+ * sidecar index) evicted from the page cache (cold) and then with it
+ * resident (warm). Every iteration gets a freshly opened ext2_fs, so the
+ * reader's own caches start empty either way. Results are printed as one
+ * JSON object per line:
+ *
+ *    {"bench":"ext2reader", <image parameters>}
+ *    {"op":"<name>","cache":"cold|warm","runs":N,"min_us":..,"median_us":..,
+ *     "max_us":..}
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "genimage.h"
+#include "../src/ext2reader.h"
+#include "../src/batch.h"
+#include "../src/cache.h"
+#include "../src/dirindex.h"
+#include "../src/restore.h"
+#include "../src/usage.h"
+#include "../src/grep.h"
+#include "../src/checksum.h"
+#include "../src/scan.h"
+#include "../src/sidecar.h"
+#include "../src/walk.h"
+
+#define BENCH_DEFAULT_FILES 20000
+#define BENCH_DEFAULT_MAX_SIZE (256 * 1024)
+#define BENCH_DEFAULT_FANOUT 256
+#define BENCH_DEFAULT_FRAGMENT_PCT 10
+#define BENCH_DEFAULT_BLOCK_SIZE 1024
+#define BENCH_RANGE_BYTES (64 * 1024) /* read from the middle of a file */
+#define BENCH_DEFAULT_RUNS 5
+#define BENCH_MAX_RUNS 100
+
+/*
+ * Everything an operation needs. Output the reader would print goes to
+ * /dev/null.
+ */
+typedef struct bench_ctx {
+   const char *image;
+   image_info *info;
+   ext2_fs *fs;
+   int use_mmap;
+   int threads;
+   int null_fd;
+   FILE *null_out;
+   char *batch_input;
+   size_t batch_len;
+   char restore_dir[64];
+   char index_path[64];
+} bench_ctx;
+
+typedef struct bench_op {
+   const char *name;
+   void (*run)(bench_ctx *ctx);
+   void (*setup)(bench_ctx *ctx); /* untimed, before each run */
+   void (*cleanup)(bench_ctx *ctx); /* untimed, after each run */
+} bench_op;
+
+/*
+ * Splits the absolute path |path| into its directory and its last
+ * component, in place
+ */
+static char *split_path(char *path) {
+   char *slash = strrchr(path, '/');
+
+   *slash = '\0';
+   return slash + 1;
+}
+
+static void run_find_dir(bench_ctx *ctx) {
+   find_dir(ctx->fs, ctx->info->deepest_dir);
+}
+
+static void run_list_entries(bench_ctx *ctx) {
+   list_entries(ctx->fs, find_dir(ctx->fs, ctx->info->largest_dir), SORT_NONE,
+         NULL);
+}
+
+static void run_list_sorted(bench_ctx *ctx) {
+   list_entries(ctx->fs, find_dir(ctx->fs, ctx->info->largest_dir), SORT_NAME,
+         NULL);
+}
+
+/*
+ * Resolves every file path one component at a time
+ */
+static void run_lookup(bench_ctx *ctx) {
+   uint32_t i, ino;
+   char *path, *name, *save;
+
+   for (i = 0; i < ctx->info->files; i++) {
+      path = strdup(ctx->info->paths[i]);
+      ino = EXT2_ROOT_INO;
+      for (name = strtok_r(path, "/", &save); name && ino;
+            name = strtok_r(NULL, "/", &save))
+         ino = dir_lookup(ctx->fs, ino, name, strlen(name));
+      free(path);
+   }
+}
+
+static void run_dump_file(bench_ctx *ctx) {
+   char *path = strdup(ctx->info->largest_file), *name = split_path(path);
+
+   dump_file(ctx->fs, find_dir(ctx->fs, *path ? path : "/"), name);
+   free(path);
+}
+
+static void run_extract_file(bench_ctx *ctx) {
+   char *path = strdup(ctx->info->largest_file), *name = split_path(path);
+
+   extract_file(ctx->fs, find_dir(ctx->fs, *path ? path : "/"), name,
+         ctx->null_fd);
+   free(path);
+}
+
+/*
+ * Reads BENCH_RANGE_BYTES from the middle of the largest file, which the
+ * block pointer tree is descended straight to
+ */
+static void run_read_range(bench_ctx *ctx) {
+   char *path = strdup(ctx->info->largest_file), *name = split_path(path);
+
+   read_range(ctx->fs, find_dir(ctx->fs, *path ? path : "/"), name,
+         ctx->info->largest_size / 2, BENCH_RANGE_BYTES, ctx->null_fd);
+   free(path);
+}
+
+static void run_batch(bench_ctx *ctx) {
+   FILE *in = fmemopen(ctx->batch_input, ctx->batch_len, "r");
+
+   resolve_batch(ctx->fs, in, ctx->null_out);
+   fclose(in);
+}
+
+static void run_walk(bench_ctx *ctx) {
+   walk_tree(ctx->fs, EXT2_ROOT_INO, "/", ctx->threads, 0, NULL,
+         ctx->null_out);
+}
+
+static void run_walk_ordered(bench_ctx *ctx) {
+   walk_tree(ctx->fs, EXT2_ROOT_INO, "/", ctx->threads, 1, NULL,
+         ctx->null_out);
+}
+
+static void run_restore(bench_ctx *ctx) {
+   restore_tree(ctx->fs, EXT2_ROOT_INO, ctx->restore_dir, ctx->threads);
+}
+
+static void run_usage(bench_ctx *ctx) {
+   usage_report report;
+
+   if (!compute_usage(ctx->fs, ctx->threads, &report))
+      free_usage(&report);
+}
+
+static void run_grep(bench_ctx *ctx) {
+   static const char needle[] = "ext2bench";
+   grep_pattern pattern = { (const uint8_t *) needle, sizeof(needle) - 1 };
+
+   grep_image(ctx->fs, &pattern, 1, ctx->threads, ctx->null_out);
+}
+
+static void run_checksum(bench_ctx *ctx) {
+   checksum_tree(ctx->fs, ctx->threads, ctx->null_out);
+}
+
+/*
+ * Finds the files over 64K by their inodes, then their paths, as -f does
+ */
+static void run_find(bench_ctx *ctx) {
+   scan_query query;
+   uint32_t *matches;
+   size_t count;
+
+   query_init(&query);
+   parse_predicate(&query, "type=f");
+   parse_predicate(&query, "size>64K");
+   if (!scan_inodes(ctx->fs, &query, ctx->threads, &matches, &count)) {
+      print_matches(ctx->fs, matches, count, ctx->null_out);
+      free(matches);
+   }
+}
+
+/*
+ * Attaches the index built before the runs, so that lookups and block runs
+ * come from it
+ */
+static void attach_index(bench_ctx *ctx) {
+   if (sidecar_open(ctx->fs, ctx->index_path, 0)) {
+      perror("\nError: could not open the sidecar index");
+      exit(1);
+   }
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+      struct FTW *ftw) {
+   (void) st;
+   (void) flag;
+   (void) ftw;
+   return remove(path);
+}
+
+static void cleanup_restore(bench_ctx *ctx) {
+   nftw(ctx->restore_dir, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static const bench_op ops[] = {
+   { "find_dir", run_find_dir, NULL, NULL },
+   { "list_entries", run_list_entries, NULL, NULL },
+   { "list_sorted", run_list_sorted, NULL, NULL },
+   { "dir_lookup", run_lookup, NULL, NULL },
+   { "index_lookup", run_lookup, attach_index, NULL },
+   { "dump_file", run_dump_file, NULL, NULL },
+   { "extract_file", run_extract_file, NULL, NULL },
+   { "read_range", run_read_range, NULL, NULL },
+   { "batch", run_batch, NULL, NULL },
+   { "walk", run_walk, NULL, NULL },
+   { "walk_ordered", run_walk_ordered, NULL, NULL },
+   { "restore", run_restore, NULL, cleanup_restore },
+   { "usage", run_usage, NULL, NULL },
+   { "find", run_find, NULL, NULL },
+   { "grep", run_grep, NULL, NULL },
+   { "checksum", run_checksum, NULL, NULL },
+};
+
+static void usage(void) {
+   fprintf(stderr,
+         "\nUsage: \n"
+               "     ext2bench [-km] [-n files] [-s min:max] [-f fanout] [-F pct]\n"
+               "               [-b block_size] [-r seed] [-i runs] [-j threads]\n"
+               "               [-o image]\n"
+               "\nOptions:\n"
+               "     -n    number of files in the generated image (default 20000)\n"
+               "     -s    file size range in bytes, log-uniform (default 0:262144)\n"
+               "     -f    entries per directory (default 256)\n"
+               "     -F    percentage of files scattered in small pieces (default 10)\n"
+               "     -b    block size of the image: 1024, 2048 or 4096 (default 1024)\n"
+               "     -r    generator seed (default 1)\n"
+               "     -i    timed runs per operation and cache state (default 5)\n"
+               "     -j    threads for the parallel operations (default: one per CPU)\n"
+               "     -m    memory-map the image\n"
+               "     -o    where to write the image (default ext2bench.img); its\n"
+               "           sidecar index goes next to it\n"
+               "     -k    keep the image and its index afterwards\n");
+   exit(1);
+}
+
+/*
+ * Drops a file from the page cache. Only clean pages can be dropped, so the
+ * generated image and its index are synced once beforehand.
+ */
+static void evict_file(const char *path) {
+   int fd = open(path, O_RDONLY);
+
+   if (fd >= 0) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+   }
+}
+
+static long elapsed_us(struct timespec *start, struct timespec *end) {
+   return (end->tv_sec - start->tv_sec) * 1000000L
+         + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+static int by_value(const void *a, const void *b) {
+   long x = *(const long *) a, y = *(const long *) b;
+   return (x > y) - (x < y);
+}
+
+static void time_op(bench_ctx *ctx, const bench_op *op, int cold, int runs,
+      FILE *results) {
+   long samples[BENCH_MAX_RUNS];
+   struct timespec start, end;
+   int i;
+
+   for (i = 0; i < runs; i++) {
+      if (cold) {
+         evict_file(ctx->image);
+         evict_file(ctx->index_path);
+      }
+
+      ctx->fs = open_image(ctx->image, ctx->use_mmap, CACHE_DEFAULT_BLOCKS);
+      if (!ctx->fs) {
+         perror("\nError: could not open the generated image");
+         exit(1);
+      }
+      if (op->setup)
+         op->setup(ctx);
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      op->run(ctx);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      samples[i] = elapsed_us(&start, &end);
+
+      close_image(ctx->fs);
+      if (op->cleanup)
+         op->cleanup(ctx);
+   }
+
+   qsort(samples, runs, sizeof(long), by_value);
+   fprintf(results, "{\"op\":\"%s\",\"cache\":\"%s\",\"runs\":%d,"
+         "\"min_us\":%ld,\"median_us\":%ld,\"max_us\":%ld}\n", op->name,
+         cold ? "cold" : "warm", runs, samples[0], samples[runs / 2],
+         samples[runs - 1]);
+   fflush(results);
+}
+
+int main(int argc, char **argv) {
+   image_spec spec = { BENCH_DEFAULT_FILES, 0, BENCH_DEFAULT_MAX_SIZE,
+         BENCH_DEFAULT_FANOUT, BENCH_DEFAULT_FRAGMENT_PCT, 1,
+         BENCH_DEFAULT_BLOCK_SIZE };
+   image_info info;
+   bench_ctx ctx = { 0 };
+   const char *image = "ext2bench.img";
+   int c, runs = BENCH_DEFAULT_RUNS, keep = 0, fd, cold;
+   size_t i, len;
+   FILE *results;
+   ext2_fs *fs;
+
+   ctx.threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+   while ((c = getopt(argc, argv, "n:s:f:F:b:r:i:j:o:km")) != -1) {
+      switch (c) {
+      case 'n':
+         spec.files = strtoul(optarg, NULL, 10);
+         break;
+      case 's':
+         if (sscanf(optarg, "%lld:%lld", (long long *) &spec.min_size,
+               (long long *) &spec.max_size) != 2)
+            usage();
+         break;
+      case 'f':
+         spec.fanout = strtoul(optarg, NULL, 10);
+         break;
+      case 'F':
+         spec.fragment_pct = strtoul(optarg, NULL, 10);
+         break;
+      case 'b':
+         spec.block_size = strtoul(optarg, NULL, 10);
+         break;
+      case 'r':
+         spec.seed = strtoul(optarg, NULL, 10);
+         break;
+      case 'i':
+         runs = atoi(optarg);
+         break;
+      case 'j':
+         ctx.threads = atoi(optarg);
+         break;
+      case 'o':
+         image = optarg;
+         break;
+      case 'k':
+         keep = 1;
+         break;
+      case 'm':
+         ctx.use_mmap = 1;
+         break;
+      default:
+         usage();
+      }
+   }
+
+   if (optind != argc || runs < 1 || runs > BENCH_MAX_RUNS || !spec.fanout
+         || spec.fragment_pct > 100 || (spec.block_size != 1024
+         && spec.block_size != 2048 && spec.block_size != 4096))
+      usage();
+
+   if (generate_image(image, &spec, &info)) {
+      perror("\nError: could not generate the image");
+      return 1;
+   }
+
+   // the index is built once, untimed, for the operations that use it
+   snprintf(ctx.index_path, sizeof(ctx.index_path), "%s%s", image,
+         SIDECAR_SUFFIX);
+   fs = open_image(image, 0, CACHE_DEFAULT_BLOCKS);
+   if (!fs || sidecar_build(fs, ctx.index_path)) {
+      perror("\nError: could not build the sidecar index");
+      return 1;
+   }
+   close_image(fs);
+
+   for (i = 0; i < 2; i++) {
+      fd = open(i ? ctx.index_path : image, O_RDONLY);
+      if (fd >= 0) {
+         fsync(fd);
+         close(fd);
+      }
+   }
+
+   // the reader writes listings and file contents to stdout
+   results = fdopen(dup(STDOUT_FILENO), "w");
+   ctx.null_fd = open("/dev/null", O_WRONLY);
+   ctx.null_out = fdopen(dup(ctx.null_fd), "w");
+   if (!results || ctx.null_fd < 0 || !ctx.null_out) {
+      perror("\nError: could not set up output");
+      return 1;
+   }
+   fflush(stdout);
+   dup2(ctx.null_fd, STDOUT_FILENO);
+
+   ctx.image = image;
+   ctx.info = &info;
+   snprintf(ctx.restore_dir, sizeof(ctx.restore_dir), "%s.restore", image);
+
+   for (i = 0, len = 0; i < info.files; i++)
+      len += strlen(info.paths[i]) + 1;
+   ctx.batch_input = malloc(len + 1);
+   for (i = 0, ctx.batch_len = 0; i < info.files; i++)
+      ctx.batch_len += sprintf(ctx.batch_input + ctx.batch_len, "%s\n",
+            info.paths[i]);
+
+   fprintf(results, "{\"bench\":\"ext2reader\",\"files\":%u,\"dirs\":%u,"
+         "\"data_bytes\":%lld,\"block_size\":%u,\"blocks\":%u,\"groups\":%u,"
+         "\"min_size\":%lld,\"max_size\":%lld,\"fanout\":%u,"
+         "\"fragment_pct\":%u,\"seed\":%u,"
+         "\"mmap\":%d,\"threads\":%d,\"kernel\":\"%s\","
+         "\"popcount\":\"%s\",\"search\":\"%s\","
+         "\"crc32c\":\"%s\"}\n", info.files,
+         info.dirs, (long long) info.data_bytes, spec.block_size, info.blocks,
+         info.groups, (long long) spec.min_size, (long long) spec.max_size,
+         spec.fanout,
+         spec.fragment_pct, spec.seed, ctx.use_mmap, ctx.threads,
+         match_kernel(), usage_kernel(), grep_kernel(),
+         crc32c_kernel());
+
+   for (cold = 1; cold >= 0; cold--)
+      for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+         // operations on files need at least one file
+         if (!info.largest_file && (ops[i].run == run_dump_file
+               || ops[i].run == run_extract_file
+               || ops[i].run == run_read_range))
+            continue;
+         time_op(&ctx, &ops[i], cold, runs, results);
+      }
+
+   free(ctx.batch_input);
+   free_image_info(&info);
+   fclose(ctx.null_out);
+   close(ctx.null_fd);
+   fclose(results);
+   if (!keep) {
+      unlink(image);
+      unlink(ctx.index_path);
+   }
+   return 0;
+}
@@ -0,0 +1,746 @@
+/*
+ * genimage.c
+ *
+ * Synthetic ext2 image generator, see genimage.h
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "genimage.h"
+
+#define GEN_PATTERN_SIZE (1024 * 1024)
+#define GEN_MAX_PTRS (GEN_MAX_BLOCK_SIZE / sizeof(uint32_t))
+#define GEN_NONE ((uint32_t) -1)
+#define GEN_MAX_PIECE 8 /* blocks per piece of a scattered file */
+#define GEN_MAX_GAP 8 /* free blocks left after each piece */
+
+/*
+ * A file or directory of the tree being generated
+ */
+typedef struct gen_node {
+   uint32_t parent;
+   uint32_t first_child;
+   uint32_t last_child;
+   uint32_t next_sibling;
+   uint32_t child_count;
+   uint32_t subdirs;
+   uint32_t depth;
+   uint32_t inode;
+   off_t size;
+   int is_dir;
+   char name[24];
+} gen_node;
+
+typedef struct generator {
+   int fd;
+   const image_spec *spec;
+   uint32_t block_size;
+   uint32_t blocks_per_group; /* one bitmap block's worth */
+   uint32_t ptrs_per_block;
+   uint32_t first_data_block; /* block of the superblock, 0 past 1K */
+   uint32_t rng;
+   gen_node *nodes;
+   uint32_t count;
+   uint32_t capacity;
+   uint32_t *order; /* nodes in inode order */
+   uint32_t groups;
+   uint32_t inodes_per_group;
+   uint32_t gdt_blocks;
+   uint32_t itable_blocks;
+   uint32_t blocks_count;
+   uint32_t last_inode;
+   uint8_t *inode_tables;
+   uint8_t *block_bitmaps;
+   uint32_t cursor; /* next block to hand out */
+   uint32_t piece_left; /* blocks left in the current scattered piece */
+   uint32_t run_start; /* data blocks not written out yet */
+   uint32_t run_len;
+   uint8_t *pattern;
+} generator;
+
+static uint32_t next_random(generator *gen) {
+   uint32_t x = gen->rng;
+
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   return gen->rng = x;
+}
+
+static uint32_t add_node(generator *gen, uint32_t parent, int is_dir) {
+   gen_node *node, *up;
+
+   if (gen->count == gen->capacity) {
+      uint32_t capacity = gen->capacity ? gen->capacity * 2 : 1024;
+      gen_node *nodes = realloc(gen->nodes, capacity * sizeof(gen_node));
+      if (!nodes)
+         return GEN_NONE;
+      gen->nodes = nodes;
+      gen->capacity = capacity;
+   }
+
+   node = &gen->nodes[gen->count];
+   memset(node, 0, sizeof(gen_node));
+   node->parent = parent;
+   node->first_child = node->last_child = node->next_sibling = GEN_NONE;
+   node->is_dir = is_dir;
+
+   if (gen->count) {
+      up = &gen->nodes[parent];
+      node->depth = up->depth + 1;
+      snprintf(node->name, sizeof(node->name), is_dir ? "dir%u" : "file%u.dat",
+            up->child_count);
+      if (up->last_child == GEN_NONE)
+         up->first_child = gen->count;
+      else
+         gen->nodes[up->last_child].next_sibling = gen->count;
+      up->last_child = gen->count;
+      up->child_count++;
+      up->subdirs += is_dir;
+   }
+
+   return gen->count++;
+}
+
+/*
+ * File sizes are log-uniform: a power of two range is picked uniformly,
+ * then a size inside it
+ */
+static off_t pick_size(generator *gen) {
+   off_t lo = gen->spec->min_size, hi = gen->spec->max_size, base, span, size;
+   int bits_lo = 0, bits_hi = 0, bits;
+
+   if (hi > GEN_MAX_FILE_SIZE)
+      hi = GEN_MAX_FILE_SIZE;
+   if (lo > hi)
+      lo = hi;
+   if (lo == hi)
+      return lo;
+
+   while (((off_t) 1 << bits_lo) < lo + 1)
+      bits_lo++;
+   while (((off_t) 1 << bits_hi) < hi + 1)
+      bits_hi++;
+
+   bits = bits_lo + next_random(gen) % (bits_hi - bits_lo + 1);
+   base = bits ? (off_t) 1 << (bits - 1) : 0;
+   span = base < lo ? lo : base;
+   span = (base > hi - span ? hi - base : span) + 1;
+   size = base + (off_t) (next_random(gen) % (uint32_t) span);
+   return size < lo ? lo : size;
+}
+
+/*
+ * Builds the directory tree: files fill leaf directories |fanout| at a
+ * time, and directories are grouped |fanout| at a time into parents until
+ * one level fits under the root
+ */
+static int build_tree(generator *gen) {
+   uint32_t fanout = gen->spec->fanout ? gen->spec->fanout : 1;
+   uint32_t levels[32], nlevels = 0, level, start, prev_start = 0, i;
+
+   if (add_node(gen, 0, 1) == GEN_NONE || add_node(gen, 0, 1) == GEN_NONE)
+      return -1;
+   strcpy(gen->nodes[1].name, "lost+found");
+
+   levels[0] = gen->spec->files ? (gen->spec->files + fanout - 1) / fanout : 0;
+   for (nlevels = 1; levels[nlevels - 1] > fanout && nlevels < 32; nlevels++)
+      levels[nlevels] = (levels[nlevels - 1] + fanout - 1) / fanout;
+
+   for (level = nlevels; level-- > 0;) {
+      start = gen->count;
+      for (i = 0; i < levels[level]; i++)
+         if (add_node(gen, level == nlevels - 1 ? 0 : prev_start + i / fanout,
+               1) == GEN_NONE)
+            return -1;
+      prev_start = start;
+   }
+
+   for (i = 0; i < gen->spec->files; i++) {
+      uint32_t node = add_node(gen, prev_start + i / fanout, 0);
+      if (node == GEN_NONE)
+         return -1;
+      gen->nodes[node].size = pick_size(gen);
+   }
+   return 0;
+}
+
+/*
+ * Numbers the inodes in depth-first order so that a directory's inode and
+ * data sit next to those of its contents. |order| lists the nodes in inode
+ * order, which is also the order their blocks are allocated in.
+ */
+static int number_inodes(generator *gen) {
+   uint32_t *stack = malloc(gen->count * sizeof(uint32_t));
+   uint32_t top = 0, at, n = 0, node, child, ino = EXT2_GOOD_OLD_FIRST_INO + 1;
+
+   gen->order = malloc(gen->count * sizeof(uint32_t));
+   if (!stack || !gen->order) {
+      free(stack);
+      return -1;
+   }
+
+   gen->nodes[0].inode = EXT2_ROOT_INO;
+   gen->nodes[1].inode = EXT2_GOOD_OLD_FIRST_INO;
+   gen->order[n++] = 0;
+   gen->order[n++] = 1;
+
+   stack[top++] = 0;
+   while (top) {
+      node = stack[--top];
+      if (node > 1) {
+         gen->nodes[node].inode = ino++;
+         gen->order[n++] = node;
+      }
+
+      // push in reverse so children come out in directory order
+      at = top += gen->nodes[node].child_count - !node;
+      for (child = gen->nodes[node].first_child; child != GEN_NONE;
+            child = gen->nodes[child].next_sibling)
+         if (child != 1)
+            stack[--at] = child;
+   }
+
+   gen->last_inode = ino - 1;
+   free(stack);
+   return 0;
+}
+
+static uint32_t dir_blocks(generator *gen, uint32_t node) {
+   uint32_t blocks = 1, pos = 24, len, child;
+
+   for (child = gen->nodes[node].first_child; child != GEN_NONE;
+         child = gen->nodes[child].next_sibling) {
+      len = (8 + strlen(gen->nodes[child].name) + 3) & ~3;
+      if (pos + len > gen->block_size) {
+         blocks++;
+         pos = 0;
+      }
+      pos += len;
+   }
+   return blocks;
+}
+
+static uint32_t blocks_with_indirect(generator *gen, off_t size) {
+   uint32_t blocks = (size + gen->block_size - 1) / gen->block_size, total;
+   uint32_t ptrs = gen->ptrs_per_block;
+
+   total = blocks;
+   if (blocks > EXT2_NDIR_BLOCKS)
+      total++;
+   if (blocks > EXT2_NDIR_BLOCKS + ptrs)
+      total += 1 + (blocks - EXT2_NDIR_BLOCKS - ptrs + ptrs - 1) / ptrs;
+   return total;
+}
+
+static uint32_t group_start(generator *gen, uint32_t group) {
+   return gen->first_data_block + group * gen->blocks_per_group;
+}
+
+static uint32_t data_start(generator *gen, uint32_t group) {
+   return group_start(gen, group) + 1 + gen->gdt_blocks + 2
+         + gen->itable_blocks;
+}
+
+/*
+ * Picks the group count and inodes per group so that every inode and,
+ * with some slack, every data block fits
+ */
+static int size_image(generator *gen) {
+   off_t needed = 64, scattered = 0;
+   uint32_t i, inodes = gen->count + EXT2_GOOD_OLD_FIRST_INO, per_block;
+
+   for (i = 0; i < gen->count; i++) {
+      gen_node *node = &gen->nodes[i];
+      off_t blocks = node->is_dir ? dir_blocks(gen, i)
+            : blocks_with_indirect(gen, node->size);
+      needed += blocks;
+      if (!node->is_dir)
+         scattered += blocks + 1;
+   }
+
+   // a scattered file leaves at most GEN_MAX_GAP free blocks per piece
+   needed += scattered * GEN_MAX_GAP * gen->spec->fragment_pct / 100;
+   needed += needed / 10;
+
+   // the inode table fills whole blocks
+   per_block = gen->block_size / GEN_INODE_SIZE;
+   for (gen->groups = 1;; gen->groups++) {
+      gen->inodes_per_group = (inodes + gen->groups - 1) / gen->groups;
+      gen->inodes_per_group = (gen->inodes_per_group + per_block - 1)
+            / per_block * per_block;
+      if (gen->inodes_per_group > gen->block_size * 8)
+         continue;
+
+      gen->gdt_blocks = (gen->groups * sizeof(ext2_group_desc)
+            + gen->block_size - 1) / gen->block_size;
+      gen->itable_blocks = gen->inodes_per_group / per_block;
+      if ((off_t) gen->groups * (gen->blocks_per_group - (data_start(gen, 0)
+            - gen->first_data_block)) >= needed)
+         break;
+   }
+
+   gen->blocks_count = group_start(gen, gen->groups);
+   return 0;
+}
+
+static void mark_block(generator *gen, uint32_t block) {
+   uint32_t bit = (block - gen->first_data_block) % gen->blocks_per_group;
+   uint8_t *bitmap = gen->block_bitmaps + (size_t) ((block
+         - gen->first_data_block) / gen->blocks_per_group) * gen->block_size;
+
+   bitmap[bit / 8] |= 1 << (bit % 8);
+}
+
+/*
+ * Hands out the next free block. Blocks of scattered files come in pieces
+ * of 1 to GEN_MAX_PIECE blocks with a gap of 1 to GEN_MAX_GAP free blocks
+ * in front of each piece.
+ */
+static uint32_t alloc_block(generator *gen, int scattered) {
+   uint32_t group;
+
+   if (scattered) {
+      if (!gen->piece_left) {
+         gen->cursor += 1 + next_random(gen) % GEN_MAX_GAP;
+         gen->piece_left = 1 + next_random(gen) % GEN_MAX_PIECE;
+      }
+      gen->piece_left--;
+   }
+
+   group = (gen->cursor - gen->first_data_block) / gen->blocks_per_group;
+   if (gen->cursor < data_start(gen, group))
+      gen->cursor = data_start(gen, group);
+   if (gen->cursor >= gen->blocks_count) {
+      errno = ENOSPC;
+      return 0;
+   }
+
+   mark_block(gen, gen->cursor);
+   return gen->cursor++;
+}
+
+static int write_block(generator *gen, uint32_t block, const void *data) {
+   return pwrite(gen->fd, data, gen->block_size,
+         (off_t) block * gen->block_size) == (ssize_t) gen->block_size ? 0
+         : -1;
+}
+
+/*
+ * Writes out the pending run of file data blocks
+ */
+static int flush_run(generator *gen) {
+   off_t pos = (off_t) gen->run_start * gen->block_size;
+   size_t len = (size_t) gen->run_len * gen->block_size, n;
+
+   for (; len; len -= n, pos += n) {
+      n = len < GEN_PATTERN_SIZE ? len : GEN_PATTERN_SIZE;
+      if (pwrite(gen->fd, gen->pattern, n, pos) != (ssize_t) n)
+         return -1;
+   }
+   gen->run_len = 0;
+   return 0;
+}
+
+static int add_data_block(generator *gen, uint32_t block) {
+   if (gen->run_len && gen->run_start + gen->run_len == block) {
+      gen->run_len++;
+      return 0;
+   }
+   if (flush_run(gen))
+      return -1;
+   gen->run_start = block;
+   gen->run_len = 1;
+   return 0;
+}
+
+/*
+ * Allocates |nblocks| blocks (plus indirect blocks) for |ino| and writes
+ * them: from |content| if given, otherwise with the file data pattern.
+ * Returns the number of blocks used, or 0 on failure.
+ */
+static uint32_t write_blocks(generator *gen, ext2_inode *ino, uint32_t nblocks,
+      const uint8_t *content, int scattered) {
+   uint32_t ind[GEN_MAX_PTRS], dind[GEN_MAX_PTRS];
+   uint32_t ind_block = 0, k, j, block, used = 0, ptrs = gen->ptrs_per_block;
+
+   for (k = 0; k < nblocks; k++) {
+      if (k == EXT2_NDIR_BLOCKS) {
+         ind_block = alloc_block(gen, scattered);
+         if (!ind_block)
+            return 0;
+         ino->i_block[EXT2_IND_BLOCK] = ind_block;
+         memset(ind, 0, sizeof(ind));
+         used++;
+      }
+      else if (k >= EXT2_NDIR_BLOCKS + ptrs) {
+         j = k - EXT2_NDIR_BLOCKS - ptrs;
+         if (!j) {
+            ino->i_block[EXT2_DIND_BLOCK] = alloc_block(gen, scattered);
+            if (!ino->i_block[EXT2_DIND_BLOCK])
+               return 0;
+            memset(dind, 0, sizeof(dind));
+            used++;
+         }
+         if (!(j % ptrs)) {
+            ind_block = alloc_block(gen, scattered);
+            if (!ind_block)
+               return 0;
+            dind[j / ptrs] = ind_block;
+            memset(ind, 0, sizeof(ind));
+            used++;
+         }
+      }
+
+      block = alloc_block(gen, scattered);
+      if (!block)
+         return 0;
+      used++;
+
+      if (k < EXT2_NDIR_BLOCKS)
+         ino->i_block[k] = block;
+      else if (k < EXT2_NDIR_BLOCKS + ptrs)
+         ind[k - EXT2_NDIR_BLOCKS] = block;
+      else
+         ind[(k - EXT2_NDIR_BLOCKS - ptrs) % ptrs] = block;
+
+      if (content ? write_block(gen, block, content + (size_t) k
+            * gen->block_size) : add_data_block(gen, block))
+         return 0;
+
+      // write each pointer block once it is full or the file ends
+      if (k >= EXT2_NDIR_BLOCKS && (k + 1 == nblocks || (k + 1
+            - EXT2_NDIR_BLOCKS) % ptrs == 0)
+            && write_block(gen, ind_block, ind))
+         return 0;
+   }
+
+   if (nblocks > EXT2_NDIR_BLOCKS + ptrs
+         && write_block(gen, ino->i_block[EXT2_DIND_BLOCK], dind))
+      return 0;
+   return used;
+}
+
+static ext2_inode *inode_at(generator *gen, uint32_t ino_num) {
+   return (ext2_inode *) (gen->inode_tables
+         + (size_t) (ino_num - 1) * GEN_INODE_SIZE);
+}
+
+static void put_entry(generator *gen, uint8_t *buf, uint32_t *pos,
+      uint32_t *last, uint32_t inode, const char *name) {
+   uint32_t name_len = strlen(name), len = (8 + name_len + 3) & ~3;
+   uint32_t block_size = gen->block_size;
+   ext2_dir_entry *entry;
+
+   // start a new block, stretching the previous entry over the gap
+   if (*pos % block_size + len > block_size) {
+      ((ext2_dir_entry *) (buf + *last))->rec_len += block_size
+            - *pos % block_size;
+      *pos += block_size - *pos % block_size;
+   }
+
+   entry = (ext2_dir_entry *) (buf + *pos);
+   entry->inode = inode;
+   entry->rec_len = len;
+   entry->name_len = name_len;
+   entry->file_type = 0;
+   memcpy(entry->name, name, name_len);
+   *last = *pos;
+   *pos += len;
+}
+
+static int write_node(generator *gen, uint32_t index) {
+   gen_node *node = &gen->nodes[index];
+   ext2_inode *ino = inode_at(gen, node->inode);
+   uint32_t nblocks, used, pos = 0, last = 0, child;
+   int scattered;
+   uint8_t *buf;
+
+   ino->i_atime = ino->i_ctime = ino->i_mtime = GEN_TIMESTAMP;
+
+   if (!node->is_dir) {
+      ino->i_mode = 0100644;
+      ino->i_links_count = 1;
+      ino->i_size = node->size;
+      nblocks = (node->size + gen->block_size - 1) / gen->block_size;
+      scattered = next_random(gen) % 100 < gen->spec->fragment_pct;
+      gen->piece_left = 0;
+      used = write_blocks(gen, ino, nblocks, NULL, scattered);
+      if (nblocks && !used)
+         return -1;
+      ino->i_blocks = used * (gen->block_size / 512);
+      return 0;
+   }
+
+   nblocks = dir_blocks(gen, index);
+   buf = calloc(nblocks, gen->block_size);
+   if (!buf)
+      return -1;
+
+   put_entry(gen, buf, &pos, &last, node->inode, ".");
+   put_entry(gen, buf, &pos, &last, gen->nodes[node->parent].inode, "..");
+   for (child = node->first_child; child != GEN_NONE;
+         child = gen->nodes[child].next_sibling)
+      put_entry(gen, buf, &pos, &last, gen->nodes[child].inode,
+            gen->nodes[child].name);
+   ((ext2_dir_entry *) (buf + last))->rec_len += nblocks * gen->block_size
+         - pos;
+
+   ino->i_mode = index == 1 ? 040700 : 040755;
+   ino->i_links_count = 2 + node->subdirs;
+   ino->i_size = nblocks * gen->block_size;
+   used = write_blocks(gen, ino, nblocks, buf, 0);
+   ino->i_blocks = used * (gen->block_size / 512);
+   free(buf);
+   return used ? 0 : -1;
+}
+
+/*
+ * Writes the superblock, descriptors, bitmaps and inode table of every
+ * group
+ */
+static int write_metadata(generator *gen, ext2_super_block *sb) {
+   ext2_group_desc *gdt = calloc(gen->gdt_blocks, gen->block_size);
+   uint8_t bitmap[GEN_MAX_BLOCK_SIZE];
+   size_t gdt_size = (size_t) gen->gdt_blocks * gen->block_size;
+   off_t sb_pos;
+   uint32_t g, b, i, base, used, free_blocks = 0, free_inodes = 0, node;
+   int err = 0;
+
+   if (!gdt)
+      return -1;
+
+   for (node = 0; node < gen->count; node++)
+      if (gen->nodes[node].is_dir)
+         gdt[(gen->nodes[node].inode - 1) / gen->inodes_per_group]
+               .bg_used_dirs_count++;
+
+   for (g = 0; g < gen->groups; g++) {
+      uint8_t *blocks = gen->block_bitmaps + (size_t) g * gen->block_size;
+
+      base = group_start(gen, g);
+      gdt[g].bg_block_bitmap = base + 1 + gen->gdt_blocks;
+      gdt[g].bg_inode_bitmap = base + 2 + gen->gdt_blocks;
+      gdt[g].bg_inode_table = base + 3 + gen->gdt_blocks;
+
+      for (b = 0, used = 0; b < gen->blocks_per_group; b++)
+         used += blocks[b / 8] >> (b % 8) & 1;
+      gdt[g].bg_free_blocks_count = gen->blocks_per_group - used;
+
+      used = 0;
+      if (gen->last_inode > g * gen->inodes_per_group)
+         used = gen->last_inode - g * gen->inodes_per_group;
+      if (used > gen->inodes_per_group)
+         used = gen->inodes_per_group;
+      gdt[g].bg_free_inodes_count = gen->inodes_per_group - used;
+
+      free_blocks += gdt[g].bg_free_blocks_count;
+      free_inodes += gdt[g].bg_free_inodes_count;
+   }
+
+   sb->s_free_blocks_count = free_blocks;
+   sb->s_free_inodes_count = free_inodes;
+
+   for (g = 0; g < gen->groups && !err; g++) {
+      base = group_start(gen, g);
+      sb->s_block_group_nr = g;
+
+      // the first superblock is always 1024 bytes in, past the boot block
+      sb_pos = base ? (off_t) base * gen->block_size : EXT2_MIN_BLOCK_SIZE;
+
+      // inode bitmap: used inodes, then padding past the group's inodes
+      memset(bitmap, 0, sizeof(bitmap));
+      for (i = 0; i < gen->block_size * 8; i++)
+         if (i >= gen->inodes_per_group
+               || g * gen->inodes_per_group + i < gen->last_inode)
+            bitmap[i / 8] |= 1 << (i % 8);
+
+      err = pwrite(gen->fd, sb, sizeof(*sb), sb_pos) != sizeof(*sb)
+            || pwrite(gen->fd, gdt, gdt_size,
+                  (off_t) (base + 1) * gen->block_size) != (ssize_t) gdt_size
+            || write_block(gen, gdt[g].bg_block_bitmap,
+                  gen->block_bitmaps + (size_t) g * gen->block_size)
+            || write_block(gen, gdt[g].bg_inode_bitmap, bitmap)
+            || pwrite(gen->fd, gen->inode_tables + (size_t) g
+                  * gen->inodes_per_group * GEN_INODE_SIZE,
+                  (size_t) gen->itable_blocks * gen->block_size,
+                  (off_t) gdt[g].bg_inode_table * gen->block_size)
+                  != (ssize_t) ((size_t) gen->itable_blocks * gen->block_size);
+   }
+
+   free(gdt);
+   return err ? -1 : 0;
+}
+
+static void init_super(generator *gen, ext2_super_block *sb) {
+   uint32_t i;
+
+   memset(sb, 0, sizeof(*sb));
+   sb->s_inodes_count = gen->groups * gen->inodes_per_group;
+   sb->s_blocks_count = gen->blocks_count;
+   sb->s_first_data_block = gen->first_data_block;
+   for (i = EXT2_MIN_BLOCK_SIZE; i < gen->block_size; i <<= 1)
+      sb->s_log_block_size++;
+   sb->s_log_frag_size = sb->s_log_block_size;
+   sb->s_blocks_per_group = gen->blocks_per_group;
+   sb->s_frags_per_group = gen->blocks_per_group;
+   sb->s_inodes_per_group = gen->inodes_per_group;
+   sb->s_wtime = sb->s_lastcheck = sb->s_mkfs_time = GEN_TIMESTAMP;
+   sb->s_max_mnt_count = 0xffff;
+   sb->s_magic = EXT2_SUPER_MAGIC;
+   sb->s_state = 1;
+   sb->s_errors = 1;
+   sb->s_rev_level = EXT2_DYNAMIC_REV;
+   sb->s_first_ino = EXT2_GOOD_OLD_FIRST_INO;
+   sb->s_inode_size = GEN_INODE_SIZE;
+   for (i = 0; i < sizeof(sb->s_uuid); i++)
+      sb->s_uuid[i] = next_random(gen);
+   strcpy(sb->s_volume_name, "ext2bench");
+}
+
+/*
+ * Returns the absolute path of |node| in a new string
+ */
+static char *node_path(generator *gen, uint32_t node) {
+   size_t len = 0, at;
+   uint32_t n;
+   char *path;
+
+   for (n = node; n; n = gen->nodes[n].parent)
+      len += 1 + strlen(gen->nodes[n].name);
+   path = malloc(len + 2);
+   if (!path)
+      return NULL;
+
+   strcpy(path, "/");
+   path[len] = '\0';
+   for (n = node, at = len; n; n = gen->nodes[n].parent) {
+      size_t name_len = strlen(gen->nodes[n].name);
+      at -= name_len;
+      memcpy(path + at, gen->nodes[n].name, name_len);
+      path[--at] = '/';
+   }
+   return path;
+}
+
+static int fill_info(generator *gen, image_info *info) {
+   uint32_t i, node, deepest = 0, largest_dir = 0, largest_file = GEN_NONE;
+
+   memset(info, 0, sizeof(*info));
+   info->groups = gen->groups;
+   info->blocks = gen->blocks_count;
+   info->paths = calloc(gen->spec->files + 1, sizeof(char *));
+   if (!info->paths)
+      return -1;
+
+   for (i = 0; i < gen->count; i++) {
+      node = gen->order[i];
+      if (gen->nodes[node].is_dir) {
+         info->dirs++;
+         if (gen->nodes[node].depth > gen->nodes[deepest].depth)
+            deepest = node;
+         if (gen->nodes[node].child_count
+               > gen->nodes[largest_dir].child_count)
+            largest_dir = node;
+         continue;
+      }
+
+      info->data_bytes += gen->nodes[node].size;
+      if (largest_file == GEN_NONE
+            || gen->nodes[node].size > gen->nodes[largest_file].size)
+         largest_file = node;
+      info->paths[info->files] = node_path(gen, node);
+      if (!info->paths[info->files++])
+         return -1;
+   }
+
+   info->deepest_dir = node_path(gen, deepest);
+   info->largest_dir = node_path(gen, largest_dir);
+   if (largest_file != GEN_NONE) {
+      info->largest_file = node_path(gen, largest_file);
+      info->largest_size = gen->nodes[largest_file].size;
+   }
+   return info->deepest_dir && info->largest_dir ? 0 : -1;
+}
+
+int generate_image(const char *path, const image_spec *spec,
+      image_info *info) {
+   generator gen = { 0 };
+   ext2_super_block sb;
+   uint32_t g, b, i;
+   int err = -1;
+
+   gen.spec = spec;
+   gen.rng = spec->seed ? spec->seed : 1;
+   memset(info, 0, sizeof(*info));
+
+   if (spec->block_size != 1024 && spec->block_size != 2048
+         && spec->block_size != 4096) {
+      errno = EINVAL;
+      return -1;
+   }
+   gen.block_size = spec->block_size;
+   gen.blocks_per_group = spec->block_size * 8;
+   gen.ptrs_per_block = spec->block_size / sizeof(uint32_t);
+   gen.first_data_block = spec->block_size == EXT2_MIN_BLOCK_SIZE;
+
+   errno = ENOMEM;
+   if (build_tree(&gen) || number_inodes(&gen) || size_image(&gen))
+      goto done;
+
+   gen.inode_tables = calloc((size_t) gen.groups * gen.inodes_per_group,
+         GEN_INODE_SIZE);
+   gen.block_bitmaps = calloc(gen.groups, gen.block_size);
+   gen.pattern = malloc(GEN_PATTERN_SIZE);
+   if (!gen.inode_tables || !gen.block_bitmaps || !gen.pattern)
+      goto done;
+   for (i = 0; i < GEN_PATTERN_SIZE; i++)
+      gen.pattern[i] = next_random(&gen);
+
+   gen.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (gen.fd < 0)
+      goto done;
+   if (ftruncate(gen.fd, (off_t) gen.blocks_count * gen.block_size))
+      goto close;
+
+   // every group's metadata blocks are in use
+   for (g = 0; g < gen.groups; g++)
+      for (b = group_start(&gen, g); b < data_start(&gen, g); b++)
+         mark_block(&gen, b);
+   gen.cursor = data_start(&gen, 0);
+
+   init_super(&gen, &sb);
+   for (i = 0; i < gen.count; i++)
+      if (write_node(&gen, gen.order[i]))
+         goto close;
+
+   if (flush_run(&gen) || write_metadata(&gen, &sb) || fill_info(&gen, info))
+      goto close;
+   err = 0;
+
+close:
+   if (close(gen.fd))
+      err = -1;
+done:
+   free(gen.nodes);
+   free(gen.order);
+   free(gen.inode_tables);
+   free(gen.block_bitmaps);
+   free(gen.pattern);
+   return err;
+}
+
+void free_image_info(image_info *info) {
+   uint32_t i;
+
+   for (i = 0; info->paths && i < info->files; i++)
+      free(info->paths[i]);
+   free(info->paths);
+   free(info->deepest_dir);
+   free(info->largest_dir);
+   free(info->largest_file);
+   memset(info, 0, sizeof(*info));
+}
@@ -0,0 +1,63 @@
+/*
+ * genimage.h
+ *
+ * Reproducible synthetic ext2 images for benchmarking. An image is fully
+ * described by an image_spec: the same spec (including the seed) always
+ * produces the same bytes. Images use 1K, 2K or 4K blocks, 128-byte inodes
+ * and no optional features, with a superblock and group descriptor copy in
+ * every group, and pass e2fsck.
+ */
+
+#ifndef GENIMAGE_H_
+#define GENIMAGE_H_
+
+#include <sys/types.h>
+#include "../src/ext2.h"
+
+#define GEN_MIN_BLOCK_SIZE EXT2_MIN_BLOCK_SIZE
+#define GEN_MAX_BLOCK_SIZE EXT2_MAX_BLOCK_SIZE
+#define GEN_INODE_SIZE 128
+#define GEN_MAX_FILE_SIZE ((off_t) 64 * 1024 * 1024) /* double indirect */
+#define GEN_TIMESTAMP 1400000000
+
+typedef struct image_spec {
+   uint32_t files; /* regular files in the tree */
+   off_t min_size; /* file sizes are log-uniform in [min_size, max_size] */
+   off_t max_size;
+   uint32_t fanout; /* entries per directory */
+   uint32_t fragment_pct; /* % of files scattered in short runs with gaps */
+   uint32_t seed;
+   uint32_t block_size; /* 1024, 2048 or 4096; a group spans 8 per byte */
+} image_spec;
+
+/*
+ * What was generated, for picking benchmark targets. Paths are absolute
+ * inside the image.
+ */
+typedef struct image_info {
+   uint32_t dirs;
+   uint32_t files;
+   off_t data_bytes;
+   uint32_t blocks;
+   uint32_t groups;
+   char **paths; /* every regular file, in inode order */
+   char *deepest_dir;
+   char *largest_dir; /* the directory with the most entries */
+   char *largest_file;
+   off_t largest_size;
+} image_info;
+
+/*
+ * Writes the image described by |spec| to |path|, replacing any existing
+ * file, and fills in |info|. Returns 0 on success, -1 with errno set on
+ * failure (EINVAL for an unsupported block size).
+ */
+int generate_image(const char *path, const image_spec *spec,
+      image_info *info);
+
+/*
+ * Frees everything generate_image() allocated in |info|
+ */
+void free_image_info(image_info *info);
+
+#endif /* GENIMAGE_H_ */
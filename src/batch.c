@@ -0,0 +1,140 @@
+/*
+ * batch.c
+ *
+ * Trie based batch path resolution, see batch.h
+ */
+
+#include <string.h>
+#include "batch.h"
+#include "blockmap.h"
+#include "dir.h"
+#include "inode.h"
+#include "trie.h"
+
+/*
+ * State for matching the entries of one directory against the children
+ * of its trie node
+ */
+typedef struct dir_match {
+   path_trie *trie;
+   uint32_t node;
+   uint32_t left; /* children not found yet */
+} dir_match;
+
+static int match_entry(ext2_dir_entry *entry, void *arg) {
+   dir_match *match = arg;
+   uint32_t child = trie_child(match->trie, match->node, entry->name,
+         entry->name_len);
+
+   if (child != TRIE_NONE && !match->trie->nodes[child].inode) {
+      match->trie->nodes[child].inode = entry->inode;
+      match->left--;
+   }
+
+   // every wanted name in this directory is found, skip the rest of it
+   return !match->left;
+}
+
+int resolve_trie(ext2_fs *fs, path_trie *trie) {
+   uint32_t *stack, top = 0, node, child;
+   ext2_inode *ino;
+   dir_match match;
+   unsigned long start;
+
+   stack = malloc(trie->count * sizeof(uint32_t));
+   if (!stack)
+      return -1;
+
+   stack[top++] = TRIE_ROOT;
+   while (top) {
+      node = stack[--top];
+      ino = get_inode(fs, trie->nodes[node].inode);
+      if (inode_type(ino) != 'd')
+         continue;
+
+      match.trie = trie;
+      match.node = node;
+      match.left = trie->nodes[node].child_count;
+      start = stats_now();
+      if (iterate_dir(fs, ino, match_entry, &match) < 0) {
+         free(stack);
+         return -1;
+      }
+      stats_record(&fs->stats, STATS_RESOLVE, start);
+
+      for (child = trie->nodes[node].first_child; child != TRIE_NONE;
+            child = trie->nodes[child].next_sibling)
+         if (trie->nodes[child].inode && trie->nodes[child].child_count)
+            stack[top++] = child;
+   }
+
+   free(stack);
+   return 0;
+}
+
+long resolve_batch(ext2_fs *fs, FILE *in, FILE *out) {
+   path_trie *trie = trie_create();
+   char **paths = NULL, *line = NULL;
+   uint32_t *nodes = NULL;
+   size_t count = 0, capacity = 0, line_cap = 0, i;
+   ssize_t len;
+   long missing = -1;
+   ext2_inode *ino;
+
+   if (!trie)
+      return -1;
+
+   // load every path into the trie before touching the image
+   while ((len = getline(&line, &line_cap, in)) != -1) {
+      while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+         line[--len] = '\0';
+      if (!len)
+         continue;
+
+      if (count == capacity) {
+         capacity = capacity ? capacity * 2 : 1024;
+         char **more_paths = realloc(paths, capacity * sizeof(char *));
+         uint32_t *more_nodes = realloc(nodes, capacity * sizeof(uint32_t));
+         if (more_paths)
+            paths = more_paths;
+         if (more_nodes)
+            nodes = more_nodes;
+         if (!more_paths || !more_nodes)
+            goto done;
+      }
+
+      nodes[count] = trie_insert(trie, line);
+      paths[count] = strdup(line);
+      if (nodes[count] == TRIE_NONE || !paths[count]) {
+         free(paths[count]);
+         goto done;
+      }
+      count++;
+   }
+
+   if (resolve_trie(fs, trie))
+      goto done;
+
+   missing = 0;
+   for (i = 0; i < count; i++) {
+      trie_node *node = &trie->nodes[nodes[i]];
+      ino = node->inode ? get_inode(fs, node->inode) : NULL;
+
+      if (!ino) {
+         fprintf(out, "%s\t0\t-\t0\n", paths[i]);
+         missing++;
+      }
+      else
+         fprintf(out, "%s\t%u\t%c\t%lld\n", paths[i], node->inode,
+               inode_type(ino), (long long) inode_size(ino));
+   }
+
+done:
+   for (i = 0; i < count; i++)
+      free(paths[i]);
+   free(paths);
+   free(nodes);
+   free(line);
+   trie_destroy(trie);
+   return missing;
+}
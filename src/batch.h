@@ -0,0 +1,36 @@
+/*
+ * batch.h
+ *
+ * Batch path resolution. All paths are loaded into a path_trie first and
+ * resolved together, so each directory shared by several paths is read and
+ * scanned only once no matter how many of the paths run through it.
+ */
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "ext2.h"
+
+struct path_trie;
+
+/*
+ * Reads newline separated paths from |in|, resolves them against |fs| and
+ * writes one tab separated line per path to |out|, in input order:
+ *
+ *    <path> <inode> <type> <size>
+ *
+ * where <type> is the inode_type() letter, as in listings. Paths that don't
+ * exist are reported with inode 0 and type '-'. Returns the number of paths that could
+ * not be resolved, or -1 if memory ran out.
+ */
+long resolve_batch(ext2_fs *fs, FILE *in, FILE *out);
+
+/*
+ * Sets the inode of every node of |trie| that exists in |fs|, top down.
+ * Each directory node with children is scanned exactly once; nodes whose
+ * parent is missing or isn't a directory stay unresolved. Returns 0 on
+ * success, -1 if memory ran out.
+ */
+int resolve_trie(ext2_fs *fs, struct path_trie *trie);
+
+#endif /* BATCH_H_ */
@@ -0,0 +1,263 @@
+/*
+ * blockmap.c
+ *
+ * Block pointer to extent resolution, see blockmap.h
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include "blockmap.h"
+#include "sidecar.h"
+
+/*
+ * Appends |length| blocks at |physical| to the end of |map|, extending the
+ * last run when the new blocks continue it on disk (or continue a hole)
+ */
+static int append_run(block_map *map, uint32_t physical, uint32_t length) {
+   extent *last = map->count ? &map->runs[map->count - 1] : NULL;
+   uint32_t logical = last ? last->logical + last->length : 0;
+
+   if (last && ((!physical && !last->physical)
+         || (physical && last->physical
+               && last->physical + last->length == physical))) {
+      last->length += length;
+      return 0;
+   }
+
+   if (map->count == map->capacity) {
+      size_t capacity = map->capacity ? map->capacity * 2 : 16;
+      extent *runs = realloc(map->runs, capacity * sizeof(extent));
+      if (!runs)
+         return -1;
+      map->runs = runs;
+      map->capacity = capacity;
+   }
+
+   map->runs[map->count].logical = logical;
+   map->runs[map->count].physical = physical;
+   map->runs[map->count].length = length;
+   map->count++;
+   return 0;
+}
+
+off_t inode_size(ext2_inode *ino) {
+   off_t size = ino->i_size;
+
+   // i_dir_acl holds the upper 32 bits only for regular files
+   if (S_ISREG(ino->i_mode))
+      size |= (off_t) ino->i_dir_acl << 32;
+   return size;
+}
+
+/*
+ * Returns the pointers of the pointer block |block| at |level| (0 being
+ * the one referenced from the inode), reading it only if that level holds
+ * a different block
+ */
+static const uint32_t *load_level(block_iter *it, int level, uint32_t block) {
+   if (it->loaded[level] != block) {
+      it->ptrs[level] = fetch_block(it->fs, block, it->bufs[level]);
+      it->loaded[level] = block;
+   }
+   return it->ptrs[level];
+}
+
+/*
+ * Maps logical block |logical| with |ptrs| pointers per block: stores its
+ * physical block in |*physical| and returns how many blocks from |logical|
+ * on share that mapping, which is more than 1 only for a hole left by a
+ * missing pointer block. Always inlined into the per-size variants below,
+ * where |ptrs| is a constant.
+ */
+static inline __attribute__((always_inline))
+off_t map_one(block_iter *it, uint32_t logical, uint32_t *physical,
+      const uint32_t ptrs) {
+   off_t rest = logical, span = 1;
+   uint32_t block, index;
+   int depth, level;
+
+   if (rest < EXT2_NDIR_BLOCKS) {
+      *physical = it->ino->i_block[rest];
+      return 1;
+   }
+   rest -= EXT2_NDIR_BLOCKS;
+
+   // find the tree holding the block and the number of blocks it spans
+   for (depth = 1; depth <= 3; depth++) {
+      span *= ptrs;
+      if (rest < span)
+         break;
+      rest -= span;
+   }
+   if (depth > 3) {
+      *physical = 0;
+      return 1;
+   }
+
+   // descend one level at a time, |span| being what's below |block|
+   block = it->ino->i_block[EXT2_NDIR_BLOCKS + depth - 1];
+   for (level = 0; level < depth; level++) {
+      if (!block) {
+         *physical = 0;
+         return span - rest % span;
+      }
+      span /= ptrs;
+      index = rest / span % ptrs;
+      block = load_level(it, level, block)[index];
+   }
+
+   *physical = block;
+   return 1;
+}
+
+#define DEFINE_MAP_ONE(size) \
+   static off_t map_one_##size(block_iter *it, uint32_t logical, \
+         uint32_t *physical) { \
+      return map_one(it, logical, physical, (size) / sizeof(uint32_t)); \
+   }
+
+DEFINE_MAP_ONE(1024)
+DEFINE_MAP_ONE(2048)
+DEFINE_MAP_ONE(4096)
+
+/*
+ * Indexed by block_shift - EXT2_MIN_BLOCK_LOG_SIZE
+ */
+static off_t (*const map_one_by_size[EXT2_BLOCK_SIZES])(block_iter *,
+      uint32_t, uint32_t *) = { map_one_1024, map_one_2048, map_one_4096 };
+
+void iter_init(block_iter *it, ext2_fs *fs, ext2_inode *ino) {
+   it->fs = fs;
+   it->ino = ino;
+   it->map_one = map_one_by_size[fs->block_shift - EXT2_MIN_BLOCK_LOG_SIZE];
+   it->next = 0;
+   it->nblocks = (inode_size(ino) + fs->block_size - 1) >> fs->block_shift;
+   memset(it->loaded, 0, sizeof(it->loaded));
+   it->runs = sidecar_runs(fs, ino, &it->run_count);
+   it->run = 0;
+}
+
+void iter_range(block_iter *it, uint32_t first, uint32_t end) {
+   if (end < it->nblocks)
+      it->nblocks = end;
+   it->next = first < it->nblocks ? first : it->nblocks;
+}
+
+/*
+ * iter_next() for an inode whose runs are stored in the sidecar index
+ */
+static int next_stored(block_iter *it, extent *run) {
+   const extent *stored;
+   uint32_t lo = it->run, hi = it->run_count, mid;
+
+   // iter_range() may have skipped ahead of the last run returned
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (it->runs[mid].logical + it->runs[mid].length <= it->next)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   if (lo == it->run_count)
+      return 0;
+
+   stored = &it->runs[lo];
+   run->logical = it->next;
+   run->physical = stored->physical ? stored->physical
+         + (it->next - stored->logical) : 0;
+   run->length = stored->logical + stored->length - it->next;
+   if (run->length > it->nblocks - it->next)
+      run->length = it->nblocks - it->next;
+   it->next += run->length;
+   it->run = lo;
+   return 1;
+}
+
+int iter_next(block_iter *it, extent *run) {
+   uint32_t physical;
+   off_t count;
+
+   if (it->next >= it->nblocks)
+      return 0;
+   if (it->runs)
+      return next_stored(it, run);
+
+   count = it->map_one(it, it->next, &run->physical);
+   run->logical = it->next;
+   run->length = count < it->nblocks - it->next ? count
+         : it->nblocks - it->next;
+   it->next += run->length;
+
+   // extend the run while the following blocks continue it on disk
+   while (it->next < it->nblocks) {
+      count = it->map_one(it, it->next, &physical);
+      if (run->physical ? physical != run->physical + run->length : physical)
+         break;
+
+      if (count > it->nblocks - it->next)
+         count = it->nblocks - it->next;
+      run->length += count;
+      it->next += count;
+   }
+   return 1;
+}
+
+uint32_t iter_lookup(block_iter *it, uint32_t logical) {
+   uint32_t physical, lo = 0, hi = it->run_count, mid;
+
+   if (logical >= it->nblocks)
+      return 0;
+   if (!it->runs) {
+      it->map_one(it, logical, &physical);
+      return physical;
+   }
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (it->runs[mid].logical + it->runs[mid].length <= logical)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   if (lo == it->run_count || !it->runs[lo].physical)
+      return 0;
+   return it->runs[lo].physical + (logical - it->runs[lo].logical);
+}
+
+int map_blocks(ext2_fs *fs, ext2_inode *ino, block_map *map) {
+   block_iter it;
+   extent run;
+
+   memset(map, 0, sizeof(block_map));
+   iter_init(&it, fs, ino);
+   map->nblocks = it.nblocks;
+
+   while (iter_next(&it, &run))
+      if (append_run(map, run.physical, run.length)) {
+         free_block_map(map);
+         return -1;
+      }
+   return 0;
+}
+
+uint32_t map_lookup(block_map *map, uint32_t logical) {
+   size_t lo = 0, hi = map->count, mid;
+
+   // runs are sorted by logical block and cover the file without gaps
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (map->runs[mid].logical + map->runs[mid].length <= logical)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   if (lo == map->count || !map->runs[lo].physical)
+      return 0;
+   return map->runs[lo].physical + (logical - map->runs[lo].logical);
+}
+
+void free_block_map(block_map *map) {
+   free(map->runs);
+   memset(map, 0, sizeof(block_map));
+}
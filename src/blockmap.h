@@ -0,0 +1,112 @@
+/*
+ * blockmap.h
+ *
+ * Resolves an inode's direct and indirect block pointers into physically
+ * contiguous runs so file data can be read with a few large reads instead
+ * of one read per block. Runs are either streamed by a block_iter or
+ * collected into a block_map.
+ */
+
+#ifndef BLOCKMAP_H_
+#define BLOCKMAP_H_
+
+#include <sys/types.h>
+#include "ext2.h"
+
+#define MAP_MAX_PTRS (EXT2_MAX_BLOCK_SIZE / sizeof(uint32_t))
+
+/*
+ * |length| blocks starting at logical block |logical| of the file are stored
+ * at physical block |physical| onwards. A |physical| of 0 marks a hole that
+ * reads back as zeroes.
+ */
+typedef struct extent {
+   uint32_t logical;
+   uint32_t physical;
+   uint32_t length;
+} extent;
+
+typedef struct block_map {
+   extent *runs;
+   size_t count;
+   size_t capacity;
+   uint32_t nblocks; /* number of logical blocks covered by i_size */
+} block_map;
+
+/*
+ * Returns the size in bytes of the file described by |ino|, including the
+ * high 32 bits stored in i_dir_acl for large regular files
+ */
+off_t inode_size(ext2_inode *ino);
+
+/*
+ * Lazily walks the block pointers of an inode, one logical block at a time
+ * and without recursion. Only the pointer block last read at each level of
+ * indirection is kept, so memory stays bounded however large the file is.
+ * Inodes served from a sidecar index (see sidecar.h) come with their runs
+ * already resolved, and no pointer block is read for them at all.
+ */
+typedef struct block_iter {
+   ext2_fs *fs;
+   ext2_inode *ino;
+   /* map_one() specialized for the image's block size */
+   off_t (*map_one)(struct block_iter *it, uint32_t logical,
+         uint32_t *physical);
+   uint32_t next; /* next logical block to map */
+   uint32_t nblocks; /* logical block to stop at, i_size's by default */
+   uint32_t loaded[3]; /* pointer block held at each level, 0 if none */
+   const uint32_t *ptrs[3]; /* its pointers, in |bufs| or the mapping */
+   const extent *runs; /* runs stored in the sidecar index, or NULL */
+   uint32_t run_count;
+   uint32_t run; /* stored run last returned from */
+   uint32_t bufs[3][MAP_MAX_PTRS];
+} block_iter;
+
+/*
+ * Starts iterating over the blocks of inode |ino| of |fs|
+ */
+void iter_init(block_iter *it, ext2_fs *fs, ext2_inode *ino);
+
+/*
+ * Stores in |run| the longest run of physically contiguous blocks (or of
+ * holes) starting at the next unmapped logical block, never reaching past
+ * i_size. Returns 1 if a run was stored, 0 once the file is exhausted.
+ */
+int iter_next(block_iter *it, extent *run);
+
+/*
+ * Restricts the iteration to logical blocks |first| up to (not including)
+ * |end|, clipped to i_size. Nothing is read here: the next iter_next()
+ * descends straight to |first| from the inode, so only the pointer blocks
+ * on the path to the blocks in range are ever fetched.
+ */
+void iter_range(block_iter *it, uint32_t first, uint32_t end);
+
+/*
+ * Returns the physical block holding logical block |logical| of the
+ * iterated inode, or 0 if it is a hole or past i_size. Blocks can be looked
+ * up in any order without disturbing the iteration; the pointer blocks read
+ * on the way are kept as by iter_next(), so lookups close together cost no
+ * further reads.
+ */
+uint32_t iter_lookup(block_iter *it, uint32_t logical);
+
+/*
+ * Collects every run of inode |ino| of |fs| into |map| for random access
+ * with map_lookup(). Returns 0 on success, -1 if memory ran out. The runs
+ * must be released with free_block_map().
+ */
+int map_blocks(ext2_fs *fs, ext2_inode *ino, block_map *map);
+
+/*
+ * Returns the physical block holding logical block |logical| of |map|, or 0
+ * if it is a hole or past the end of the file
+ */
+uint32_t map_lookup(block_map *map, uint32_t logical);
+
+/*
+ * Frees the runs held by |map|
+ */
+void free_block_map(block_map *map);
+
+#endif /* BLOCKMAP_H_ */
@@ -0,0 +1,211 @@
+/*
+ * cache.c
+ *
+ * Segmented LRU block cache, see cache.h
+ */
+
+#include <string.h>
+#include "cache.h"
+
+#define NIL -1
+
+enum {
+   PROBATION, PROTECTED, SEGMENTS
+};
+
+typedef struct cache_entry {
+   uint32_t block;
+   int segment;
+   int prev, next; /* LRU list links, head is most recently used */
+   int hnext; /* hash chain link */
+} cache_entry;
+
+typedef struct lru_list {
+   int head, tail;
+   size_t count;
+} lru_list;
+
+struct block_cache {
+   uint32_t block_size;
+   size_t capacity;
+   size_t used;
+   size_t protected_max;
+   uint32_t hash_mask;
+   int *buckets;
+   cache_entry *entries;
+   uint8_t *data;
+   lru_list lists[SEGMENTS];
+   cache_stats stats;
+};
+
+static uint32_t hash_block(block_cache *cache, uint32_t block) {
+   return (block * 2654435761u) & cache->hash_mask;
+}
+
+static void list_unlink(block_cache *cache, int idx) {
+   cache_entry *e = &cache->entries[idx];
+   lru_list *list = &cache->lists[e->segment];
+
+   if (e->prev != NIL)
+      cache->entries[e->prev].next = e->next;
+   else
+      list->head = e->next;
+
+   if (e->next != NIL)
+      cache->entries[e->next].prev = e->prev;
+   else
+      list->tail = e->prev;
+
+   list->count--;
+}
+
+static void list_push_head(block_cache *cache, int idx, int segment) {
+   cache_entry *e = &cache->entries[idx];
+   lru_list *list = &cache->lists[segment];
+
+   e->segment = segment;
+   e->prev = NIL;
+   e->next = list->head;
+   if (list->head != NIL)
+      cache->entries[list->head].prev = idx;
+   else
+      list->tail = idx;
+   list->head = idx;
+   list->count++;
+}
+
+static void hash_remove(block_cache *cache, int idx) {
+   int *link = &cache->buckets[hash_block(cache, cache->entries[idx].block)];
+
+   while (*link != idx)
+      link = &cache->entries[*link].hnext;
+   *link = cache->entries[idx].hnext;
+}
+
+block_cache *cache_create(size_t nblocks, uint32_t block_size) {
+   block_cache *cache;
+   size_t nbuckets = 1;
+
+   if (!nblocks)
+      return NULL;
+
+   while (nbuckets < nblocks * 2)
+      nbuckets <<= 1;
+
+   cache = calloc(1, sizeof(block_cache));
+   if (!cache)
+      return NULL;
+
+   cache->block_size = block_size;
+   cache->capacity = nblocks;
+   cache->protected_max = nblocks * CACHE_PROTECTED_PCT / 100;
+   if (cache->protected_max >= nblocks)
+      cache->protected_max = nblocks - 1;
+   cache->hash_mask = nbuckets - 1;
+   cache->buckets = malloc(nbuckets * sizeof(int));
+   cache->entries = malloc(nblocks * sizeof(cache_entry));
+   cache->data = malloc(nblocks * block_size);
+
+   if (!cache->buckets || !cache->entries || !cache->data) {
+      cache_destroy(cache);
+      return NULL;
+   }
+
+   memset(cache->buckets, NIL, nbuckets * sizeof(int));
+   cache->lists[PROBATION].head = cache->lists[PROBATION].tail = NIL;
+   cache->lists[PROTECTED].head = cache->lists[PROTECTED].tail = NIL;
+
+   return cache;
+}
+
+void cache_destroy(block_cache *cache) {
+   if (!cache)
+      return;
+
+   free(cache->buckets);
+   free(cache->entries);
+   free(cache->data);
+   free(cache);
+}
+
+/*
+ * Returns the entry holding |block|, or NIL
+ */
+static int find_entry(block_cache *cache, uint32_t block) {
+   int idx = cache->buckets[hash_block(cache, block)];
+
+   while (idx != NIL && cache->entries[idx].block != block)
+      idx = cache->entries[idx].hnext;
+   return idx;
+}
+
+uint8_t *cache_lookup(block_cache *cache, uint32_t block) {
+   int idx = find_entry(cache, block);
+
+   if (idx == NIL) {
+      cache->stats.misses++;
+      return NULL;
+   }
+
+   cache->stats.hits++;
+   list_unlink(cache, idx);
+
+   // a second touch promotes the block out of probation
+   if (cache->entries[idx].segment == PROBATION && cache->protected_max) {
+      cache->stats.promotions++;
+      list_push_head(cache, idx, PROTECTED);
+
+      if (cache->lists[PROTECTED].count > cache->protected_max) {
+         int demoted = cache->lists[PROTECTED].tail;
+         list_unlink(cache, demoted);
+         list_push_head(cache, demoted, PROBATION);
+      }
+   }
+   else
+      list_push_head(cache, idx, cache->entries[idx].segment);
+
+   return cache->data + (size_t) idx * cache->block_size;
+}
+
+uint8_t *cache_insert(block_cache *cache, uint32_t block) {
+   int idx = find_entry(cache, block);
+   uint32_t bucket;
+
+   // filled in by another reader since this one missed
+   if (idx != NIL)
+      return cache->data + (size_t) idx * cache->block_size;
+
+   if (cache->used < cache->capacity)
+      idx = cache->used++;
+   else {
+      idx = cache->lists[PROBATION].tail;
+      list_unlink(cache, idx);
+      hash_remove(cache, idx);
+      cache->stats.evictions++;
+   }
+
+   bucket = hash_block(cache, block);
+   cache->entries[idx].block = block;
+   cache->entries[idx].hnext = cache->buckets[bucket];
+   cache->buckets[bucket] = idx;
+   list_push_head(cache, idx, PROBATION);
+
+   return cache->data + (size_t) idx * cache->block_size;
+}
+
+cache_stats cache_get_stats(block_cache *cache) {
+   cache_stats none = { 0 };
+   return cache ? cache->stats : none;
+}
+
+void cache_print_stats(block_cache *cache, FILE *out) {
+   if (!cache) {
+      fprintf(out, "\ncache: disabled\n");
+      return;
+   }
+
+   fprintf(out, "\ncache: %lu hits, %lu misses, %lu evictions, "
+         "%lu promotions (%lu/%lu blocks)\n", cache->stats.hits,
+         cache->stats.misses, cache->stats.evictions, cache->stats.promotions,
+         (unsigned long) cache->used, (unsigned long) cache->capacity);
+}
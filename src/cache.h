@@ -0,0 +1,65 @@
+/*
+ * cache.h
+ *
+ * Bounded block cache sitting underneath read_data(). Blocks are keyed by
+ * block number and evicted with a segmented LRU: a block enters the
+ * probationary segment on its first miss and is only promoted to the
+ * protected segment when it is hit again. A one-pass scan over data blocks
+ * therefore only churns the probationary segment and never pushes hot
+ * metadata (superblock, BGDT, inode tables, directory blocks) out.
+ */
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include "ext2.h"
+
+#define CACHE_DEFAULT_BLOCKS 1024
+#define CACHE_PROTECTED_PCT 80
+
+typedef struct cache_stats {
+   unsigned long hits;
+   unsigned long misses;
+   unsigned long evictions;
+   unsigned long promotions;
+} cache_stats;
+
+typedef struct block_cache block_cache;
+
+/*
+ * Creates a cache holding at most |nblocks| blocks of |block_size| bytes.
+ * Returns NULL if |nblocks| is 0 or allocation fails.
+ */
+block_cache *cache_create(size_t nblocks, uint32_t block_size);
+
+/*
+ * Frees |cache| and every block it holds
+ */
+void cache_destroy(block_cache *cache);
+
+/*
+ * Returns the cached contents of |block|, or NULL on a miss. A hit refreshes
+ * the block's position in the LRU and promotes it to the protected segment.
+ */
+uint8_t *cache_lookup(block_cache *cache, uint32_t block);
+
+/*
+ * Reserves a slot for |block|, evicting the least recently used
+ * probationary block if the cache is full, and returns the slot's buffer
+ * for the caller to fill. If |block| is already cached, its slot is
+ * returned as it is.
+ */
+uint8_t *cache_insert(block_cache *cache, uint32_t block);
+
+/*
+ * Returns the hit/miss/eviction counters of |cache|
+ */
+cache_stats cache_get_stats(block_cache *cache);
+
+/*
+ * Prints the counters of |cache| to |out|. A NULL |cache| is reported as
+ * disabled.
+ */
+void cache_print_stats(block_cache *cache, FILE *out);
+
+#endif /* CACHE_H_ */
@@ -0,0 +1,518 @@
+/*
+ * checksum.c
+ *
+ * Parallel per-file CRC32C checksums, see checksum.h
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include "checksum.h"
+#include "batch.h"
+#include "blockmap.h"
+#include "inode.h"
+#include "plan.h"
+#include "trie.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define CRC32C_POLY 0x82f63b78u /* reflected Castagnoli polynomial */
+#define CRC_STREAMS_MIN (64 * 1024) /* shortest buffer split in three */
+#define NO_FILE ((uint32_t) -1)
+
+/*
+ * A file to checksum: |job_count| jobs from |first_job| on cover it in
+ * logical order
+ */
+typedef struct sum_file {
+   char *path; /* owned, or NULL when the caller keeps the path */
+   uint32_t first_job;
+   uint32_t job_count;
+   uint32_t crc;
+} sum_file;
+
+typedef struct sum_plan {
+   ext2_fs *fs;
+   dir_walk walk;
+   job_plan jobs; /* holes included, |file| indexing |files| */
+   uint32_t *crcs; /* of each job */
+   sum_file *files;
+   size_t file_count;
+   size_t file_cap;
+} sum_plan;
+
+/*
+ * Paths read by checksum_list() or verify_manifest(), with the trie node,
+ * the expected checksum and the planned file of each
+ */
+typedef struct path_list {
+   path_trie *trie;
+   char **paths;
+   uint32_t *nodes;
+   uint32_t *expected;
+   uint32_t *files;
+   size_t count;
+   size_t cap;
+} path_list;
+
+static uint32_t crc_table[8][256];
+static uint32_t x2n_table[32];
+
+/*
+ * Kernels update the raw, uninverted CRC register
+ */
+static uint32_t update_scalar(uint32_t crc, const uint8_t *p, size_t len) {
+   uint32_t lo, hi;
+
+   // slicing by 8: one table lookup per byte, eight bytes per step
+   for (; len >= 8; p += 8, len -= 8) {
+      lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24);
+      hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t) p[7] << 24;
+      crc = crc_table[7][lo & 0xff] ^ crc_table[6][lo >> 8 & 0xff]
+            ^ crc_table[5][lo >> 16 & 0xff] ^ crc_table[4][lo >> 24]
+            ^ crc_table[3][hi & 0xff] ^ crc_table[2][hi >> 8 & 0xff]
+            ^ crc_table[1][hi >> 16 & 0xff] ^ crc_table[0][hi >> 24];
+   }
+   for (; len; p++, len--)
+      crc = crc_table[0][(crc ^ *p) & 0xff] ^ crc >> 8;
+   return crc;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse4.2")))
+static uint32_t update_one_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+   unsigned long long c = crc, w;
+
+   for (; len >= 8; p += 8, len -= 8) {
+      memcpy(&w, p, 8);
+      c = _mm_crc32_u64(c, w);
+   }
+   for (; len; p++, len--)
+      c = _mm_crc32_u8((uint32_t) c, *p);
+   return (uint32_t) c;
+}
+
+/*
+ * The crc32 instruction takes three cycles but can start one every cycle,
+ * so long buffers are summed as three independent streams that are
+ * combined at the end
+ */
+__attribute__((target("sse4.2")))
+static uint32_t update_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+   unsigned long long c0 = crc, c1 = ~0u, c2 = ~0u, w0, w1, w2;
+   size_t third, i;
+
+   if (len < CRC_STREAMS_MIN)
+      return update_one_sse42(crc, p, len);
+
+   third = len / 3 & ~(size_t) 7;
+   for (i = 0; i < third; i += 8) {
+      memcpy(&w0, p + i, 8);
+      memcpy(&w1, p + third + i, 8);
+      memcpy(&w2, p + 2 * third + i, 8);
+      c0 = _mm_crc32_u64(c0, w0);
+      c1 = _mm_crc32_u64(c1, w1);
+      c2 = _mm_crc32_u64(c2, w2);
+   }
+
+   crc = ~crc32c_combine(crc32c_combine(~(uint32_t) c0, ~(uint32_t) c1,
+         third), ~(uint32_t) c2, third);
+   return update_one_sse42(crc, p + 3 * third, len - 3 * third);
+}
+#endif
+
+static uint32_t (*update_kernel)(uint32_t, const uint8_t *, size_t) =
+      update_scalar;
+static const char *kernel_name = "scalar";
+
+/*
+ * Returns a(x) b(x) modulo the polynomial, both bit reflected
+ */
+static uint32_t multmodp(uint32_t a, uint32_t b) {
+   uint32_t m = 1u << 31, p = 0;
+
+   for (;;) {
+      if (a & m) {
+         p ^= b;
+         if (!(a & (m - 1)))
+            break;
+      }
+      m >>= 1;
+      b = b & 1 ? b >> 1 ^ CRC32C_POLY : b >> 1;
+   }
+   return p;
+}
+
+/*
+ * Returns x^(n 2^k) modulo the polynomial
+ */
+static uint32_t x2nmodp(off_t n, unsigned k) {
+   uint32_t p = 1u << 31; /* x^0 */
+
+   for (; n; n >>= 1, k++)
+      if (n & 1)
+         p = multmodp(x2n_table[k & 31], p);
+   return p;
+}
+
+/*
+ * Builds the tables and picks the kernel before main() runs, so neither
+ * ever races with the worker threads
+ */
+__attribute__((constructor))
+static void pick_kernel(void) {
+   uint32_t c, n, k, p;
+
+   for (n = 0; n < 256; n++) {
+      for (c = n, k = 0; k < 8; k++)
+         c = c & 1 ? c >> 1 ^ CRC32C_POLY : c >> 1;
+      crc_table[0][n] = c;
+   }
+   for (n = 0; n < 256; n++)
+      for (k = 1; k < 8; k++)
+         crc_table[k][n] = crc_table[k - 1][n] >> 8
+               ^ crc_table[0][crc_table[k - 1][n] & 0xff];
+
+   for (p = 1u << 30, n = 0; n < 32; n++) {
+      x2n_table[n] = p;
+      p = multmodp(p, p);
+   }
+
+#ifdef HAVE_X86_KERNELS
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("sse4.2")) {
+      update_kernel = update_sse42;
+      kernel_name = "sse4.2";
+   }
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+   return ~update_kernel(~crc, buf, len);
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, off_t len2) {
+   // shifting crc1 past len2 zero bytes, 2^3 bits each
+   return multmodp(x2nmodp(len2, 3), crc1) ^ crc2;
+}
+
+const char *crc32c_kernel(void) {
+   return kernel_name;
+}
+
+/*
+ * Records the regular file |ino|, known as |path|, and queues jobs for
+ * every run of it, holes included. Returns -1 if memory ran out, in which
+ * case |path| is freed.
+ */
+static int plan_file(sum_plan *plan, ext2_inode *ino, char *path) {
+   sum_file *file;
+
+   if (plan->file_count == plan->file_cap) {
+      size_t file_cap = plan->file_cap ? plan->file_cap * 2 : 1024;
+      sum_file *files = realloc(plan->files, file_cap * sizeof(sum_file));
+      if (!files) {
+         free(path);
+         return -1;
+      }
+      plan->files = files;
+      plan->file_cap = file_cap;
+   }
+   file = &plan->files[plan->file_count++];
+   file->path = path;
+   file->first_job = plan->jobs.job_count;
+   file->crc = 0;
+
+   if (plan_runs(&plan->jobs, ino, plan->file_count - 1))
+      return -1;
+   file->job_count = plan->jobs.job_count - file->first_job;
+   return 0;
+}
+
+static int plan_entry(dir_walk *walk, ext2_dir_entry *entry) {
+   sum_plan *plan = walk->arg;
+   ext2_inode *ino = get_inode(plan->fs, entry->inode);
+   char *path;
+
+   if (!ino || !(S_ISDIR(ino->i_mode) || S_ISREG(ino->i_mode)))
+      return 0;
+
+   path = entry_path(walk, entry);
+   if (!path)
+      return -1;
+
+   if (S_ISREG(ino->i_mode))
+      return plan_file(plan, ino, path);
+
+   if (walk_push(walk, entry->inode, path)) {
+      free(path);
+      return -1;
+   }
+   return 0;
+}
+
+/*
+ * Checksum thread: claims jobs in physical order until none are left
+ */
+static void sum_jobs(job_plan *jobs, void *arg) {
+   sum_plan *plan = arg;
+   ext2_fs *fs = plan->fs;
+   uint8_t *buf = malloc(BLOCK_POS(fs, CHECKSUM_CHUNK_BLOCKS));
+   const uint8_t *data;
+   unsigned long start;
+   read_job *job;
+
+   if (!buf) {
+      jobs->out_of_memory = 1;
+      return;
+   }
+
+   while ((job = claim_job(jobs))) {
+      start = stats_now();
+      if (job->pos)
+         data = fetch_range(fs, job->pos, buf, job->len);
+      else {
+         memset(buf, 0, job->len);
+         data = buf;
+      }
+      plan->crcs[job - jobs->jobs] = crc32c(0, data, job->len);
+      stats_record(&fs->stats, STATS_READ, start);
+   }
+
+   free(buf);
+}
+
+/*
+ * Sums every planned job with |threads| threads and combines the sums of
+ * each file. Returns -1 if memory ran out.
+ */
+static int run_plan(sum_plan *plan, int threads) {
+   sum_file *file;
+   size_t f, j;
+
+   plan->crcs = malloc(plan->jobs.job_count * sizeof(uint32_t) + 1);
+   if (!plan->crcs || run_jobs(&plan->jobs, threads, sum_jobs, plan, 0) < 0)
+      return -1;
+
+   for (f = 0; f < plan->file_count; f++) {
+      file = &plan->files[f];
+      for (j = file->first_job; j < file->first_job + file->job_count; j++)
+         file->crc = crc32c_combine(file->crc, plan->crcs[j],
+               plan->jobs.jobs[j].len);
+   }
+   return 0;
+}
+
+static void init_plan(sum_plan *plan, ext2_fs *fs) {
+   memset(plan, 0, sizeof(sum_plan));
+   plan->fs = fs;
+   plan->walk.fs = fs;
+   plan->walk.arg = plan;
+   plan->walk.visit = plan_entry;
+   plan->jobs.fs = fs;
+   plan->jobs.chunk_blocks = CHECKSUM_CHUNK_BLOCKS;
+   plan->jobs.holes = 1;
+}
+
+static void free_plan(sum_plan *plan) {
+   size_t f;
+
+   walk_free(&plan->walk);
+   free_jobs(&plan->jobs);
+   for (f = 0; f < plan->file_count; f++)
+      free(plan->files[f].path);
+   free(plan->files);
+   free(plan->crcs);
+}
+
+long checksum_tree(ext2_fs *fs, int threads, FILE *out) {
+   sum_plan plan;
+   long status = -1;
+   size_t f;
+
+   init_plan(&plan, fs);
+   if (!walk_dirs(&plan.walk, EXT2_ROOT_INO, "") && !run_plan(&plan, threads)) {
+      for (f = 0; f < plan.file_count; f++)
+         fprintf(out, "%s\t%08x\n", plan.files[f].path, plan.files[f].crc);
+      status = 0;
+   }
+
+   free_plan(&plan);
+   return status;
+}
+
+/*
+ * Splits the manifest line |line| into its path, which is terminated in
+ * place, and |*crc|. Returns -1 if it isn't "<path>\t<8 hex digits>".
+ */
+static int parse_manifest_line(char *line, uint32_t *crc) {
+   char *tab = strrchr(line, '\t'), *end;
+
+   if (!tab || tab == line || strlen(tab + 1) != 8)
+      return -1;
+   *crc = strtoul(tab + 1, &end, 16);
+   if (*end)
+      return -1;
+   *tab = '\0';
+   return 0;
+}
+
+/*
+ * Reads the newline separated lines of |in| into |list|, as manifest lines
+ * if |manifest| is nonzero. Malformed manifest lines are reported on
+ * stderr and counted in |*malformed|. Returns -1 if memory ran out.
+ */
+static int read_paths(path_list *list, FILE *in, int manifest,
+      long *malformed) {
+   char *line = NULL;
+   size_t line_cap = 0, line_no = 0;
+   uint32_t crc = 0;
+   ssize_t len;
+   int status = -1;
+
+   list->trie = trie_create();
+   if (!list->trie)
+      return -1;
+
+   while ((len = getline(&line, &line_cap, in)) != -1) {
+      line_no++;
+      while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+         line[--len] = '\0';
+      if (!len)
+         continue;
+      if (manifest && parse_manifest_line(line, &crc)) {
+         fprintf(stderr, "\nError: malformed manifest line %lu\n",
+               (unsigned long) line_no);
+         (*malformed)++;
+         continue;
+      }
+
+      if (list->count == list->cap) {
+         size_t cap = list->cap ? list->cap * 2 : 1024;
+         char **paths = realloc(list->paths, cap * sizeof(char *));
+         uint32_t *nodes = realloc(list->nodes, cap * sizeof(uint32_t));
+         uint32_t *expected = realloc(list->expected, cap * sizeof(uint32_t));
+         uint32_t *files = realloc(list->files, cap * sizeof(uint32_t));
+         if (paths)
+            list->paths = paths;
+         if (nodes)
+            list->nodes = nodes;
+         if (expected)
+            list->expected = expected;
+         if (files)
+            list->files = files;
+         if (!paths || !nodes || !expected || !files)
+            goto done;
+         list->cap = cap;
+      }
+
+      list->nodes[list->count] = trie_insert(list->trie, line);
+      list->paths[list->count] = strdup(line);
+      if (list->nodes[list->count] == TRIE_NONE || !list->paths[list->count]) {
+         free(list->paths[list->count]);
+         goto done;
+      }
+      list->expected[list->count] = crc;
+      list->files[list->count] = NO_FILE;
+      list->count++;
+   }
+   status = 0;
+
+done:
+   free(line);
+   return status;
+}
+
+/*
+ * Resolves every path of |list| and plans the regular files among them.
+ * Returns -1 if memory ran out.
+ */
+static int plan_paths(sum_plan *plan, path_list *list) {
+   ext2_inode *ino;
+   uint32_t inode;
+   unsigned long start = stats_now();
+   size_t i;
+
+   if (resolve_trie(plan->fs, list->trie))
+      return -1;
+   stats_record(&plan->fs->stats, STATS_RESOLVE, start);
+
+   for (i = 0; i < list->count; i++) {
+      inode = list->trie->nodes[list->nodes[i]].inode;
+      ino = inode ? get_inode(plan->fs, inode) : NULL;
+      if (!ino || !S_ISREG(ino->i_mode))
+         continue;
+
+      list->files[i] = plan->file_count;
+      if (plan_file(plan, ino, NULL))
+         return -1;
+   }
+   return 0;
+}
+
+static void free_paths(path_list *list) {
+   size_t i;
+
+   for (i = 0; i < list->count; i++)
+      free(list->paths[i]);
+   free(list->paths);
+   free(list->nodes);
+   free(list->expected);
+   free(list->files);
+   if (list->trie)
+      trie_destroy(list->trie);
+}
+
+long checksum_list(ext2_fs *fs, FILE *in, int threads, FILE *out) {
+   path_list list = { 0 };
+   sum_plan plan;
+   long missing = -1;
+   size_t i;
+
+   init_plan(&plan, fs);
+   if (!read_paths(&list, in, 0, NULL) && !plan_paths(&plan, &list)
+         && !run_plan(&plan, threads)) {
+      missing = 0;
+      for (i = 0; i < list.count; i++) {
+         if (list.files[i] == NO_FILE) {
+            fprintf(out, "%s\t-\n", list.paths[i]);
+            missing++;
+         }
+         else
+            fprintf(out, "%s\t%08x\n", list.paths[i],
+                  plan.files[list.files[i]].crc);
+      }
+   }
+
+   free_plan(&plan);
+   free_paths(&list);
+   return missing;
+}
+
+long verify_manifest(ext2_fs *fs, FILE *manifest, int threads, FILE *out) {
+   path_list list = { 0 };
+   sum_plan plan;
+   long failures = 0;
+   size_t i;
+
+   init_plan(&plan, fs);
+   if (read_paths(&list, manifest, 1, &failures) || plan_paths(&plan, &list)
+         || run_plan(&plan, threads))
+      failures = -1;
+   else
+      for (i = 0; i < list.count; i++) {
+         if (list.files[i] == NO_FILE)
+            fprintf(out, "%s\tMISSING\n", list.paths[i]);
+         else if (plan.files[list.files[i]].crc != list.expected[i])
+            fprintf(out, "%s\tFAILED\n", list.paths[i]);
+         else
+            continue;
+         failures++;
+      }
+
+   free_plan(&plan);
+   free_paths(&list);
+   return failures;
+}
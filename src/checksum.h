@@ -0,0 +1,71 @@
+/*
+ * checksum.h
+ *
+ * Per-file CRC32C checksums, and verification against a manifest of them.
+ * The files' block maps are cut into read jobs that a pool of threads
+ * takes in physical block order, one large read apiece, so a single big
+ * file is spread over every thread like a tree of small ones. Each job is
+ * summed on its own, with the SSE4.2 crc32 instruction over three
+ * interleaved streams when the CPU has it (picked once at startup), and
+ * the sums of a file's jobs are then combined in logical order.
+ */
+
+#ifndef CHECKSUM_H_
+#define CHECKSUM_H_
+
+#include "ext2.h"
+
+#define CHECKSUM_CHUNK_BLOCKS 1024 /* largest single read job */
+
+/*
+ * Returns the CRC32C (Castagnoli) of the |len| bytes at |buf| following
+ * data whose CRC32C is |crc|. Start from 0.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/*
+ * Returns the CRC32C of two pieces of data put end to end, given |crc1| of
+ * the first, |crc2| of the second and the length |len2| of the second
+ */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, off_t len2);
+
+/*
+ * Returns the name of the CRC32C kernel picked for this CPU: "sse4.2" or
+ * "scalar"
+ */
+const char *crc32c_kernel(void);
+
+/*
+ * Checksums every regular file of |fs| with |threads| threads and writes
+ * one manifest line per file to |out|, in depth-first walk order:
+ *
+ *    <path> <crc32c>
+ *
+ * with the checksum as 8 hex digits. Returns 0 on success, -1 if memory
+ * ran out.
+ */
+long checksum_tree(ext2_fs *fs, int threads, FILE *out);
+
+/*
+ * Like checksum_tree() for the newline separated paths read from |in|,
+ * written in input order. Paths that don't exist or aren't regular files
+ * are written with "-" as their checksum. Returns the number of such
+ * paths, or -1 if memory ran out.
+ */
+long checksum_list(ext2_fs *fs, FILE *in, int threads, FILE *out);
+
+/*
+ * Checksums the files named by the manifest read from |manifest|, in the
+ * format written by checksum_tree(), and writes a line to |out| for each
+ * one that doesn't match:
+ *
+ *    <path> FAILED     the checksums differ
+ *    <path> MISSING    no such regular file in the image
+ *
+ * Malformed manifest lines are reported on stderr. Returns the number of
+ * files that failed, were missing or had a malformed line, or -1 if memory
+ * ran out.
+ */
+long verify_manifest(ext2_fs *fs, FILE *manifest, int threads, FILE *out);
+
+#endif /* CHECKSUM_H_ */
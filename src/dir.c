@@ -0,0 +1,78 @@
+/*
+ * dir.c
+ *
+ * Directory traversal, see dir.h
+ */
+
+#include "dir.h"
+#include "blockmap.h"
+
+/*
+ * Visits the entries of one directory block of |size| bytes. Returns the
+ * nonzero value |visit| stopped with, or 0. Always inlined into the
+ * per-size variants below, where |size| is a constant.
+ */
+static inline __attribute__((always_inline))
+int scan_entries(uint8_t *block, const uint32_t size, dir_visitor visit,
+      void *arg) {
+   uint32_t pos = 0;
+   ext2_dir_entry *entry;
+   int stop;
+
+   while (pos + sizeof(ext2_dir_entry) <= size) {
+      entry = (ext2_dir_entry *) (block + pos);
+
+      // a bad rec_len would send us out of the block or into a loop
+      if (entry->rec_len < sizeof(ext2_dir_entry)
+            || entry->rec_len > size - pos)
+         return 0;
+
+      if (entry->inode
+            && sizeof(ext2_dir_entry) + entry->name_len <= entry->rec_len
+            && (stop = visit(entry, arg)))
+         return stop;
+
+      pos += entry->rec_len;
+   }
+   return 0;
+}
+
+#define DEFINE_SCAN_BLOCK(size) \
+   static int scan_block_##size(uint8_t *block, dir_visitor visit, \
+         void *arg) { \
+      return scan_entries(block, (size), visit, arg); \
+   }
+
+DEFINE_SCAN_BLOCK(1024)
+DEFINE_SCAN_BLOCK(2048)
+DEFINE_SCAN_BLOCK(4096)
+
+/*
+ * Indexed by block_shift - EXT2_MIN_BLOCK_LOG_SIZE
+ */
+static int (*const scan_block_by_size[EXT2_BLOCK_SIZES])(uint8_t *,
+      dir_visitor, void *) = { scan_block_1024, scan_block_2048,
+      scan_block_4096 };
+
+int iterate_dir(ext2_fs *fs, ext2_inode *dir, dir_visitor visit, void *arg) {
+   uint8_t buf[EXT2_MAX_BLOCK_SIZE];
+   uint8_t *block;
+   block_iter it;
+   extent run;
+   uint32_t i;
+   int stopped = 0;
+   int (*scan_block)(uint8_t *, dir_visitor, void *) =
+         scan_block_by_size[fs->block_shift - EXT2_MIN_BLOCK_LOG_SIZE];
+
+   iter_init(&it, fs, dir);
+   while (!stopped && iter_next(&it, &run)) {
+      // directory blocks are metadata, so they go through the block cache
+      for (i = 0; i < run.length && run.physical && !stopped; i++) {
+         STATS_ADD(fs->stats.dir_block_fetches, 1);
+         block = fetch_block(fs, run.physical + i, buf);
+         stopped = scan_block(block, visit, arg);
+      }
+   }
+
+   return stopped;
+}
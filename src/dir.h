@@ -0,0 +1,29 @@
+/*
+ * dir.h
+ *
+ * Directory traversal over every block of a directory inode, following the
+ * same block map as file data instead of just the 12 direct pointers.
+ */
+
+#ifndef DIR_H_
+#define DIR_H_
+
+#include "ext2.h"
+
+/*
+ * Called by iterate_dir() for each in-use entry of a directory. |entry|
+ * is only valid for the duration of the call. Returning nonzero stops the
+ * iteration.
+ */
+typedef int (*dir_visitor)(ext2_dir_entry *entry, void *arg);
+
+/*
+ * Calls |visit| with |arg| for every in-use entry of the directory |dir| of
+ * |fs|, in on-disk order. Entries with a zero inode (deleted) and malformed
+ * records are skipped. Blocks are streamed through a block_iter, so no
+ * block map is built. Returns 0 once every entry has been visited, or the
+ * nonzero value |visit| stopped with (-1 by convention if memory ran out).
+ */
+int iterate_dir(ext2_fs *fs, ext2_inode *dir, dir_visitor visit, void *arg);
+
+#endif /* DIR_H_ */
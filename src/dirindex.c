@@ -0,0 +1,227 @@
+/*
+ * dirindex.c
+ *
+ * Hashed directory lookups, see dirindex.h
+ */
+
+#include <string.h>
+#include "dirindex.h"
+#include "dir.h"
+#include "htree.h"
+#include "inode.h"
+#include "match.h"
+#include "sidecar.h"
+
+typedef struct index_entry {
+   uint32_t hash;
+   uint32_t inode;
+   uint32_t name; /* offset into the index's name arena */
+   uint32_t name_len;
+} index_entry;
+
+typedef struct dir_index {
+   uint32_t dir_ino;
+   struct dir_index *next; /* chain in the handle's table of indexes */
+   index_entry *entries;
+   uint32_t count;
+   uint32_t capacity;
+   char *names;
+   size_t names_len;
+   size_t names_cap;
+   uint32_t *slots; /* entry index + 1, 0 for an empty slot */
+   uint32_t mask;
+   int failed; /* ran out of memory while building */
+} dir_index;
+
+static uint32_t hash_name(const char *name, size_t len) {
+   uint32_t h = 2166136261u;
+
+   while (len--)
+      h = (h ^ (uint8_t) *name++) * 16777619u;
+   return h;
+}
+
+static int add_entry(ext2_dir_entry *entry, void *arg) {
+   dir_index *index = arg;
+   index_entry *e;
+
+   if (index->count == index->capacity) {
+      uint32_t capacity = index->capacity ? index->capacity * 2 : 64;
+      index_entry *entries = realloc(index->entries,
+            capacity * sizeof(index_entry));
+      if (!entries)
+         return index->failed = 1;
+      index->entries = entries;
+      index->capacity = capacity;
+   }
+
+   while (index->names_len + entry->name_len > index->names_cap) {
+      size_t names_cap = index->names_cap ? index->names_cap * 2 : 1024;
+      char *names = realloc(index->names, names_cap);
+      if (!names)
+         return index->failed = 1;
+      index->names = names;
+      index->names_cap = names_cap;
+   }
+
+   e = &index->entries[index->count++];
+   e->hash = hash_name(entry->name, entry->name_len);
+   e->inode = entry->inode;
+   e->name = index->names_len;
+   e->name_len = entry->name_len;
+   memcpy(index->names + index->names_len, entry->name, entry->name_len);
+   index->names_len += entry->name_len;
+   return 0;
+}
+
+static void free_index(dir_index *index) {
+   free(index->entries);
+   free(index->names);
+   free(index->slots);
+   free(index);
+}
+
+/*
+ * Scans directory |dir| once and builds its hash table. Returns NULL if
+ * memory ran out.
+ */
+static dir_index *build_index(ext2_fs *fs, uint32_t dir_ino, ext2_inode *dir) {
+   dir_index *index = calloc(1, sizeof(dir_index));
+   uint32_t i, slot;
+
+   if (!index)
+      return NULL;
+
+   index->dir_ino = dir_ino;
+   if (iterate_dir(fs, dir, add_entry, index) || index->failed) {
+      free_index(index);
+      return NULL;
+   }
+
+   // keep the table at most half full
+   for (index->mask = 15; index->mask / 2 < index->count;)
+      index->mask = index->mask * 2 + 1;
+   index->slots = calloc(index->mask + 1, sizeof(uint32_t));
+   if (!index->slots) {
+      free_index(index);
+      return NULL;
+   }
+
+   for (i = 0; i < index->count; i++) {
+      for (slot = index->entries[i].hash & index->mask; index->slots[slot];)
+         slot = (slot + 1) & index->mask;
+      index->slots[slot] = i + 1;
+   }
+
+   return index;
+}
+
+/*
+ * Returns the index of |dir_ino| in the chain starting at |index|, or NULL
+ */
+static dir_index *find_index(dir_index *index, uint32_t dir_ino) {
+   for (; index; index = index->next)
+      if (index->dir_ino == dir_ino)
+         return index;
+   return NULL;
+}
+
+/*
+ * Returns the cached index of |dir_ino|, building it on first use. Indexes
+ * never change once published, so finding one takes no lock; a new one is
+ * built without holding any lock and then published under |index_lock|,
+ * dropping it if another thread published the same directory first.
+ */
+static dir_index *get_index(ext2_fs *fs, uint32_t dir_ino, ext2_inode *dir) {
+   dir_index **table, **bucket, *index, *built;
+
+   table = __atomic_load_n(&fs->dir_indexes, __ATOMIC_ACQUIRE);
+   if (table) {
+      bucket = &table[dir_ino % DIR_INDEX_BUCKETS];
+      index = find_index(__atomic_load_n(bucket, __ATOMIC_ACQUIRE), dir_ino);
+      if (index)
+         return index;
+   }
+
+   built = build_index(fs, dir_ino, dir);
+   if (!built)
+      return NULL;
+
+   pthread_mutex_lock(&fs->index_lock);
+   table = fs->dir_indexes;
+   if (!table) {
+      table = calloc(DIR_INDEX_BUCKETS, sizeof(dir_index *));
+      if (!table) {
+         pthread_mutex_unlock(&fs->index_lock);
+         free_index(built);
+         return NULL;
+      }
+      __atomic_store_n(&fs->dir_indexes, table, __ATOMIC_RELEASE);
+   }
+
+   bucket = &table[dir_ino % DIR_INDEX_BUCKETS];
+   index = find_index(*bucket, dir_ino);
+   if (!index) {
+      index = built;
+      built = NULL;
+      index->next = *bucket;
+      __atomic_store_n(bucket, index, __ATOMIC_RELEASE);
+   }
+   pthread_mutex_unlock(&fs->index_lock);
+
+   if (built)
+      free_index(built);
+   return index;
+}
+
+uint32_t dir_lookup(ext2_fs *fs, uint32_t dir_ino, const char *name,
+      size_t len) {
+   ext2_inode *dir = get_inode(fs, dir_ino);
+   dir_index *index;
+   index_entry *e;
+   uint32_t hash, slot, ino_num;
+
+   if (inode_type(dir) != 'd' || len > EXT2_NAME_LEN)
+      return 0;
+
+   if (sidecar_lookup(fs, dir_ino, name, len, &ino_num))
+      return ino_num;
+
+   switch (htree_lookup(fs, dir, name, len, &ino_num)) {
+   case 1:
+      return ino_num;
+   case 0:
+      return 0;
+   }
+
+   index = get_index(fs, dir_ino, dir);
+   if (!index)
+      return 0;
+
+   hash = hash_name(name, len);
+   for (slot = hash & index->mask; index->slots[slot];
+         slot = (slot + 1) & index->mask) {
+      e = &index->entries[index->slots[slot] - 1];
+      if (e->hash == hash && e->name_len == len
+            && names_equal(index->names + e->name, name, len))
+         return e->inode;
+   }
+   return 0;
+}
+
+void free_dir_indexes(ext2_fs *fs) {
+   dir_index *index, *next;
+   uint32_t i;
+
+   if (!fs->dir_indexes)
+      return;
+
+   for (i = 0; i < DIR_INDEX_BUCKETS; i++)
+      for (index = fs->dir_indexes[i]; index; index = next) {
+         next = index->next;
+         free_index(index);
+      }
+
+   free(fs->dir_indexes);
+   fs->dir_indexes = NULL;
+}
@@ -0,0 +1,31 @@
+/*
+ * dirindex.h
+ *
+ * Name lookups inside a directory. Directories carrying an on-disk htree
+ * index are searched through it; any other directory is scanned once, the
+ * first time a name is looked up in it, into an in-memory hash table kept
+ * on the ext2_fs handle so that every later lookup is O(1). Lookups may be
+ * issued from several threads at once.
+ */
+
+#ifndef DIRINDEX_H_
+#define DIRINDEX_H_
+
+#include "ext2.h"
+
+#define DIR_INDEX_BUCKETS 256
+
+/*
+ * Returns the inode number of the entry named by the |len| bytes at |name|
+ * in the directory with inode number |dir_ino|, or 0 if there is no such
+ * entry (or |dir_ino| is not a directory).
+ */
+uint32_t dir_lookup(ext2_fs *fs, uint32_t dir_ino, const char *name,
+      size_t len);
+
+/*
+ * Releases every in-memory directory index of |fs|. Called by close_image().
+ */
+void free_dir_indexes(ext2_fs *fs);
+
+#endif /* DIRINDEX_H_ */
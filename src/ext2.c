@@ -5,22 +5,234 @@
  *      Author: knavero
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "ext2.h"
+#include "cache.h"
+#include "inode.h"
+#include "dirindex.h"
+#include "sidecar.h"
 
-FILE *fp = NULL;
+/*
+ * Reads exactly |size| bytes at |pos| of the image behind |fs|, zero-filling
+ * anything past its end
+ */
+static void pread_full(ext2_fs *fs, void *buf, size_t size, off_t pos) {
+   ssize_t n;
+
+   stats_device_read(&fs->stats, pos, size);
+   while (size) {
+      n = pread(fs->fd, buf, size, pos);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n <= 0) {
+         memset(buf, 0, size);
+         return;
+      }
+      buf = (uint8_t *) buf + n;
+      pos += n;
+      size -= n;
+   }
+}
+
+/*
+ * Validates the superblock of |fs| and reads in every group descriptor.
+ * Returns 0 on success, -1 with errno set otherwise.
+ */
+static int parse_super(ext2_fs *fs) {
+   size_t bgdt_size;
+   ext2_group_desc *bgdt;
+
+   read_data(fs, 2, 0, (uint8_t *) &fs->sb, sizeof(fs->sb));
+   if (fs->sb.s_magic != EXT2_SUPER_MAGIC || !fs->sb.s_inodes_per_group) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   if (fs->sb.s_log_block_size
+         > EXT2_MAX_BLOCK_LOG_SIZE - EXT2_MIN_BLOCK_LOG_SIZE) {
+      errno = ENOTSUP;
+      return -1;
+   }
+   fs->block_shift = EXT2_MIN_BLOCK_LOG_SIZE + fs->sb.s_log_block_size;
+   fs->block_size = 1 << fs->block_shift;
+
+   fs->inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+   if (fs->sb.s_rev_level >= EXT2_DYNAMIC_REV && fs->sb.s_inode_size)
+      fs->inode_size = fs->sb.s_inode_size;
+
+   fs->group_count = (fs->sb.s_inodes_count + fs->sb.s_inodes_per_group - 1)
+         / fs->sb.s_inodes_per_group;
+
+   // the BGDT starts in the block after the superblock and may span
+   // several blocks
+   bgdt_size = fs->group_count * sizeof(ext2_group_desc);
+   fs->groups = malloc(bgdt_size);
+   fs->inode_tables = calloc(fs->group_count, sizeof(uint8_t *));
+   if (!fs->groups || !fs->inode_tables)
+      return -1;
+
+   bgdt = fetch_range(fs, BLOCK_POS(fs, fs->sb.s_first_data_block + 1),
+         fs->groups, bgdt_size);
+   if (bgdt != fs->groups)
+      memcpy(fs->groups, bgdt, bgdt_size);
+   return 0;
+}
+
+ext2_fs *open_image(const char *path, int use_mmap, size_t cache_blocks) {
+   struct stat st;
+   void *map;
+   ext2_fs *fs = calloc(1, sizeof(ext2_fs));
+
+   if (!fs)
+      return NULL;
+
+   fs->fd = open(path, O_RDONLY);
+   if (fs->fd < 0) {
+      free(fs);
+      return NULL;
+   }
+   pthread_mutex_init(&fs->lock, NULL);
+   pthread_mutex_init(&fs->index_lock, NULL);
+
+   if (use_mmap && !fstat(fs->fd, &st) && S_ISREG(st.st_mode) && st.st_size) {
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fs->fd, 0);
+      if (map != MAP_FAILED) {
+         fs->map = map;
+         fs->map_size = st.st_size;
+      }
+   }
+
+   // the superblock is read uncached: the cache needs the block size
+   if (parse_super(fs)) {
+      int err = errno;
+      close_image(fs);
+      errno = err;
+      return NULL;
+   }
+
+   // fall back silently to cached preads if the image can't be mapped
+   if (!fs->map)
+      fs->cache = cache_create(cache_blocks, fs->block_size);
+
+   return fs;
+}
+
+void close_image(ext2_fs *fs) {
+   if (!fs)
+      return;
+
+   sidecar_close(fs);
+   free_dir_indexes(fs);
+   free_inode_tables(fs);
+   free(fs->groups);
+   cache_destroy(fs->cache);
+
+   if (fs->map)
+      munmap(fs->map, fs->map_size);
+
+   close(fs->fd);
+   pthread_mutex_destroy(&fs->lock);
+   pthread_mutex_destroy(&fs->index_lock);
+   free(fs);
+}
+
+/*
+ * Reads |size| bytes at byte offset |pos| of the image behind |fs| into
+ * |data|, through the mapping or the block cache when there is one. The
+ * cache lock isn't held while a missed block is read from the image, so
+ * other threads' hits aren't held up behind it.
+ */
+static void read_at(ext2_fs *fs, off_t pos, uint8_t *data, size_t size) {
+   uint8_t missed[EXT2_MAX_BLOCK_SIZE];
+   uint32_t block, skip, len;
+   uint8_t *cached;
+
+   if (fs->map) {
+      // anything past the end of the image reads back as zeroes
+      if ((size_t) pos > fs->map_size || size > fs->map_size - pos)
+         memset(data, 0, size);
+      else
+         memcpy(data, fs->map + pos, size);
+      return;
+   }
+
+   if (!fs->cache) {
+      pread_full(fs, data, size, pos);
+      return;
+   }
+
+   // serve the request one cached block at a time
+   while (size) {
+      block = pos >> fs->block_shift;
+      skip = pos & (fs->block_size - 1);
+      len = fs->block_size - skip < size ? fs->block_size - skip : size;
+
+      pthread_mutex_lock(&fs->lock);
+      cached = cache_lookup(fs->cache, block);
+      if (cached)
+         memcpy(data, cached + skip, len);
+      pthread_mutex_unlock(&fs->lock);
+
+      if (!cached) {
+         // read privately, then publish the block
+         pread_full(fs, missed, fs->block_size, BLOCK_POS(fs, block));
+         memcpy(data, missed + skip, len);
+
+         pthread_mutex_lock(&fs->lock);
+         memcpy(cache_insert(fs->cache, block), missed, fs->block_size);
+         pthread_mutex_unlock(&fs->lock);
+      }
+
+      data += len;
+      pos += len;
+      size -= len;
+   }
+}
 
 //the block argument is in terms of SD card 512 byte sectors
 /*
- * Sets cursor to |sector|*512 + |offset|, reads |size| bytes from
- * that position in the FILE *|fp| global, and stores the data in a block
- * pointed to by |data|
+ * Reads |size| bytes at |sector|*512 + |offset| of the image behind |fs|
+ * and stores the data in a block pointed to by |data|
  */
-void read_data(uint32_t sector, uint16_t offset, uint8_t* data, uint16_t size) {
+void read_data(ext2_fs *fs, uint32_t sector, uint16_t offset, uint8_t* data,
+      uint16_t size) {
    if (offset > 511) {
       printf("Offset greater than 511.\n");
       exit(0);
    }
 
-   fseek(fp, sector * 512 + offset, SEEK_SET);
-   fread(data, size, 1, fp);
+   stats_read(&fs->stats, size);
+   read_at(fs, (off_t) sector * 512 + offset, data, size);
+}
+
+void *fetch_block(ext2_fs *fs, uint32_t block, void *buf) {
+   off_t pos = BLOCK_POS(fs, block);
+
+   stats_read(&fs->stats, fs->block_size);
+   if (fs->map && (size_t) pos <= fs->map_size
+         && fs->block_size <= fs->map_size - pos)
+      return fs->map + pos;
+
+   read_at(fs, pos, buf, fs->block_size);
+   return buf;
+}
+
+void *fetch_range(ext2_fs *fs, off_t pos, void *buf, size_t size) {
+   stats_read(&fs->stats, size);
+   if (fs->map) {
+      if (pos >= 0 && (size_t) pos <= fs->map_size
+            && size <= fs->map_size - pos)
+         return fs->map + pos;
+      memset(buf, 0, size);
+      return buf;
+   }
+
+   // bulk reads bypass the block cache so file data can't evict metadata
+   pread_full(fs, buf, size, pos);
+   return buf;
 }
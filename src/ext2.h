@@ -10,8 +10,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-
-extern FILE *fp;
+#include <sys/types.h>
+#include <pthread.h>
+#include "stats.h"
 
 /*
  * Copyright (C) 1992, 1993, 1994, 1995
@@ -61,6 +62,11 @@ typedef struct ext2_group_desc {
 #define  EXT2_TIND_BLOCK         (EXT2_DIND_BLOCK + 1)
 #define  EXT2_N_BLOCKS        (EXT2_TIND_BLOCK + 1)
 
+/*
+ * Inode flags
+ */
+#define EXT2_INDEX_FL 0x00001000 /* hash-indexed directory */
+
 /*
  * Structure of an inode on the disk
  */
@@ -147,23 +153,81 @@ typedef struct ext2_super_block {
    uint32_t s_rev_level; /* Revision level */
    uint16_t s_def_resuid; /* Default uid for reserved blocks */
    uint16_t s_def_resgid; /* Default gid for reserved blocks */
+   /*
+    * These fields are for EXT2_DYNAMIC_REV superblocks only.
+    */
+   uint32_t s_first_ino; /* First non-reserved inode */
+   uint16_t s_inode_size; /* size of inode structure */
+   uint16_t s_block_group_nr; /* block group # of this superblock */
+   uint32_t s_feature_compat; /* compatible feature set */
+   uint32_t s_feature_incompat; /* incompatible feature set */
+   uint32_t s_feature_ro_compat; /* readonly-compatible feature set */
+   uint8_t s_uuid[16]; /* 128-bit uuid for volume */
+   char s_volume_name[16]; /* volume name */
+   char s_last_mounted[64]; /* directory where last mounted */
+   uint32_t s_algorithm_usage_bitmap; /* For compression */
+   uint8_t s_prealloc_blocks; /* Nr of blocks to try to preallocate*/
+   uint8_t s_prealloc_dir_blocks; /* Nr to preallocate for dirs */
+   uint16_t s_padding1;
+   uint8_t s_journal_uuid[16]; /* uuid of journal superblock */
+   uint32_t s_journal_inum; /* inode number of journal file */
+   uint32_t s_journal_dev; /* device number of journal file */
+   uint32_t s_last_orphan; /* start of list of inodes to delete */
+   uint32_t s_hash_seed[4]; /* HTREE hash seed */
+   uint8_t s_def_hash_version; /* Default hash version to use */
+   uint8_t s_reserved_char_pad;
+   uint16_t s_reserved_word_pad;
+   uint32_t s_default_mount_opts;
+   uint32_t s_first_meta_bg; /* First metablock block group */
+   uint32_t s_mkfs_time; /* When the filesystem was created */
+   uint32_t s_jnl_blocks[17]; /* Backup of the journal inode */
+   uint32_t s_blocks_count_hi; /* Blocks count high 32 bits */
+   uint32_t s_r_blocks_count_hi; /* Reserved blocks count high 32 bits */
+   uint32_t s_free_blocks_hi; /* Free blocks count high 32 bits */
+   uint16_t s_min_extra_isize; /* All inodes have at least # bytes */
+   uint16_t s_want_extra_isize; /* New inodes should reserve # bytes */
+   uint32_t s_flags; /* Miscellaneous flags */
+   uint32_t s_reserved[167]; /* Padding to the end of the block */
 } ext2_super_block;
 
+/*
+ * Superblock s_flags
+ */
+#define EXT2_FLAGS_SIGNED_HASH   0x0001 /* Signed dirhash in use */
+#define EXT2_FLAGS_UNSIGNED_HASH 0x0002 /* Unsigned dirhash in use */
+
+#define EXT2_SUPER_MAGIC 0xEF53
+
 /*
  * Revision levels
  */
 #define EXT2_GOOD_OLD_REV  0  /* The good old (original) format */
+#define EXT2_DYNAMIC_REV   1  /* V2 format w/ dynamic inode sizes */
 #define EXT2_CURRENT_REV   EXT2_GOOD_OLD_REV
 #define EXT2_GOOD_OLD_INODE_SIZE 128
 
+/*
+ * Feature set definitions
+ */
+#define EXT2_FEATURE_COMPAT_DIR_INDEX     0x0020
+#define EXT2_FEATURE_INCOMPAT_FILETYPE    0x0002
+
 /*
  * Structure of a directory entry
  */
 
+/*
+ * On revision 0 images name_len is a 16 bit field, but names never exceed
+ * EXT2_NAME_LEN so its high byte is always zero; images with the filetype
+ * feature keep the entry's file type there instead.
+ */
+#define EXT2_NAME_LEN 255
+
 typedef struct ext2_dir_entry {
    uint32_t inode; /* Inode number */
    uint16_t rec_len; /* Directory entry length */
-   uint16_t name_len; /* Name length */
+   uint8_t name_len; /* Name length */
+   uint8_t file_type; /* EXT2_FT_*, with the filetype feature */
    char name[]; /* File name, up to EXT2_NAME_LEN */
 } ext2_dir_entry;
 
@@ -183,4 +247,88 @@ enum {
    EXT2_FT_MAX
 };
 
+/*
+ * Block sizes the readers understand: 1, 2 and 4 KiB
+ */
+#define EXT2_MIN_BLOCK_SIZE 1024
+#define EXT2_MAX_BLOCK_SIZE 4096
+#define EXT2_MIN_BLOCK_LOG_SIZE 10
+#define EXT2_MAX_BLOCK_LOG_SIZE 12
+#define EXT2_BLOCK_SIZES (EXT2_MAX_BLOCK_LOG_SIZE - EXT2_MIN_BLOCK_LOG_SIZE + 1)
+
+/*
+ * Byte offset in the image of block |block| of |fs|
+ */
+#define BLOCK_POS(fs, block) ((off_t) (block) << (fs)->block_shift)
+
+struct block_cache;
+struct dir_index;
+struct sidecar;
+
+/*
+ * An open ext2 image. The superblock and every group descriptor are parsed
+ * once by open_image(); inode tables are loaded on demand by get_inode().
+ * All reads are positional, so several handles (on the same or different
+ * images) can be used side by side. Block reads and inode fetches may be
+ * issued from several threads at once: |lock| guards the block cache and
+ * the loading of inode tables, and |index_lock| the publishing of
+ * directory indexes. |stats| counts the work done through the handle.
+ */
+typedef struct ext2_fs {
+   int fd;
+   uint8_t *map; /* whole image mapped read-only, or NULL */
+   size_t map_size;
+   struct block_cache *cache; /* block cache for unmapped reads, or NULL */
+   ext2_super_block sb;
+   uint32_t block_size; /* 1024 << s_log_block_size */
+   uint32_t block_shift; /* log2 of block_size */
+   ext2_group_desc *groups;
+   uint32_t group_count;
+   uint32_t inode_size;
+   uint8_t **inode_tables; /* per group, loaded by get_inode() */
+   struct dir_index **dir_indexes; /* built by dir_lookup(), or NULL */
+   struct sidecar *sidecar; /* persistent index, see sidecar.h, or NULL */
+   pthread_mutex_t lock;
+   pthread_mutex_t index_lock;
+   io_stats stats;
+} ext2_fs;
+
+/*
+ * Opens the ext2 image at |path| and parses its superblock and group
+ * descriptors. If |use_mmap| is nonzero the whole image is mapped read-only
+ * so that metadata and data blocks can be accessed in place. Otherwise, or
+ * if mapping fails, reads go through pread() behind a block cache of
+ * |cache_blocks| filesystem blocks (0 disables the cache). Returns NULL
+ * with errno set if the image could not be opened or is not a supported
+ * ext2 filesystem.
+ */
+ext2_fs *open_image(const char *path, int use_mmap, size_t cache_blocks);
+
+/*
+ * Releases everything owned by |fs| and closes the image
+ */
+void close_image(ext2_fs *fs);
+
+/*
+ * Reads |size| bytes at |sector|*512 + |offset| of |fs| into |data|
+ */
+void read_data(ext2_fs *fs, uint32_t sector, uint16_t offset, uint8_t* data,
+      uint16_t size);
+
+/*
+ * Returns a pointer to the whole of block |block|. When the image is mapped
+ * the pointer points directly into the mapping and nothing is copied,
+ * otherwise the block is read through the block cache into |buf|, which
+ * must hold block_size bytes, and |buf| is returned. The returned memory
+ * must be treated as read-only.
+ */
+void *fetch_block(ext2_fs *fs, uint32_t block, void *buf);
+
+/*
+ * Like fetch_block() for |size| bytes at byte offset |pos|, issued as one
+ * large read. Used for runs of contiguous data blocks; bypasses the block
+ * cache.
+ */
+void *fetch_range(ext2_fs *fs, off_t pos, void *buf, size_t size);
+
 #endif /* EXT2_H_ */
@@ -0,0 +1,170 @@
+/*
+ * ext2lib.c
+ *
+ * Image handle API, see ext2lib.h
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "ext2lib.h"
+#include "blockmap.h"
+#include "dir.h"
+#include "dirindex.h"
+#include "inode.h"
+#include "sidecar.h"
+
+struct ext2lib {
+   ext2_fs *fs;
+};
+
+ext2lib *ext2lib_open(const char *path, int flags, size_t cache_blocks) {
+   ext2lib *img = malloc(sizeof(ext2lib));
+
+   if (!img)
+      return NULL;
+
+   img->fs = open_image(path, flags & EXT2LIB_MMAP, cache_blocks);
+   if (!img->fs) {
+      free(img);
+      return NULL;
+   }
+   return img;
+}
+
+void ext2lib_close(ext2lib *img) {
+   if (!img)
+      return;
+
+   close_image(img->fs);
+   free(img);
+}
+
+int ext2lib_use_index(ext2lib *img, const char *path, int build) {
+   return sidecar_open(img->fs, path, build);
+}
+
+int ext2lib_lookup(ext2lib *img, const char *path, uint32_t *ino) {
+   uint32_t ino_num = EXT2_ROOT_INO;
+   const char *name = path;
+   size_t len;
+
+   for (;;) {
+      while (*name == '/')
+         name++;
+      if (!*name)
+         break;
+
+      len = strcspn(name, "/");
+      if (inode_type(get_inode(img->fs, ino_num)) != 'd') {
+         errno = ENOTDIR;
+         return -1;
+      }
+      ino_num = dir_lookup(img->fs, ino_num, name, len);
+      if (!ino_num) {
+         errno = ENOENT;
+         return -1;
+      }
+      name += len;
+   }
+
+   *ino = ino_num;
+   return 0;
+}
+
+int ext2lib_stat(ext2lib *img, uint32_t ino, ext2lib_attr *st) {
+   ext2_inode *inode = get_inode(img->fs, ino);
+
+   if (!inode) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   st->ino = ino;
+   st->mode = inode->i_mode;
+   st->nlink = inode->i_links_count;
+   st->uid = inode->i_uid | (uint32_t) inode->osd2.linux2.l_i_uid_high << 16;
+   st->gid = inode->i_gid | (uint32_t) inode->osd2.linux2.l_i_gid_high << 16;
+   st->size = inode_size(inode);
+   st->blocks = inode->i_blocks;
+   st->atime = inode->i_atime;
+   st->mtime = inode->i_mtime;
+   st->ctime = inode->i_ctime;
+   return 0;
+}
+
+typedef struct readdir_state {
+   ext2lib_visitor visit;
+   void *arg;
+} readdir_state;
+
+static int visit_name(ext2_dir_entry *entry, void *arg) {
+   readdir_state *state = arg;
+   char name[EXT2_NAME_LEN + 1];
+
+   memcpy(name, entry->name, entry->name_len);
+   name[entry->name_len] = '\0';
+   return state->visit(name, entry->inode, state->arg) ? 1 : 0;
+}
+
+int ext2lib_readdir(ext2lib *img, uint32_t ino, ext2lib_visitor visit,
+      void *arg) {
+   ext2_inode *dir = get_inode(img->fs, ino);
+   readdir_state state = { visit, arg };
+
+   if (inode_type(dir) != 'd') {
+      errno = ENOTDIR;
+      return -1;
+   }
+
+   iterate_dir(img->fs, dir, visit_name, &state);
+   return 0;
+}
+
+ssize_t ext2lib_read(ext2lib *img, uint32_t ino, void *buf, size_t len,
+      off_t offset) {
+   ext2_fs *fs = img->fs;
+   ext2_inode *inode = get_inode(fs, ino);
+   off_t size, pos, end, start, stop;
+   uint8_t *out = buf;
+   const uint8_t *data;
+   block_iter it;
+   extent run;
+
+   if (inode_type(inode) != 'f') {
+      errno = inode_type(inode) == 'd' ? EISDIR : EINVAL;
+      return -1;
+   }
+
+   size = inode_size(inode);
+   if (offset < 0) {
+      errno = EINVAL;
+      return -1;
+   }
+   if (offset >= size || !len)
+      return 0;
+   end = (off_t) len < size - offset ? offset + (off_t) len : size;
+
+   // map only the blocks overlapping [offset, end), copying their part
+   iter_init(&it, fs, inode);
+   iter_range(&it, offset >> fs->block_shift,
+         (end + fs->block_size - 1) >> fs->block_shift);
+   while (iter_next(&it, &run)) {
+      pos = BLOCK_POS(fs, run.logical);
+      start = pos > offset ? pos : offset;
+      stop = pos + BLOCK_POS(fs, run.length);
+      if (stop > end)
+         stop = end;
+
+      if (!run.physical)
+         memset(out + (start - offset), 0, stop - start);
+      else {
+         data = fetch_range(fs, BLOCK_POS(fs, run.physical) + start - pos,
+               out + (start - offset), stop - start);
+         if (data != out + (start - offset))
+            memcpy(out + (start - offset), data, stop - start);
+      }
+   }
+
+   return end - offset;
+}
@@ -0,0 +1,93 @@
+/*
+ * ext2lib.h
+ *
+ * Embeddable reader API over an opaque image handle, built as
+ * libext2reader.a and libext2reader.so. Every call may be made from any
+ * number of threads on the same handle at once: all image I/O is
+ * positional, file data is read with pread() (or straight out of the
+ * mapping) without taking any lock, and only metadata lookups that go
+ * through the shared block cache serialize briefly on it. Functions
+ * return 0 (or a byte count) on success and -1 with errno set on failure.
+ * This header stands alone: none of the reader's internal headers are
+ * needed to use it.
+ */
+
+#ifndef EXT2LIB_H_
+#define EXT2LIB_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define EXT2LIB_MMAP 0x1 /* map the whole image instead of using pread() */
+
+typedef struct ext2lib ext2lib;
+
+typedef struct ext2lib_attr {
+   uint32_t ino;
+   uint32_t mode; /* file type and permission bits, as in st_mode */
+   uint32_t nlink;
+   uint32_t uid;
+   uint32_t gid;
+   off_t size;
+   off_t blocks; /* 512-byte units allocated, as in st_blocks */
+   time_t atime;
+   time_t mtime;
+   time_t ctime;
+} ext2lib_attr;
+
+/*
+ * Called by ext2lib_readdir() for each entry with its NUL-terminated
+ * |name| and inode number. Returning nonzero stops the listing.
+ */
+typedef int (*ext2lib_visitor)(const char *name, uint32_t ino, void *arg);
+
+/*
+ * Opens the ext2 image at |path|. |flags| is 0 or EXT2LIB_MMAP;
+ * |cache_blocks| sizes the metadata block cache used without the mapping
+ * (0 disables it). Returns NULL with errno set on failure.
+ */
+ext2lib *ext2lib_open(const char *path, int flags, size_t cache_blocks);
+
+/*
+ * Closes |img|. No other call on it may be in progress or follow.
+ */
+void ext2lib_close(ext2lib *img);
+
+/*
+ * Stores in |*ino| the inode number of the absolute |path| ('/' separated,
+ * "/" being the root). Fails with ENOENT or ENOTDIR.
+ */
+int ext2lib_lookup(ext2lib *img, const char *path, uint32_t *ino);
+
+/*
+ * Fills |st| with the attributes of inode |ino|. Fails with EINVAL for an
+ * out of range inode number.
+ */
+int ext2lib_stat(ext2lib *img, uint32_t ino, ext2lib_attr *st);
+
+/*
+ * Calls |visit| with |arg| for every entry of directory |ino|, "." and ".."
+ * included, in on-disk order. Fails with ENOTDIR.
+ */
+int ext2lib_readdir(ext2lib *img, uint32_t ino, ext2lib_visitor visit,
+      void *arg);
+
+/*
+ * Reads up to |len| bytes at byte |offset| of regular file |ino| into
+ * |buf|, holes reading back as zeroes. Returns the number of bytes read,
+ * which is short only at the end of the file. Fails with EISDIR or EINVAL
+ * for anything but a regular file.
+ */
+ssize_t ext2lib_read(ext2lib *img, uint32_t ino, void *buf, size_t len,
+      off_t offset);
+
+/*
+ * Attaches the sidecar index at |path| to |img|, a file of precomputed
+ * paths and block runs that speeds up lookups and reads, building it first
+ * if |build| is nonzero and it is missing or out of date. Must be called
+ * before |img| is shared between threads.
+ */
+int ext2lib_use_index(ext2lib *img, const char *path, int build);
+
+#endif /* EXT2LIB_H_ */
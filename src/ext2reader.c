@@ -6,287 +6,437 @@
  */
 
 #include "ext2reader.h"
+#include "inode.h"
+#include "dir.h"
+#include "dirindex.h"
+#include "readahead.h"
 
 /*
- * This is called by parse_blocks() for recursion, and is not to be
- * directly called by the client application. |blocks| points to the beginning
- * of an inode's i_block field. The inode must of type regular file (0x8000)
- * inside i_mode. |opt| can be either "d" for direct, "i" for indirect, or
- * "I" for doubly indirect.
+ * Writes the data blocks of |ino| to |out| one run at a time, reading each
+ * run of physically contiguous blocks with as few large reads as possible.
+ * Returns 0 on success, -1 on a write error.
  */
-static void parse_blocks_recurs(uint32_t *blocks, char *opt) {
-   int i, j, k;
-   char data[BLOCK_SIZE];
-
-   if (!strcmp(opt, "d")) {
-      for (i = 0; blocks[i] && i < 12; i++) {
-         read_data(blocks[i] * 2, 0, data, BLOCK_SIZE);
-         for (j = 0; data[j] && j < BLOCK_SIZE; j++)
-            printf("%c", data[j]);
+static int dump_runs(ext2_fs *fs, ext2_inode *ino, out_buffer *out) {
+   off_t size = inode_size(ino), pos, len, count;
+   char *chunk = NULL, *data;
+   block_iter it;
+   extent run;
+   int err = 0;
+
+   if (!fs->map)
+      chunk = malloc(READ_CHUNK_SIZE);
+
+   iter_init(&it, fs, ino);
+   while (!err && iter_next(&it, &run)) {
+      pos = BLOCK_POS(fs, run.logical);
+      len = BLOCK_POS(fs, run.length);
+      if (len > size - pos)
+         len = size - pos;
+
+      if (!run.physical) {
+         err = out_zeroes(out, len);
+         continue;
       }
 
-      if (blocks[i - 1])
-         parse_blocks_recurs(blocks, "i");
-   }
-   else if (!strcmp(opt, "i")) {
-      uint32_t direct_blocks[BLOCK_SIZE];
-
-      read_data(blocks[12] * 2, 0, direct_blocks, BLOCK_SIZE);
-      for (i = 0; direct_blocks[i] && i < 256; i++) {
-         read_data(direct_blocks[i] * 2, 0, data, BLOCK_SIZE);
-         for (j = 0; data[j] && j < BLOCK_SIZE; j++)
-            printf("%c", data[j]);
-      }
+      for (pos = 0; pos < len && !err; pos += count) {
+         count = len - pos;
+         if (count > READ_CHUNK_SIZE)
+            count = READ_CHUNK_SIZE;
 
-      if (direct_blocks[i - 1])
-         parse_blocks_recurs(blocks, "I");
-   }
-   else if (!strcmp(opt, "I")) {
-      uint32_t indirect_blocks[BLOCK_SIZE];
-      uint32_t direct_blocks[BLOCK_SIZE];
-
-      read_data(blocks[13] * 2, 0, indirect_blocks, BLOCK_SIZE);
-      for (i = 0; i < 256; i++) {
-         read_data(indirect_blocks[i] * 2, 0, direct_blocks, BLOCK_SIZE);
-         for (j = 0; j < 256; j++) {
-            read_data(direct_blocks[j] * 2, 0, data, BLOCK_SIZE);
-            for (k = 0; data[k] && k < BLOCK_SIZE; k++)
-               printf("%c", data[k]);
-         }
+         data = fetch_range(fs, BLOCK_POS(fs, run.physical) + pos,
+               chunk, count);
+         err = out_write(out, data, count);
       }
    }
-   else
-      fprintf(stderr, "\nError: invalid opt\n");
+
+   free(chunk);
+   return err;
 }
 
 /*
- * Parse block pointers and dump the data to screen. The intended use of this
- * function is such that |blocks| points to the beginning of an inode's
- * i_block field. The inode must be of type regular file (0x8000) inside mode.
- * This function is called within dump_file() and shouldn't be called directly
- * inside the client application
+ * Dumps the data blocks of |ino| to stdout, up to i_size, with the final
+ * block trimmed to the file size. Unless the image is mapped, the blocks of
+ * large files are read ahead on a background thread while earlier ones are
+ * written out. This function is called within dump_file() and shouldn't be
+ * called directly inside the client application
  */
-static void parse_blocks(uint32_t *blocks) {
-   parse_blocks_recurs(blocks, "d");
+static void dump_blocks(ext2_fs *fs, ext2_inode *ino) {
+   const uint8_t *piece;
+   readahead *ra;
+   out_buffer out;
+   off_t len;
+   int err;
+
+   fflush(stdout);
+   err = out_open(&out, STDOUT_FILENO, OUT_BUFFER_SIZE);
+
+   ra = err || fs->map ? NULL : ra_start(fs, ino);
+   if (ra) {
+      while (!err && ra_next(ra, &piece, &len))
+         err = piece ? out_write(&out, piece, len) : out_zeroes(&out, len);
+      ra_stop(ra);
+   }
+   else if (!err)
+      err = dump_runs(fs, ino, &out);
+
+   if (out_close(&out) || err) {
+      perror("\nError: could not write file contents");
+      exit(1);
+   }
 }
 
 void print_error_msg_and_exit(int exit_value) {
    fprintf(stderr,
          "\nUsage: \n"
-               "     ext2reader <image.ext2> [path]\n"
-               "     ext2reader -l <image.ext2> <file_to_dump.txt>\n"
+               "     ext2reader [-ims] [-c blocks] [-S key] [-g glob] <image.ext2> [path]\n"
+               "     ext2reader [-ims] [-c blocks] [-r range] -l <image.ext2> <file_to_dump.txt>\n"
+               "     ext2reader [-ims] [-c blocks] [-r range] -x <image.ext2> <file> [dest]\n"
+               "     ext2reader [-ims] [-c blocks] -b <image.ext2> <path_list>\n"
+               "     ext2reader [-oims] [-j threads] [-c blocks] [-g glob] -R <image.ext2>\n"
+               "                [path]\n"
+               "     ext2reader [-ims] [-j threads] [-c blocks] -X <image.ext2> <dir> <dest>\n"
+               "     ext2reader [-ms] [-j threads] [-c blocks] -u <image.ext2>\n"
+               "     ext2reader [-ims] [-j threads] [-c blocks] -f <image.ext2>\n"
+               "                [predicate...]\n"
+               "     ext2reader [-ims] [-j threads] [-c blocks] -G <image.ext2> <pattern>\n"
+               "                [pattern...]\n"
+               "     ext2reader [-ims] [-j threads] [-c blocks] -H <image.ext2> [path_list]\n"
+               "     ext2reader [-ims] [-j threads] [-c blocks] -V <image.ext2> <manifest>\n"
                "\n     If [path] is not specified, '/' will be used\n"
                "\nOptions:\n"
                "     -l    print to the screen the contents of <file_to_dump.txt>\n"
+               "     -x    extract <file> byte for byte to [dest], or to stdout\n"
+               "     -b    resolve every path listed in <path_list> ('-' for stdin)\n"
+               "           and print <path> <inode> <type> <size> for each\n"
+               "     -R    print <path> <inode> <type> <size> for everything below\n"
+               "           [path], scanning directories in parallel\n"
+               "     -X    restore everything below <dir> into the host directory\n"
+               "           <dest>, copying file contents in parallel\n"
+               "     -r    with -l or -x, only read <offset>[:<length>] bytes of the\n"
+               "           file; a negative offset counts back from its end\n"
+               "     -u    print used and free blocks and inodes per group and in\n"
+               "           total, from the bitmaps, and how fragmented free space is\n"
+               "     -f    print <path> <inode> <type> <size> for every inode matching\n"
+               "           all the predicates, found by scanning the inode tables:\n"
+               "           size<N size=N size>N (N in bytes, or with K, M or G),\n"
+               "           mtime<T mtime=T mtime>T, ctime... (T in seconds since the\n"
+               "           epoch, or YYYY-MM-DD), type=f|d|l|c|b|p|s, perm=OCTAL,\n"
+               "           mode&OCTAL (any of the bits), uid=N, gid=N\n"
+               "     -G    print <path> <offset> for every place a pattern occurs in\n"
+               "           the contents of a regular file; patterns are byte strings\n"
+               "           that may use the escapes \\xHH \\t \\n \\r \\0 and \\\\\n"
+               "     -H    print <path> <crc32c> for every regular file, or for those\n"
+               "           listed in [path_list] ('-' for stdin), as a manifest\n"
+               "     -V    check the files of <manifest> ('-' for stdin) and print\n"
+               "           <path> FAILED or <path> MISSING for each that doesn't match\n"
+               "     -j    number of threads used by -R, -X, -u, -f, -G, -H and -V\n"
+               "           (default: one per CPU)\n"
+               "     -o    with -R, print in depth-first on-disk order every time\n"
+               "     -S    sort the listing by name, size, inode or type\n"
+               "     -g    only list entries whose name matches <glob>, e.g. 'f1*'\n"
+               "     -i, --index[=file]\n"
+               "           look paths and block runs up in a sidecar index kept in\n"
+               "           <file> (default <image.ext2>.idx), building it if it is\n"
+               "           missing or out of date\n"
+               "     -m    memory-map the image instead of using buffered reads\n"
+               "     -c    size of the block cache used for buffered reads, in blocks\n"
+               "           (default 1024, 0 disables the cache)\n"
+               "     -s, --stats[=text|json]\n"
+               "           print I/O counters, cache statistics, latency\n"
+               "           histograms and peak memory to stderr when done\n"
                "\nNotes:\n"
                "     All paths not prefixed with '/' are relative to the root directory\n");
    exit(exit_value);
 }
 
-uint32_t *find_dir(FILE *image, char *dir) {
-   int i;
-   bool found;
-
-   // get superblock
-   ext2_super_block *sb = malloc(BLOCK_SIZE);
-   read_data(2, 0, sb, BLOCK_SIZE);
-
-   // get bgdt, root dir entry list, and an array of the first
-   // 12 blocks in inode 2
-   ext2_group_desc *bgdt = malloc(BLOCK_SIZE);
-   ext2_inode *ino = malloc(INODE_SIZE);
-   ext2_dir_entry *dentry = malloc(BLOCK_SIZE);
-   uint32_t *blocks = malloc(12 * sizeof(uint32_t));
-
-   read_data(2 + TO_BGDT, 0, bgdt, BLOCK_SIZE);
-   read_data(bgdt[0].bg_inode_table * 2, INODE_SIZE, ino, INODE_SIZE);
-
-   // copy all the direct block pointers to a blocks array for root
-   // inode (inode 2)
-   for (i = 0; ino->i_block[i] && i < 12; i++)
-      blocks[i] = ino->i_block[i];
-   blocks[i] = 0;
-   read_data(blocks[i = 0] * 2, 0, dentry, BLOCK_SIZE);
-   ext2_dir_entry *dentry_next = dentry;
-
-   if (strcmp(dir, "/")) { // if not equal to root
-      char dir_cpy[DEFAULT_SIZE];
-      strcpy(dir_cpy, dir);
-      char *dir_search = strtok(dir_cpy, "/");
-
-      // search for each tokenized directory until dir_search is found
-      while (dentry_next->inode && dir_search) {
-         found = false;
-         char dentry_name[DEFAULT_SIZE];
-
-         // obtain name of dentry as a c-string
-         strncpy(dentry_name, dentry_next->name, dentry_next->name_len);
-         dentry_name[dentry_next->name_len] = NULL;
-
-         // locate entry name match
-         if (!strcmp(dir_search, dentry_name)) {
-            int block_group = (dentry_next->inode - 1) / sb->s_inodes_per_group;
-            int local_inode_index = (dentry_next->inode - 1)
-                  % sb->s_inodes_per_group;
-
-            int sectors = local_inode_index * INODE_SIZE / 512;
-            int offset = local_inode_index * INODE_SIZE % 512;
-            read_data(bgdt[block_group].bg_inode_table * 2 + sectors, offset,
-                  ino, INODE_SIZE);
-
-            // if a matched entry name is a directory
-            if (ino->i_mode >> ISDIR_SHIFT & 1) {
-               for (i = 0; ino->i_block[i] && i < 12; i++)
-                  blocks[i] = ino->i_block[i];
-               blocks[i] = 0;
-               i = 0;
-
-               read_data(blocks[0] * 2, 0, dentry, BLOCK_SIZE);
-               dentry_next = dentry;
-
-               dir_search = strtok(NULL, "/");
-               found = true;
-
-               continue;
-            }
-         }
-
-         // go to the next directory entry
-         dentry_next = ((char *) dentry_next) + dentry_next->rec_len;
-         if ((char *) dentry_next - (char *) dentry >= BLOCK_SIZE) {
-            read_data(blocks[++i] * 2, 0, dentry, BLOCK_SIZE);
-            dentry_next = dentry;
-         }
-      }
+uint32_t find_dir(ext2_fs *fs, char *dir) {
+   uint32_t dir_ino = EXT2_ROOT_INO;
+   char *dir_cpy = strdup(dir), *dir_search, *save;
+   unsigned long start = stats_now();
 
-      if (!found) {
+   if (!dir_cpy) {
+      fprintf(stderr, "\nError: out of memory. Exiting...\n");
+      exit(1);
+   }
+
+   // look up each tokenized component in its parent's name index
+   for (dir_search = strtok_r(dir_cpy, "/", &save); dir_search;
+         dir_search = strtok_r(NULL, "/", &save)) {
+      dir_ino = dir_lookup(fs, dir_ino, dir_search, strlen(dir_search));
+      if (inode_type(dir_ino ? get_inode(fs, dir_ino) : NULL) != 'd') {
          fprintf(stderr, "\nError: %s is not a directory. Exiting...\n", dir);
          exit(1);
       }
    }
 
-   // teardown
-   free(dentry);
-   free(ino);
-   free(bgdt);
-   free(sb);
-   return blocks;
+   free(dir_cpy);
+   stats_record(&fs->stats, STATS_RESOLVE, start);
+   return dir_ino;
 }
 
-void list_entries(uint32_t *blocks) {
-   int i = 0, size;
-   int sectors, offset, block_group, local_idx;
-   char name[DEFAULT_SIZE];
+/*
+ * A directory entry collected by list_entries(). |name| is an offset into
+ * the listing's name buffer.
+ */
+typedef struct listed_entry {
+   uint32_t inode;
+   uint32_t name;
+   off_t size;
    char type;
+} listed_entry;
 
-   // get superblock
-   ext2_super_block *sb = malloc(BLOCK_SIZE);
-   read_data(2, 0, sb, BLOCK_SIZE);
-
-   // get bgdt and allocate space for an inode
-   ext2_group_desc *bgdt = malloc(BLOCK_SIZE);
-   read_data(4, 0, bgdt, BLOCK_SIZE);
-   ext2_inode *ino = malloc(INODE_SIZE);
-
-   // set dir and dir_next directory entries
-   ext2_dir_entry *dir = malloc(BLOCK_SIZE);
-   read_data(blocks[i] * 2, 0, dir, BLOCK_SIZE);
-   ext2_dir_entry *dir_next = dir;
-
-   printf("%20s %20s %20s\n\n", "filename", "type", "size");
-   while (dir_next->inode) {
-      // turn directory entry name into c-string
-      strncpy(name, dir_next->name, dir_next->name_len);
-      name[dir_next->name_len] = NULL;
-
-      // get the associating inode
-      block_group = (dir_next->inode - 1) / sb->s_inodes_per_group;
-      local_idx = (dir_next->inode - 1) % sb->s_inodes_per_group;
-      sectors = local_idx * INODE_SIZE / 512;
-      offset = local_idx * INODE_SIZE % 512;
-
-      read_data(bgdt[block_group].bg_inode_table * 2 + sectors, offset, ino,
-      INODE_SIZE);
-
-      if (ino->i_mode >> ISDIR_SHIFT & 1)
-         type = 'd';
-      else if (ino->i_mode >> ISFILE_SHIFT & 1)
-         type = 'f';
-      else
-         type = 'u';
-      size = ino->i_size;
-
-      printf("%20s %20c %20d\n", name, type, size);
+/*
+ * The entries of a directory being listed, in directory order
+ */
+typedef struct listing {
+   listed_entry *entries;
+   size_t count;
+   size_t capacity;
+   char *names;
+   size_t names_len;
+   size_t names_cap;
+   const name_filter *filter; /* or NULL to list everything */
+} listing;
+
+static int collect_entry(ext2_dir_entry *dentry, void *arg) {
+   listing *list = arg;
+
+   if (list->filter && !filter_match(list->filter, dentry->name,
+         dentry->name_len))
+      return 0;
+
+   if (list->count == list->capacity) {
+      list->capacity = list->capacity ? list->capacity * 2 : 64;
+      list->entries = realloc(list->entries,
+            list->capacity * sizeof(listed_entry));
+   }
+   while (list->names_len + dentry->name_len + 1 > list->names_cap) {
+      list->names_cap = list->names_cap ? list->names_cap * 2 : 1024;
+      list->names = realloc(list->names, list->names_cap);
+   }
+   if (!list->entries || !list->names)
+      return -1;
+
+   // turn directory entry name into c-string
+   list->entries[list->count].inode = dentry->inode;
+   list->entries[list->count].name = list->names_len;
+   memcpy(list->names + list->names_len, dentry->name, dentry->name_len);
+   list->names_len += dentry->name_len;
+   list->names[list->names_len++] = '\0';
+   list->count++;
+   return 0;
+}
 
-      dir_next = ((char *) dir_next) + dir_next->rec_len;
-      if ((char *) dir_next - (char *) dir >= BLOCK_SIZE) {
-         read_data(blocks[++i] * 2, 0, dir, BLOCK_SIZE);
-         dir_next = dir;
-      }
+/*
+ * Stores in |order| the listing order of the |count| |entries| for |key|.
+ * Ties in the other keys are broken by name. Returns -1 if memory ran
+ * out.
+ */
+static int sort_listing(listed_entry *entries, const char *names,
+      size_t count, sort_key key, uint32_t *order) {
+   uint32_t *offsets;
+   off_t *keys;
+   size_t n;
+   int err;
+
+   // hard links share an inode, so that key needs the name order too
+   if (key == SORT_NONE) {
+      for (n = 0; n < count; n++)
+         order[n] = n;
+   }
+   else {
+      offsets = malloc(count * sizeof(uint32_t));
+      if (!offsets)
+         return -1;
+      for (n = 0; n < count; n++)
+         offsets[n] = entries[n].name;
+      err = sort_names(names, offsets, order, count);
+      free(offsets);
+      if (err)
+         return -1;
    }
 
-   free(dir);
-   free(ino);
-   free(bgdt);
-   free(sb);
+   if (key == SORT_NONE || key == SORT_NAME)
+      return 0;
+
+   keys = malloc(count * sizeof(off_t));
+   if (!keys)
+      return -1;
+   for (n = 0; n < count; n++)
+      keys[n] = key == SORT_SIZE ? entries[n].size
+            : key == SORT_INODE ? entries[n].inode
+            : (uint32_t) (unsigned char) entries[n].type;
+   err = sort_keys(keys, order, count);
+   free(keys);
+   return err;
 }
 
-void dump_file(uint32_t *blocks, char *file_dump) {
-   int i = 0;
-   ext2_super_block *sb = malloc(BLOCK_SIZE);
-   ext2_group_desc *bgdt = malloc(BLOCK_SIZE);
-   ext2_inode *ino = malloc(INODE_SIZE);
-   ext2_dir_entry *dentry = malloc(BLOCK_SIZE);
-   bool data_dumped = false;
-
-   read_data(2, 0, sb, BLOCK_SIZE);
-   read_data(2 + TO_BGDT, 0, bgdt, BLOCK_SIZE);
-   read_data(blocks[i] * 2, 0, dentry, BLOCK_SIZE);
-
-   ext2_dir_entry *dentry_next = dentry;
-
-   while (dentry_next->inode && !data_dumped) {
-      char dentry_name[DEFAULT_SIZE];
-
-      strncpy(dentry_name, dentry_next->name, dentry_next->name_len);
-      dentry_name[dentry_next->name_len] = NULL;
-
-      // locate entry name and verify if a file
-      if (!strcmp(file_dump, dentry_name)) {
-         int block_group = (dentry_next->inode - 1) / sb->s_inodes_per_group;
-         int local_inode_index = (dentry_next->inode - 1)
-               % sb->s_inodes_per_group;
-
-         int sectors = local_inode_index * INODE_SIZE / 512;
-         int offset = local_inode_index * INODE_SIZE % 512;
-         read_data(bgdt[block_group].bg_inode_table * 2 + sectors, offset, ino,
-         INODE_SIZE);
-
-         // if a file, traverse through all in-use block pointers to dump
-         // data
-         if (ino->i_mode >> ISFILE_SHIFT & 1) {
-            uint32_t *block = ino->i_block;
-            parse_blocks(block);
-            data_dumped = true;
-            continue;
-         }
-      }
+void list_entries(ext2_fs *fs, uint32_t dir_ino, sort_key key,
+      const name_filter *filter) {
+   listing list = { 0 };
+   listed_entry *entries;
+   uint32_t *order;
+   off_t *inodes;
+   char *names, line[EXT2_NAME_LEN + 64];
+   size_t n, count;
+   ext2_inode *ino;
+   out_buffer out;
+   int len, err;
+   unsigned long start = stats_now();
+
+   // first pass: collect the entries in directory order
+   list.filter = filter;
+   if (iterate_dir(fs, get_inode(fs, dir_ino), collect_entry, &list)) {
+      fprintf(stderr, "\nError: out of memory. Exiting...\n");
+      exit(1);
+   }
+   entries = list.entries;
+   names = list.names;
+   count = list.count;
+
+   // second pass: fetch the inodes in inode number order so the inode
+   // tables are walked sequentially
+   order = malloc(count * sizeof(uint32_t) + 1);
+   inodes = malloc(count * sizeof(off_t) + 1);
+   if (!order || !inodes) {
+      fprintf(stderr, "\nError: out of memory. Exiting...\n");
+      exit(1);
+   }
+   for (n = 0; n < count; n++) {
+      order[n] = n;
+      inodes[n] = entries[n].inode;
+   }
+   if (sort_keys(inodes, order, count)) {
+      fprintf(stderr, "\nError: out of memory. Exiting...\n");
+      exit(1);
+   }
+   free(inodes);
 
-      dentry_next = ((char *) dentry_next) + dentry_next->rec_len;
-      if ((char *) dentry_next - (char *) dentry >= BLOCK_SIZE) {
-         read_data(blocks[++i] * 2, 0, dentry, BLOCK_SIZE);
-         dentry_next = dentry;
-      }
+   for (n = 0; n < count; n++) {
+      listed_entry *entry = &entries[order[n]];
+
+      ino = get_inode(fs, entry->inode);
+      entry->type = inode_type(ino);
+      entry->size = ino ? inode_size(ino) : 0;
+   }
+
+   if (sort_listing(entries, names, count, key, order)
+         || out_open(&out, STDOUT_FILENO, OUT_BUFFER_SIZE)) {
+      fprintf(stderr, "\nError: out of memory. Exiting...\n");
+      exit(1);
+   }
+
+   // stream the listing out in large writes
+   fflush(stdout);
+   len = snprintf(line, sizeof(line), "%20s %20s %20s\n\n", "filename",
+         "type", "size");
+   err = out_write(&out, line, len);
+   for (n = 0; n < count && !err; n++) {
+      listed_entry *entry = &entries[order[n]];
+
+      len = snprintf(line, sizeof(line), "%20s %20c %20lld\n",
+            names + entry->name, entry->type, (long long) entry->size);
+      err = out_write(&out, line, len);
+   }
+
+   if (out_close(&out) || err) {
+      perror("\nError: could not write listing");
+      exit(1);
    }
 
-   if (!data_dumped) {
+   free(order);
+   free(names);
+   free(entries);
+   stats_record(&fs->stats, STATS_LIST, start);
+}
+
+/*
+ * Looks up the regular file |file_name| inside the directory with inode
+ * number |dir_ino| and returns its inode from the inode table cache. Exits
+ * if the file is not found.
+ */
+static ext2_inode *find_file(ext2_fs *fs, uint32_t dir_ino, char *file_name) {
+   unsigned long start = stats_now();
+   uint32_t ino_num = dir_lookup(fs, dir_ino, file_name, strlen(file_name));
+   ext2_inode *ino = ino_num ? get_inode(fs, ino_num) : NULL;
+
+   if (inode_type(ino) != 'f') {
       fprintf(stderr, "\nError: file %s could not be found. Exiting...\n",
-            file_dump);
+            file_name);
+      exit(1);
+   }
+
+   stats_record(&fs->stats, STATS_RESOLVE, start);
+   return ino;
+}
+
+void dump_file(ext2_fs *fs, uint32_t dir_ino, char *file_dump) {
+   ext2_inode *ino = find_file(fs, dir_ino, file_dump);
+   unsigned long start = stats_now();
+
+   // traverse through all in-use block pointers to dump data
+   dump_blocks(fs, ino);
+   stats_record(&fs->stats, STATS_READ, start);
+}
+
+/*
+ * Copies bytes |offset| up to |end| of |ino| to |out_fd|, reproducing holes.
+ * Only the blocks in that range and the pointer blocks leading to them are
+ * read. Exits on a write error.
+ */
+static void copy_file(ext2_fs *fs, ext2_inode *ino, off_t offset, off_t end,
+      int out_fd) {
+   off_t pos, start, stop;
+   block_iter it;
+   extent run;
+   int err = 0;
+
+   iter_init(&it, fs, ino);
+   iter_range(&it, offset >> fs->block_shift,
+         (end + fs->block_size - 1) >> fs->block_shift);
+   while (!err && iter_next(&it, &run)) {
+      // the first and last runs only partly overlap the range
+      pos = BLOCK_POS(fs, run.logical);
+      start = pos > offset ? pos : offset;
+      stop = pos + BLOCK_POS(fs, run.length);
+      if (stop > end)
+         stop = end;
+
+      if (!run.physical)
+         err = write_hole(out_fd, stop - start);
+      else
+         err = copy_range(fs, BLOCK_POS(fs, run.physical) + start - pos,
+               out_fd, stop - start);
+   }
+
+   if (err || finish_output(out_fd)) {
+      perror("\nError: could not write extracted data");
       exit(1);
    }
+}
+
+void extract_file(ext2_fs *fs, uint32_t dir_ino, char *file_name,
+      int out_fd) {
+   ext2_inode *ino = find_file(fs, dir_ino, file_name);
+   unsigned long start = stats_now();
+
+   copy_file(fs, ino, 0, inode_size(ino), out_fd);
+   stats_record(&fs->stats, STATS_READ, start);
+}
 
-   free(sb);
-   free(bgdt);
-   free(ino);
-   free(dentry);
+void read_range(ext2_fs *fs, uint32_t dir_ino, char *file_name,
+      off_t offset, off_t length, int out_fd) {
+   ext2_inode *ino = find_file(fs, dir_ino, file_name);
+   unsigned long start = stats_now();
+   off_t size = inode_size(ino), end;
+
+   // a negative offset counts back from the end of the file
+   if (offset < 0)
+      offset = -offset < size ? size + offset : 0;
+   if (offset > size)
+      offset = size;
+   end = length < 0 || length > size - offset ? size : offset + length;
+
+   copy_file(fs, ino, offset, end, out_fd);
+   stats_record(&fs->stats, STATS_READ, start);
 }
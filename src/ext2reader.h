@@ -11,14 +11,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "ext2.h"
+#include "blockmap.h"
+#include "output.h"
+#include "sort.h"
+#include "match.h"
 
-#define DEFAULT_SIZE 64
-#define BLOCK_SIZE 1024
-#define INODE_SIZE sizeof(ext2_inode)
-#define TO_BGDT 2
-#define ISDIR_SHIFT 14
-#define ISFILE_SHIFT 15
+#define READ_CHUNK_SIZE (8 * 1024 * 1024) /* largest single read of a dump */
 
 typedef enum bool {
    false, true
@@ -31,27 +31,46 @@ typedef enum bool {
 void print_error_msg_and_exit(int exit_value);
 
 /*
- * Finds the directory specified by |dir| inside ext2 filesystem |image|
- * and returns a uint32_t pointer pointing to the beginning of the 12
- * direct block pointers associated to the |dir| inode. Client is responsible
- * for freeing the dynamically allocated ext2_dir_entry.
+ * Finds the directory specified by |dir| inside the ext2 filesystem |fs|
+ * and returns its inode number. Each path component is looked up through
+ * dir_lookup(), so directories of any size (and htree indexed ones) are
+ * supported. Exits if |dir| is not a directory.
  */
-uint32_t *find_dir(FILE *image, char *dir);
+uint32_t find_dir(ext2_fs *fs, char *dir);
 
 /*
- * List entries inside some directory whose directory entries are pointed
- * to by |blocks|. |blocks| associates to a directory inode's 12 direct
- * pointers. Use find_dir() to get the direct block pointers associated to a
- * directory inode then pass them into list_entries() or dump_file()
+ * List entries inside the directory with inode number |dir_ino|, in
+ * on-disk order or sorted by |key|, skipping names that don't match
+ * |filter| unless it is NULL. Use find_dir() to get the inode number of a
+ * directory then pass it into list_entries() or dump_file()
  */
-void list_entries(uint32_t *blocks);
+void list_entries(ext2_fs *fs, uint32_t dir_ino, sort_key key,
+      const name_filter *filter);
 
 /*
  * Dumps contents of file |file_dump| given that |file_dump| is a valid file
- * inside the directory associated to |blocks|. |blocks| is obtained using
- * find_dir() and specifies the 12 direct block pointers belonging to the
- * inode found using find_dir()
+ * inside the directory with inode number |dir_ino|, as obtained using
+ * find_dir()
  */
-void dump_file(uint32_t *blocks, char *file_dump);
+void dump_file(ext2_fs *fs, uint32_t dir_ino, char *file_dump);
+
+/*
+ * Copies the contents of file |file_name|, found the same way as in
+ * dump_file(), to |out_fd| exactly as stored: holes are reproduced and the
+ * output ends at i_size. Data runs are moved by the kernel with
+ * copy_file_range()/splice()/sendfile() where possible.
+ */
+void extract_file(ext2_fs *fs, uint32_t dir_ino, char *file_name,
+      int out_fd);
+
+/*
+ * Like extract_file(), but copies only |length| bytes (up to the end of the
+ * file if negative) from byte |offset|, which counts back from the end of
+ * the file if negative. The block pointer tree is descended straight to the
+ * first block of the range, so the cost depends on the range, not on where
+ * it lies in the file.
+ */
+void read_range(ext2_fs *fs, uint32_t dir_ino, char *file_name,
+      off_t offset, off_t length, int out_fd);
 
 #endif /* EXT2READER_H_ */
@@ -0,0 +1,734 @@
+/*
+ * grep.c
+ *
+ * Parallel content search, see grep.h
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include "grep.h"
+#include "blockmap.h"
+#include "inode.h"
+#include "plan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define VECTOR_LEADS 16 /* most distinct leading pairs for the vector scan */
+
+/*
+ * A regular file to search. Its inode stays valid until the image is
+ * closed, so the threads can map the seams of its jobs.
+ */
+typedef struct grep_file {
+   char *path;
+   ext2_inode *ino;
+   off_t size;
+} grep_file;
+
+typedef struct grep_match {
+   off_t offset;
+   uint32_t file;
+} grep_match;
+
+/*
+ * The patterns grouped by their first byte, so that a job is scanned once
+ * for all of them: those starting with byte c are patterns[order[i]] for
+ * start[c] <= i < start[c + 1].
+ */
+typedef struct grep_matcher {
+   const grep_pattern *patterns;
+   size_t count;
+   size_t max_len; /* longest pattern */
+   uint32_t *order;
+   uint32_t start[257];
+   uint8_t firsts[256]; /* the distinct first bytes */
+   int first_count;
+   uint8_t pairs[256 * 256 / 8]; /* bitmap of the first two bytes */
+   /*
+    * The distinct first two bytes, the second being left out for one byte
+    * patterns. |lead_count| is VECTOR_LEADS + 1 if there are more.
+    */
+   uint8_t leads[VECTOR_LEADS][2];
+   int lead_single[VECTOR_LEADS];
+   int lead_count;
+} grep_matcher;
+
+typedef struct grep_plan {
+   ext2_fs *fs;
+   dir_walk walk;
+   job_plan jobs; /* |file| indexing |files| */
+   grep_matcher matcher;
+   grep_file *files;
+   size_t file_count;
+   size_t file_cap;
+} grep_plan;
+
+/*
+ * Matches found by one thread, merged once every thread is done
+ */
+typedef struct grep_worker {
+   grep_plan *plan;
+   grep_match *matches;
+   size_t count;
+   size_t cap;
+} grep_worker;
+
+static const uint8_t *find_scalar(const uint8_t *haystack, size_t size,
+      const uint8_t *needle, size_t len) {
+   const uint8_t *p = haystack, *last;
+
+   if (len > size)
+      return NULL;
+
+   // memchr() is vectorized by the C library for the first byte
+   last = haystack + size - len;
+   while (p <= last) {
+      p = memchr(p, needle[0], last - p + 1);
+      if (!p)
+         return NULL;
+      if (!memcmp(p + 1, needle + 1, len - 1))
+         return p;
+      p++;
+   }
+   return NULL;
+}
+
+#ifdef HAVE_X86_KERNELS
+/*
+ * The kernels compare the first and the last byte of the needle at 16 or
+ * 32 positions at once and only check the bytes in between where both
+ * agree, so runs of text that merely share the first byte cost nothing.
+ * They never read past |size|.
+ */
+__attribute__((target("sse2")))
+static const uint8_t *find_sse2(const uint8_t *haystack, size_t size,
+      const uint8_t *needle, size_t len) {
+   __m128i first, last, a, b;
+   unsigned mask;
+   size_t i;
+
+   if (len < 2)
+      return find_scalar(haystack, size, needle, len);
+
+   first = _mm_set1_epi8((char) needle[0]);
+   last = _mm_set1_epi8((char) needle[len - 1]);
+   for (i = 0; i + len + 15 <= size; i += 16) {
+      a = _mm_loadu_si128((const __m128i *) (haystack + i));
+      b = _mm_loadu_si128((const __m128i *) (haystack + i + len - 1));
+      mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+            _mm_cmpeq_epi8(b, last)));
+      for (; mask; mask &= mask - 1) {
+         size_t at = i + __builtin_ctz(mask);
+         if (!memcmp(haystack + at + 1, needle + 1, len - 2))
+            return haystack + at;
+      }
+   }
+   return find_scalar(haystack + i, size - i, needle, len);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t *find_avx2(const uint8_t *haystack, size_t size,
+      const uint8_t *needle, size_t len) {
+   __m256i first, last, a, b;
+   unsigned mask;
+   size_t i;
+
+   if (len < 2)
+      return find_scalar(haystack, size, needle, len);
+
+   first = _mm256_set1_epi8((char) needle[0]);
+   last = _mm256_set1_epi8((char) needle[len - 1]);
+   for (i = 0; i + len + 31 <= size; i += 32) {
+      a = _mm256_loadu_si256((const __m256i *) (haystack + i));
+      b = _mm256_loadu_si256((const __m256i *) (haystack + i + len - 1));
+      mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+      for (; mask; mask &= mask - 1) {
+         size_t at = i + __builtin_ctz(mask);
+         if (!memcmp(haystack + at + 1, needle + 1, len - 2))
+            return haystack + at;
+      }
+   }
+   return find_sse2(haystack + i, size - i, needle, len);
+}
+#endif
+
+static int add_match(grep_worker *worker, uint32_t file, off_t offset) {
+   if (worker->count == worker->cap) {
+      size_t cap = worker->cap ? worker->cap * 2 : 256;
+      grep_match *matches = realloc(worker->matches, cap * sizeof(grep_match));
+      if (!matches)
+         return -1;
+      worker->matches = matches;
+      worker->cap = cap;
+   }
+
+   worker->matches[worker->count].offset = offset;
+   worker->matches[worker->count].file = file;
+   worker->count++;
+   return 0;
+}
+
+/*
+ * The bytes at |base| of file |file| being searched for matches ending
+ * past |min_end|
+ */
+typedef struct grep_scan {
+   grep_worker *worker;
+   const uint8_t *data;
+   size_t size;
+   size_t min_end;
+   off_t base;
+   uint32_t file;
+} grep_scan;
+
+/*
+ * Records offset |at| of |scan| if one of the patterns starting with the
+ * byte there matches, the first that does being enough. Returns -1 if
+ * memory ran out.
+ */
+static inline __attribute__((always_inline))
+int match_at(const grep_scan *scan, size_t at) {
+   const grep_matcher *m = &scan->worker->plan->matcher;
+   const uint8_t *p = scan->data + at;
+   const grep_pattern *pattern;
+   uint32_t i;
+
+   // the first two bytes rule most candidates out without a comparison
+   if (at + 1 < scan->size
+         && !(m->pairs[(p[0] << 5) | (p[1] >> 3)] & (1 << (p[1] & 7))))
+      return 0;
+
+   for (i = m->start[p[0]]; i < m->start[p[0] + 1]; i++) {
+      pattern = &m->patterns[m->order[i]];
+      if (pattern->len <= scan->size - at && at + pattern->len > scan->min_end
+            && !memcmp(p + 1, pattern->bytes + 1, pattern->len - 1))
+         return add_match(scan->worker, scan->file, scan->base + at);
+   }
+   return 0;
+}
+
+/*
+ * The scan_* kernels run match_at() at every offset of |scan| below
+ * |limit| that holds the first byte of a pattern. They return -1 if memory
+ * ran out.
+ */
+static int scan_scalar(const grep_scan *scan, size_t from, size_t limit) {
+   const grep_matcher *m = &scan->worker->plan->matcher;
+   const uint8_t *p;
+   size_t at;
+
+   if (m->first_count == 1) {
+      for (at = from; at < limit; at = p - scan->data + 1) {
+         p = memchr(scan->data + at, m->firsts[0], limit - at);
+         if (!p)
+            break;
+         if (match_at(scan, p - scan->data))
+            return -1;
+      }
+      return 0;
+   }
+
+   for (at = from; at < limit; at++)
+      if (m->start[scan->data[at] + 1] != m->start[scan->data[at]]
+            && match_at(scan, at))
+         return -1;
+   return 0;
+}
+
+#ifdef HAVE_X86_KERNELS
+/*
+ * Compare 16 or 32 positions at once with the first two bytes of each
+ * lead, as long as there are few enough leads for that to beat a table
+ * lookup per byte
+ */
+__attribute__((target("sse2")))
+static int scan_sse2(const grep_scan *scan, size_t from, size_t limit) {
+   const grep_matcher *m = &scan->worker->plan->matcher;
+   __m128i firsts[VECTOR_LEADS], seconds[VECTOR_LEADS], a, b, hit, hits;
+   unsigned mask;
+   size_t i;
+   int l;
+
+   if (m->lead_count > VECTOR_LEADS)
+      return scan_scalar(scan, from, limit);
+
+   for (l = 0; l < m->lead_count; l++) {
+      firsts[l] = _mm_set1_epi8((char) m->leads[l][0]);
+      seconds[l] = _mm_set1_epi8((char) m->leads[l][1]);
+   }
+   for (i = from; i + 16 <= limit && i + 17 <= scan->size; i += 16) {
+      a = _mm_loadu_si128((const __m128i *) (scan->data + i));
+      b = _mm_loadu_si128((const __m128i *) (scan->data + i + 1));
+      hits = _mm_setzero_si128();
+      for (l = 0; l < m->lead_count; l++) {
+         hit = _mm_cmpeq_epi8(a, firsts[l]);
+         if (!m->lead_single[l])
+            hit = _mm_and_si128(hit, _mm_cmpeq_epi8(b, seconds[l]));
+         hits = _mm_or_si128(hits, hit);
+      }
+      for (mask = _mm_movemask_epi8(hits); mask; mask &= mask - 1)
+         if (match_at(scan, i + __builtin_ctz(mask)))
+            return -1;
+   }
+   return scan_scalar(scan, i, limit);
+}
+
+__attribute__((target("avx2")))
+static int scan_avx2(const grep_scan *scan, size_t from, size_t limit) {
+   const grep_matcher *m = &scan->worker->plan->matcher;
+   __m256i firsts[VECTOR_LEADS], seconds[VECTOR_LEADS], a, b, hit, hits;
+   unsigned mask;
+   size_t i;
+   int l;
+
+   if (m->lead_count > VECTOR_LEADS)
+      return scan_scalar(scan, from, limit);
+
+   for (l = 0; l < m->lead_count; l++) {
+      firsts[l] = _mm256_set1_epi8((char) m->leads[l][0]);
+      seconds[l] = _mm256_set1_epi8((char) m->leads[l][1]);
+   }
+   for (i = from; i + 32 <= limit && i + 33 <= scan->size; i += 32) {
+      a = _mm256_loadu_si256((const __m256i *) (scan->data + i));
+      b = _mm256_loadu_si256((const __m256i *) (scan->data + i + 1));
+      hits = _mm256_setzero_si256();
+      for (l = 0; l < m->lead_count; l++) {
+         hit = _mm256_cmpeq_epi8(a, firsts[l]);
+         if (!m->lead_single[l])
+            hit = _mm256_and_si256(hit, _mm256_cmpeq_epi8(b, seconds[l]));
+         hits = _mm256_or_si256(hits, hit);
+      }
+      for (mask = _mm256_movemask_epi8(hits); mask; mask &= mask - 1)
+         if (match_at(scan, i + __builtin_ctz(mask)))
+            return -1;
+   }
+   return scan_sse2(scan, i, limit);
+}
+#endif
+
+static const uint8_t *(*find_kernel)(const uint8_t *, size_t, const uint8_t *,
+      size_t) = find_scalar;
+static int (*scan_kernel)(const grep_scan *, size_t, size_t) = scan_scalar;
+static const char *kernel_name = "scalar";
+
+/*
+ * Picks the widest kernel the CPU supports before main() runs, so the
+ * choice never races with the search threads
+ */
+__attribute__((constructor))
+static void pick_kernel(void) {
+#ifdef HAVE_X86_KERNELS
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      find_kernel = find_avx2;
+      scan_kernel = scan_avx2;
+      kernel_name = "avx2";
+   }
+   else if (__builtin_cpu_supports("sse2")) {
+      find_kernel = find_sse2;
+      scan_kernel = scan_sse2;
+      kernel_name = "sse2";
+   }
+#endif
+}
+
+const uint8_t *find_bytes(const uint8_t *haystack, size_t size,
+      const uint8_t *needle, size_t len) {
+   return find_kernel(haystack, size, needle, len);
+}
+
+const char *grep_kernel(void) {
+   return kernel_name;
+}
+
+static int hex_digit(char c) {
+   if (c >= '0' && c <= '9')
+      return c - '0';
+   if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+   if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+   return -1;
+}
+
+/*
+ * Decodes the escape at |in| into |*c|. Returns its length in |in|, or 0
+ * if it is malformed.
+ */
+static int decode_escape(const char *in, char *c) {
+   int hi, lo;
+
+   switch (in[1]) {
+   case 'x':
+      hi = hex_digit(in[2]);
+      lo = hi < 0 ? -1 : hex_digit(in[3]);
+      if (lo < 0)
+         return 0;
+      *c = (char) (hi << 4 | lo);
+      return 4;
+   case 't':
+      *c = '\t';
+      return 2;
+   case 'n':
+      *c = '\n';
+      return 2;
+   case 'r':
+      *c = '\r';
+      return 2;
+   case '0':
+      *c = '\0';
+      return 2;
+   case '\\':
+      *c = '\\';
+      return 2;
+   }
+   return 0;
+}
+
+int parse_pattern(char *arg, grep_pattern *pattern) {
+   size_t len = 0, i;
+   int n;
+   char c;
+
+   // checked first so that a bad pattern is left as given for the error
+   for (i = 0; arg[i]; i += n, len++)
+      if (!(n = arg[i] == '\\' ? decode_escape(arg + i, &c) : 1))
+         return -1;
+   if (!len || len > GREP_MAX_PATTERN)
+      return -1;
+
+   // decoding only ever shrinks the pattern, so it's done in place
+   for (i = 0, len = 0; arg[i]; i += n)
+      if (arg[i] == '\\')
+         n = decode_escape(arg + i, &arg[len++]);
+      else {
+         arg[len++] = arg[i];
+         n = 1;
+      }
+
+   pattern->bytes = (const uint8_t *) arg;
+   pattern->len = len;
+   return 0;
+}
+
+/*
+ * Notes the first two bytes of |pattern| as a lead of |m| unless already
+ * known
+ */
+static void add_lead(grep_matcher *m, const grep_pattern *pattern) {
+   int single = pattern->len == 1, l;
+
+   for (l = 0; l < m->lead_count && l < VECTOR_LEADS; l++)
+      if (m->leads[l][0] == pattern->bytes[0] && m->lead_single[l] == single
+            && (single || m->leads[l][1] == pattern->bytes[1]))
+         return;
+   if (m->lead_count == VECTOR_LEADS) {
+      m->lead_count++;
+      return;
+   }
+   if (m->lead_count > VECTOR_LEADS)
+      return;
+
+   m->leads[m->lead_count][0] = pattern->bytes[0];
+   m->leads[m->lead_count][1] = single ? 0 : pattern->bytes[1];
+   m->lead_single[m->lead_count] = single;
+   m->lead_count++;
+}
+
+/*
+ * Groups the |count| |patterns| by their first byte into |m| and notes
+ * their first two bytes. Returns -1 if memory ran out.
+ */
+static int init_matcher(grep_matcher *m, const grep_pattern *patterns,
+      size_t count) {
+   uint32_t next[256];
+   const uint8_t *b;
+   size_t i;
+   int c;
+
+   m->patterns = patterns;
+   m->count = count;
+   m->order = malloc(count * sizeof(uint32_t) + 1);
+   if (!m->order)
+      return -1;
+
+   memset(m->start, 0, sizeof(m->start));
+   memset(m->pairs, 0, sizeof(m->pairs));
+   for (i = 0; i < count; i++) {
+      b = patterns[i].bytes;
+      m->start[b[0] + 1]++;
+      if (patterns[i].len > m->max_len)
+         m->max_len = patterns[i].len;
+
+      add_lead(m, &patterns[i]);
+
+      // a one byte pattern matches whatever follows it
+      if (patterns[i].len == 1)
+         memset(m->pairs + (b[0] << 5), 0xff, 256 / 8);
+      else
+         m->pairs[(b[0] << 5) | (b[1] >> 3)] |= 1 << (b[1] & 7);
+   }
+   for (c = 0; c < 256; c++) {
+      if (m->start[c + 1])
+         m->firsts[m->first_count++] = (uint8_t) c;
+      m->start[c + 1] += m->start[c];
+      next[c] = m->start[c];
+   }
+   for (i = 0; i < count; i++)
+      m->order[next[patterns[i].bytes[0]]++] = (uint32_t) i;
+   return 0;
+}
+
+/*
+ * Records the file |path| of inode |ino| and queues read jobs for its data
+ * runs. Holes need no job. Returns -1 if memory ran out.
+ */
+static int plan_file(grep_plan *plan, ext2_inode *ino, char *path) {
+   if (plan->file_count == plan->file_cap) {
+      size_t file_cap = plan->file_cap ? plan->file_cap * 2 : 1024;
+      grep_file *files = realloc(plan->files, file_cap * sizeof(grep_file));
+      if (!files) {
+         free(path);
+         return -1;
+      }
+      plan->files = files;
+      plan->file_cap = file_cap;
+   }
+   plan->files[plan->file_count].path = path;
+   plan->files[plan->file_count].ino = ino;
+   plan->files[plan->file_count].size = inode_size(ino);
+   plan->file_count++;
+
+   return plan_runs(&plan->jobs, ino, plan->file_count - 1);
+}
+
+static int plan_entry(dir_walk *walk, ext2_dir_entry *entry) {
+   grep_plan *plan = walk->arg;
+   ext2_inode *ino = get_inode(plan->fs, entry->inode);
+   char *path;
+
+   if (!ino || !(S_ISDIR(ino->i_mode) || S_ISREG(ino->i_mode)))
+      return 0;
+   if (S_ISREG(ino->i_mode) && !inode_size(ino))
+      return 0;
+
+   path = entry_path(walk, entry);
+   if (!path)
+      return -1;
+
+   if (S_ISREG(ino->i_mode))
+      return plan_file(plan, ino, path);
+
+   if (walk_push(walk, entry->inode, path)) {
+      free(path);
+      return -1;
+   }
+   return 0;
+}
+
+static int by_file_offset(const void *a, const void *b) {
+   const grep_match *x = a, *y = b;
+
+   if (x->file != y->file)
+      return x->file < y->file ? -1 : 1;
+   return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/*
+ * Records every offset of the |size| bytes at |data|, which hold the bytes
+ * at |base| of file |file|, where a pattern starts before |limit| and ends
+ * past |min_end|. The data is scanned once for all the patterns, see
+ * match_at(). Returns -1 if memory ran out.
+ */
+static int search(grep_worker *worker, uint32_t file, off_t base,
+      const uint8_t *data, size_t size, size_t limit, size_t min_end) {
+   const grep_matcher *m = &worker->plan->matcher;
+   const grep_pattern *pattern;
+   const uint8_t *p, *hit;
+   grep_scan scan;
+
+   // with a single pattern find_bytes() also checks its last byte
+   if (m->count == 1) {
+      pattern = &m->patterns[0];
+      for (p = data; (hit = find_bytes(p, data + size - p, pattern->bytes,
+            pattern->len)) && (size_t) (hit - data) < limit; p = hit + 1)
+         if ((size_t) (hit - data) + pattern->len > min_end
+               && add_match(worker, file, base + (hit - data)))
+            return -1;
+      return 0;
+   }
+
+   scan.worker = worker;
+   scan.data = data;
+   scan.size = size;
+   scan.min_end = min_end;
+   scan.base = base;
+   scan.file = file;
+   return scan_kernel(&scan, 0, limit);
+}
+
+/*
+ * Copies the |len| bytes at |offset| of |file| into |buf| through the
+ * block cache, with holes reading as zeroes. Only used for the seams
+ * between jobs, which are shorter than the longest pattern.
+ */
+static void read_seam(ext2_fs *fs, grep_file *file, off_t offset,
+      uint8_t *buf, size_t len) {
+   uint8_t block[EXT2_MAX_BLOCK_SIZE];
+   const uint8_t *data;
+   off_t start, from, to;
+   block_iter it;
+   extent run;
+   uint32_t b;
+
+   memset(buf, 0, len);
+   iter_init(&it, fs, file->ino);
+   iter_range(&it, offset >> fs->block_shift,
+         ((offset + len - 1) >> fs->block_shift) + 1);
+   while (iter_next(&it, &run)) {
+      for (b = 0; run.physical && b < run.length; b++) {
+         start = BLOCK_POS(fs, run.logical + b);
+         from = start > offset ? start : offset;
+         to = start + fs->block_size;
+         if (to > offset + (off_t) len)
+            to = offset + len;
+         if (from >= to)
+            continue;
+         data = fetch_block(fs, run.physical + b, block);
+         memcpy(buf + (from - offset), data + (from - start), to - from);
+      }
+   }
+}
+
+/*
+ * Search thread: claims jobs in physical order until none are left. A
+ * match crossing the end of a job is found on the seam made of the job's
+ * last bytes and the bytes of the file that follow it.
+ */
+static void search_jobs(job_plan *jobs, void *arg) {
+   grep_worker *worker = arg;
+   grep_plan *plan = worker->plan;
+   ext2_fs *fs = plan->fs;
+   uint8_t *buf = malloc(BLOCK_POS(fs, GREP_CHUNK_BLOCKS));
+   size_t max_len = plan->matcher.max_len;
+   uint8_t *seam = malloc(2 * max_len);
+   const uint8_t *data;
+   grep_file *file;
+   unsigned long start;
+   size_t head, tail;
+   read_job *job;
+   off_t end;
+
+   if (!buf || !seam) {
+      jobs->out_of_memory = 1;
+      free(buf);
+      free(seam);
+      return;
+   }
+
+   while ((job = claim_job(jobs))) {
+      start = stats_now();
+      file = &plan->files[job->file];
+      data = fetch_range(fs, job->pos, buf, job->len);
+      if (search(worker, job->file, job->offset, data, job->len, job->len, 0))
+         jobs->out_of_memory = 1;
+
+      end = job->offset + job->len;
+      if (max_len > 1 && end < file->size) {
+         head = job->len < max_len - 1 ? job->len : max_len - 1;
+         tail = file->size - end < (off_t) max_len - 1
+               ? (size_t) (file->size - end) : max_len - 1;
+         memcpy(seam, data + job->len - head, head);
+         read_seam(fs, file, end, seam + head, tail);
+
+         // only matches starting in the job and ending past it are new
+         if (search(worker, job->file, end - head, seam, head + tail, head,
+               head))
+            jobs->out_of_memory = 1;
+      }
+      stats_record(&fs->stats, STATS_READ, start);
+   }
+
+   free(buf);
+   free(seam);
+}
+
+/*
+ * Merges the matches of the |count| workers into file and offset order
+ * and prints them once each. Returns the number printed, or -1 if memory
+ * ran out.
+ */
+static long print_found(grep_plan *plan, grep_worker *workers, int count,
+      FILE *out) {
+   grep_match *all;
+   size_t total = 0, i, n = 0;
+   long printed = 0;
+   int w;
+
+   for (w = 0; w < count; w++)
+      total += workers[w].count;
+   if (!total)
+      return 0;
+
+   all = malloc(total * sizeof(grep_match));
+   if (!all)
+      return -1;
+   for (w = 0; w < count; w++) {
+      memcpy(all + n, workers[w].matches, workers[w].count * sizeof(grep_match));
+      n += workers[w].count;
+   }
+   qsort(all, total, sizeof(grep_match), by_file_offset);
+
+   for (i = 0; i < total; i++) {
+      if (i && all[i].file == all[i - 1].file
+            && all[i].offset == all[i - 1].offset)
+         continue;
+      fprintf(out, "%s\t%lld\n", plan->files[all[i].file].path,
+            (long long) all[i].offset);
+      printed++;
+   }
+
+   free(all);
+   return printed;
+}
+
+long grep_image(ext2_fs *fs, const grep_pattern *patterns, size_t count,
+      int threads, FILE *out) {
+   grep_plan plan = { 0 };
+   grep_worker workers[PLAN_MAX_THREADS];
+   long found = -1;
+   int i, started;
+   size_t f;
+
+   plan.fs = fs;
+   plan.walk.fs = fs;
+   plan.walk.arg = &plan;
+   plan.walk.visit = plan_entry;
+   plan.jobs.fs = fs;
+   plan.jobs.chunk_blocks = GREP_CHUNK_BLOCKS;
+   memset(workers, 0, sizeof(workers));
+   for (i = 0; i < PLAN_MAX_THREADS; i++)
+      workers[i].plan = &plan;
+
+   // each thread keeps its own matches
+   if (!init_matcher(&plan.matcher, patterns, count)
+         && !walk_dirs(&plan.walk, EXT2_ROOT_INO, "")
+         && (started = run_jobs(&plan.jobs, threads, search_jobs, workers,
+               sizeof(grep_worker))) > 0)
+      found = print_found(&plan, workers, started, out);
+
+   for (i = 0; i < PLAN_MAX_THREADS; i++)
+      free(workers[i].matches);
+   walk_free(&plan.walk);
+   free_jobs(&plan.jobs);
+   free(plan.matcher.order);
+   for (f = 0; f < plan.file_count; f++)
+      free(plan.files[f].path);
+   free(plan.files);
+
+   return found;
+}
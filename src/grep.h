@@ -0,0 +1,66 @@
+/*
+ * grep.h
+ *
+ * Content search over every regular file of an image, without writing any
+ * file data out. A metadata pass walks the tree and turns each file's block
+ * map into read jobs; a pool of threads then reads the jobs in physical
+ * block order, one large read apiece, and scans each of them once for all
+ * the patterns: they are grouped by first byte, a vector kernel (AVX2, SSE2
+ * or scalar, picked once at startup) finds the bytes that start any of
+ * them, and only the patterns starting with that byte are compared there.
+ * Matches that straddle two jobs are caught on the seam between them.
+ */
+
+#ifndef GREP_H_
+#define GREP_H_
+
+#include "ext2.h"
+
+#define GREP_CHUNK_BLOCKS 1024 /* largest single read job */
+#define GREP_MAX_PATTERN 4096 /* longest pattern, in bytes */
+
+/*
+ * A byte string to search for
+ */
+typedef struct grep_pattern {
+   const uint8_t *bytes;
+   size_t len;
+} grep_pattern;
+
+/*
+ * Decodes the escapes \xHH, \t, \n, \r, \0 and \\ of the pattern |arg| in
+ * place and points |pattern| at the result. Returns 0 on success, -1 if
+ * |arg| is empty, longer than GREP_MAX_PATTERN bytes or has a malformed
+ * escape.
+ */
+int parse_pattern(char *arg, grep_pattern *pattern);
+
+/*
+ * Searches every regular file of |fs| for the |count| patterns with
+ * |threads| threads and writes one line per match to |out|:
+ *
+ *    <path> <offset>
+ *
+ * where |offset| is the byte offset in the file at which a pattern starts.
+ * Lines are sorted by path in walk order, then by offset; several patterns
+ * starting at the same offset give a single line. Holes read as zeroes,
+ * but only data blocks are searched, so a match starting inside a hole is
+ * not reported. Returns the number of matches, or -1 if memory ran out.
+ */
+long grep_image(ext2_fs *fs, const grep_pattern *patterns, size_t count,
+      int threads, FILE *out);
+
+/*
+ * Returns the first occurrence of the |len| bytes at |needle| in the |size|
+ * bytes at |haystack|, or NULL
+ */
+const uint8_t *find_bytes(const uint8_t *haystack, size_t size,
+      const uint8_t *needle, size_t len);
+
+/*
+ * Returns the name of the search kernel picked for this CPU: "avx2",
+ * "sse2" or "scalar"
+ */
+const char *grep_kernel(void);
+
+#endif /* GREP_H_ */
@@ -0,0 +1,329 @@
+/*
+ * htree.c
+ *
+ * Hashed directory index lookups, see htree.h. The hash functions follow
+ * the kernel's fs/ext4/hash.c so that they agree with the index written by
+ * the kernel and by e2fsck -D.
+ */
+
+#include <string.h>
+#include "htree.h"
+#include "blockmap.h"
+#include "match.h"
+
+#define DX_EOF_32BIT 0x7fffffffu
+#define DELTA 0x9E3779B9
+
+#define ROL32(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+
+/* F, G and H are basic MD4 functions: selection, majority, parity */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + x, a = ROL32(a, s))
+#define K1 0
+#define K2 013240474631u
+#define K3 015666365641u
+
+static void tea_transform(uint32_t buf[4], const uint32_t in[4]) {
+   uint32_t sum = 0;
+   uint32_t b0 = buf[0], b1 = buf[1];
+   uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+   int n = 16;
+
+   do {
+      sum += DELTA;
+      b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+      b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+   } while (--n);
+
+   buf[0] += b0;
+   buf[1] += b1;
+}
+
+static void half_md4_transform(uint32_t buf[4], const uint32_t in[8]) {
+   uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+   /* Round 1 */
+   ROUND(F, a, b, c, d, in[0] + K1, 3);
+   ROUND(F, d, a, b, c, in[1] + K1, 7);
+   ROUND(F, c, d, a, b, in[2] + K1, 11);
+   ROUND(F, b, c, d, a, in[3] + K1, 19);
+   ROUND(F, a, b, c, d, in[4] + K1, 3);
+   ROUND(F, d, a, b, c, in[5] + K1, 7);
+   ROUND(F, c, d, a, b, in[6] + K1, 11);
+   ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+   /* Round 2 */
+   ROUND(G, a, b, c, d, in[1] + K2, 3);
+   ROUND(G, d, a, b, c, in[3] + K2, 5);
+   ROUND(G, c, d, a, b, in[5] + K2, 9);
+   ROUND(G, b, c, d, a, in[7] + K2, 13);
+   ROUND(G, a, b, c, d, in[0] + K2, 3);
+   ROUND(G, d, a, b, c, in[2] + K2, 5);
+   ROUND(G, c, d, a, b, in[4] + K2, 9);
+   ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+   /* Round 3 */
+   ROUND(H, a, b, c, d, in[3] + K3, 3);
+   ROUND(H, d, a, b, c, in[7] + K3, 9);
+   ROUND(H, c, d, a, b, in[2] + K3, 11);
+   ROUND(H, b, c, d, a, in[6] + K3, 15);
+   ROUND(H, a, b, c, d, in[1] + K3, 3);
+   ROUND(H, d, a, b, c, in[5] + K3, 9);
+   ROUND(H, c, d, a, b, in[0] + K3, 11);
+   ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+   buf[0] += a;
+   buf[1] += b;
+   buf[2] += c;
+   buf[3] += d;
+}
+
+/* The old legacy hash */
+static uint32_t dx_hack_hash(const char *name, size_t len, int is_unsigned) {
+   uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+   int c;
+
+   while (len--) {
+      c = is_unsigned ? (int) (unsigned char) *name
+            : (int) (signed char) *name;
+      name++;
+      hash = hash1 + (hash0 ^ (c * 7152373));
+
+      if (hash & 0x80000000)
+         hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+   }
+   return hash0 << 1;
+}
+
+static void str2hashbuf(const char *msg, size_t len, uint32_t *buf, int num,
+      int is_unsigned) {
+   uint32_t pad, val;
+   size_t i;
+   int c;
+
+   pad = (uint32_t) len | ((uint32_t) len << 8);
+   pad |= pad << 16;
+
+   val = pad;
+   if (len > (size_t) num * 4)
+      len = num * 4;
+   for (i = 0; i < len; i++) {
+      c = is_unsigned ? (int) (unsigned char) msg[i]
+            : (int) (signed char) msg[i];
+      val = c + (val << 8);
+      if ((i % 4) == 3) {
+         *buf++ = val;
+         val = pad;
+         num--;
+      }
+   }
+   if (--num >= 0)
+      *buf++ = val;
+   while (--num >= 0)
+      *buf++ = pad;
+}
+
+uint32_t dx_hash(const char *name, size_t len, int version,
+      const uint32_t *seed) {
+   uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+   uint32_t in[8], hash = 0;
+   int is_unsigned = version >= DX_HASH_LEGACY_UNSIGNED;
+   int i;
+
+   // an all-zero seed means use the default one
+   for (i = 0; seed && i < 4; i++) {
+      if (seed[i]) {
+         memcpy(buf, seed, sizeof(buf));
+         break;
+      }
+   }
+
+   switch (version) {
+   case DX_HASH_LEGACY:
+   case DX_HASH_LEGACY_UNSIGNED:
+      hash = dx_hack_hash(name, len, is_unsigned);
+      break;
+   case DX_HASH_HALF_MD4:
+   case DX_HASH_HALF_MD4_UNSIGNED:
+      for (;;) {
+         str2hashbuf(name, len, in, 8, is_unsigned);
+         half_md4_transform(buf, in);
+         if (len <= 32)
+            break;
+         len -= 32;
+         name += 32;
+      }
+      hash = buf[1];
+      break;
+   case DX_HASH_TEA:
+   case DX_HASH_TEA_UNSIGNED:
+      for (;;) {
+         str2hashbuf(name, len, in, 4, is_unsigned);
+         tea_transform(buf, in);
+         if (len <= 16)
+            break;
+         len -= 16;
+         name += 16;
+      }
+      hash = buf[0];
+      break;
+   }
+
+   hash &= ~1;
+   if (hash == (DX_EOF_32BIT << 1))
+      hash = (DX_EOF_32BIT - 1) << 1;
+   return hash;
+}
+
+/*
+ * One index node on the path from the root to a leaf
+ */
+typedef struct dx_frame {
+   uint8_t buf[EXT2_MAX_BLOCK_SIZE];
+   dx_entry *entries;
+   int count;
+   int at;
+} dx_frame;
+
+/*
+ * Returns logical block |logical| of the directory iterated by |it|, read
+ * into |buf| unless the image is mapped, or NULL if the block is a hole.
+ * Only the pointer blocks on the way to it are read.
+ */
+static uint8_t *read_dir_block(ext2_fs *fs, block_iter *it, uint32_t logical,
+      uint8_t *buf) {
+   // the top bits of an index entry's block are reserved
+   uint32_t physical = iter_lookup(it, logical & 0x0fffffff);
+
+   if (!physical)
+      return NULL;
+
+   STATS_ADD(fs->stats.dir_block_fetches, 1);
+   return fetch_block(fs, physical, buf);
+}
+
+/*
+ * Points |frame| at the index entries starting at byte |offset| of
+ * |block|, or fails if |block| is NULL. Returns -1 if the entries' count
+ * and limit don't fit the block, as happens on a corrupted image.
+ */
+static int load_entries(ext2_fs *fs, dx_frame *frame, uint8_t *block,
+      size_t offset) {
+   dx_countlimit *cl;
+
+   if (!block)
+      return -1;
+   cl = (dx_countlimit *) (block + offset);
+   if (!cl->count || cl->count > cl->limit
+         || cl->limit > (fs->block_size - offset) / sizeof(dx_entry))
+      return -1;
+   frame->entries = (dx_entry *) cl;
+   frame->count = cl->count;
+   frame->at = 0;
+   return 0;
+}
+
+/*
+ * Returns the last entry among the |count| in |entries| whose hash is not
+ * greater than |hash|. entries[0] covers everything below entries[1].
+ */
+static int find_entry(dx_entry *entries, int count, uint32_t hash) {
+   int lo = 1, hi = count - 1, mid;
+
+   while (lo <= hi) {
+      mid = lo + (hi - lo) / 2;
+      if (entries[mid].hash > hash)
+         hi = mid - 1;
+      else
+         lo = mid + 1;
+   }
+   return lo - 1;
+}
+
+int htree_lookup(ext2_fs *fs, ext2_inode *dir, const char *name, size_t len,
+      uint32_t *ino_num) {
+   dx_frame frames[DX_MAX_LEVELS];
+   uint8_t leaf_buf[EXT2_MAX_BLOCK_SIZE], *root, *leaf;
+   dx_root_info *info;
+   block_iter it;
+   uint32_t hash, next_hash;
+   int version, levels, level;
+
+   if (!(fs->sb.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX)
+         || !(dir->i_flags & EXT2_INDEX_FL))
+      return -1;
+
+   // blocks are mapped one at a time, only those the lookup visits
+   iter_init(&it, fs, dir);
+
+   // the root lives behind the "." and ".." entries of block 0
+   root = read_dir_block(fs, &it, 0, frames[0].buf);
+   if (!root)
+      return -1;
+
+   info = (dx_root_info *) (root + 24);
+   levels = info->indirect_levels + 1;
+   version = info->hash_version;
+   if (info->reserved_zero || info->info_length != 8 || levels > DX_MAX_LEVELS
+         || version > DX_HASH_TEA)
+      return -1;
+
+   if (version <= DX_HASH_TEA && fs->sb.s_flags & EXT2_FLAGS_UNSIGNED_HASH)
+      version += DX_HASH_LEGACY_UNSIGNED;
+
+   hash = dx_hash(name, len, version, fs->sb.s_hash_seed);
+   if (load_entries(fs, &frames[0], root, 24 + info->info_length))
+      return -1;
+
+   // walk down the index to the leaf covering |hash|
+   for (level = 0; level < levels; level++) {
+      dx_frame *frame = &frames[level];
+
+      frame->at = find_entry(frame->entries, frame->count, hash);
+      if (level + 1 < levels) {
+         dx_frame *next = &frames[level + 1];
+
+         // index nodes start with an empty entry spanning the block
+         if (load_entries(fs, next, read_dir_block(fs, &it,
+               frame->entries[frame->at].block, next->buf), 8))
+            return -1;
+      }
+   }
+
+   for (;;) {
+      dx_frame *frame = &frames[levels - 1];
+
+      leaf = read_dir_block(fs, &it, frame->entries[frame->at].block,
+            leaf_buf);
+      *ino_num = leaf ? find_in_block(leaf, fs->block_size, name, len)
+            : 0;
+      if (*ino_num)
+         return 1;
+
+      // names whose hash collides can continue into the next leaf
+      for (level = levels - 1; level >= 0; level--)
+         if (frames[level].at + 1 < frames[level].count)
+            break;
+      if (level < 0)
+         break;
+
+      frames[level].at++;
+      next_hash = frames[level].entries[frames[level].at].hash;
+      if ((next_hash & ~1) != hash)
+         break;
+
+      for (; level + 1 < levels; level++) {
+         dx_frame *next = &frames[level + 1];
+
+         if (load_entries(fs, next, read_dir_block(fs, &it,
+               frames[level].entries[frames[level].at].block, next->buf), 8))
+            return -1;
+      }
+   }
+   return 0;
+}
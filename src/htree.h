@@ -0,0 +1,66 @@
+/*
+ * htree.h
+ *
+ * Read-only support for the on-disk hashed directory index (dir_index /
+ * htree). An indexed directory keeps a small B-tree keyed by a hash of the
+ * entry name in its first block, so looking up a name only reads the index
+ * blocks on the path to one leaf and that leaf.
+ */
+
+#ifndef HTREE_H_
+#define HTREE_H_
+
+#include "ext2.h"
+
+/*
+ * Hash versions, as stored in dx_root_info.hash_version
+ */
+#define DX_HASH_LEGACY 0
+#define DX_HASH_HALF_MD4 1
+#define DX_HASH_TEA 2
+#define DX_HASH_LEGACY_UNSIGNED 3
+#define DX_HASH_HALF_MD4_UNSIGNED 4
+#define DX_HASH_TEA_UNSIGNED 5
+
+#define DX_MAX_LEVELS 3
+
+typedef struct dx_root_info {
+   uint32_t reserved_zero;
+   uint8_t hash_version;
+   uint8_t info_length; /* 8 */
+   uint8_t indirect_levels;
+   uint8_t unused_flags;
+} dx_root_info;
+
+/*
+ * The first entry of every index node overlays its hash with the node's
+ * limit and count
+ */
+typedef struct dx_entry {
+   uint32_t hash;
+   uint32_t block;
+} dx_entry;
+
+typedef struct dx_countlimit {
+   uint16_t limit;
+   uint16_t count;
+} dx_countlimit;
+
+/*
+ * Computes the directory hash of the |len| byte |name| with hash
+ * |version|, seeded with |seed| (four words, all zero for the default
+ * seed). The low bit is always clear.
+ */
+uint32_t dx_hash(const char *name, size_t len, int version,
+      const uint32_t *seed);
+
+/*
+ * Looks up |name| in the indexed directory |dir| of |fs| through its htree.
+ * Returns 1 and stores the entry's inode in |*ino_num| if found, 0 if the
+ * name is not in the directory and -1 if |dir| has no usable index, in
+ * which case the caller has to scan the directory itself.
+ */
+int htree_lookup(ext2_fs *fs, ext2_inode *dir, const char *name, size_t len,
+      uint32_t *ino_num);
+
+#endif /* HTREE_H_ */
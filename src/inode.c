@@ -0,0 +1,126 @@
+/*
+ * inode.c
+ *
+ * Per block group inode table cache, see inode.h
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include "inode.h"
+#include "blockmap.h"
+#include "sidecar.h"
+
+ext2_inode *get_inode(ext2_fs *fs, uint32_t ino_num) {
+   uint32_t group, index;
+   size_t table_size;
+   uint8_t *table, *buf;
+   ext2_inode *inode;
+
+   if (!ino_num || ino_num > fs->sb.s_inodes_count)
+      return NULL;
+
+   STATS_ADD(fs->stats.inode_fetches, 1);
+
+   // indexed inodes are rebuilt from the sidecar, whose copy carries runs,
+   // without loading their table
+   if (fs->sidecar && (inode = sidecar_inode(fs, ino_num)))
+      return inode;
+
+   group = (ino_num - 1) / fs->sb.s_inodes_per_group;
+   index = (ino_num - 1) % fs->sb.s_inodes_per_group;
+
+   // a table is published once fully read, so readers only lock to load
+   table = __atomic_load_n(&fs->inode_tables[group], __ATOMIC_ACQUIRE);
+   if (!table) {
+      pthread_mutex_lock(&fs->lock);
+      table = fs->inode_tables[group];
+      if (!table) {
+         table_size = (size_t) fs->sb.s_inodes_per_group * fs->inode_size;
+         buf = malloc(table_size);
+         if (!buf) {
+            pthread_mutex_unlock(&fs->lock);
+            return NULL;
+         }
+
+         // one sequential read for the whole table, or a pointer into the map
+         table = fetch_range(fs,
+               BLOCK_POS(fs, fs->groups[group].bg_inode_table), buf,
+               table_size);
+         if (table != buf)
+            free(buf);
+         __atomic_store_n(&fs->inode_tables[group], table, __ATOMIC_RELEASE);
+      }
+      pthread_mutex_unlock(&fs->lock);
+   }
+
+   return (ext2_inode *) (table + (size_t) index * fs->inode_size);
+}
+
+char inode_type(ext2_inode *ino) {
+   if (!ino)
+      return 'u';
+
+   switch (ino->i_mode & S_IFMT) {
+   case S_IFREG:
+      return 'f';
+   case S_IFDIR:
+      return 'd';
+   case S_IFLNK:
+      return 'l';
+   case S_IFCHR:
+      return 'c';
+   case S_IFBLK:
+      return 'b';
+   case S_IFIFO:
+      return 'p';
+   case S_IFSOCK:
+      return 's';
+   default:
+      return 'u';
+   }
+}
+
+long read_symlink(ext2_fs *fs, ext2_inode *ino, char *buf, size_t size) {
+   uint8_t block[EXT2_MAX_BLOCK_SIZE];
+   const uint8_t *data;
+   off_t len = inode_size(ino);
+   uint32_t acl_blocks = ino->i_file_acl ? fs->block_size >> 9 : 0;
+   block_iter it;
+   uint32_t physical;
+
+   if ((size_t) len >= size || len > fs->block_size)
+      return -1;
+
+   // a fast symlink has no data block, bar an extended attribute block
+   if (ino->i_blocks == acl_blocks && (size_t) len < sizeof(ino->i_block))
+      data = (const uint8_t *) ino->i_block;
+   else {
+      iter_init(&it, fs, ino);
+      physical = iter_lookup(&it, 0);
+      if (!physical)
+         return -1;
+      data = fetch_block(fs, physical, block);
+   }
+
+   memcpy(buf, data, len);
+   buf[len] = '\0';
+   return len;
+}
+
+void free_inode_tables(ext2_fs *fs) {
+   uint32_t i;
+   uint8_t *table;
+
+   if (!fs->inode_tables)
+      return;
+
+   // tables that point into the mapping aren't ours to free
+   for (i = 0; i < fs->group_count; i++) {
+      table = fs->inode_tables[i];
+      if (table < fs->map || table >= fs->map + fs->map_size)
+         free(table);
+   }
+
+   free(fs->inode_tables);
+   fs->inode_tables = NULL;
+}
@@ -0,0 +1,45 @@
+/*
+ * inode.h
+ *
+ * Per block group inode table cache. The first inode fetched from a group
+ * loads that group's whole inode table with one sequential read (or simply
+ * points into the mapping for memory-mapped images); every later inode in
+ * the group is served from memory. Inodes held by an attached sidecar index
+ * are served from it, without loading their table.
+ */
+
+#ifndef INODE_H_
+#define INODE_H_
+
+#include "ext2.h"
+
+/*
+ * Returns inode number |ino_num| (1-based) of |fs|. The pointer stays valid
+ * until |fs| is closed. Returns NULL for an out of range number or if the
+ * inode table could not be loaded.
+ */
+ext2_inode *get_inode(ext2_fs *fs, uint32_t ino_num);
+
+/*
+ * Classifies |ino| by the file type bits of i_mode the way listings print
+ * it: 'f' (regular file), 'd' (directory), 'l' (symbolic link), 'c' and
+ * 'b' (character and block devices), 'p' (FIFO), 's' (socket), or 'u' for
+ * an unknown type or a NULL inode
+ */
+char inode_type(ext2_inode *ino);
+
+/*
+ * Copies the target of the symbolic link |ino| of |fs| into |buf| of
+ * |size| bytes and terminates it. Short targets are kept in i_block (fast
+ * symlinks), longer ones in the link's first data block. Returns the
+ * target's length, or -1 if it doesn't fit |buf| or can't be read.
+ */
+long read_symlink(ext2_fs *fs, ext2_inode *ino, char *buf, size_t size);
+
+/*
+ * Releases every inode table of |fs| loaded by get_inode(). Called by
+ * close_image().
+ */
+void free_inode_tables(ext2_fs *fs);
+
+#endif /* INODE_H_ */
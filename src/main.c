@@ -8,91 +8,519 @@
  ============================================================================
  */
 
+#include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
 #include "ext2reader.h"
+#include "cache.h"
+#include "batch.h"
+#include "walk.h"
+#include "restore.h"
+#include "stats.h"
+#include "sidecar.h"
+#include "usage.h"
+#include "scan.h"
+#include "grep.h"
+#include "checksum.h"
 
 #define DEBUG 1
 
-#define DEFAULT_SIZE 64
-#define ARG_COUNT_L 4
-#define ARG_COUNT_MIN 2
-#define ARG_COUNT_MAX 3
+#define ARG_COUNT_L 1
+#define ARG_COUNT_X_MAX 2
+#define ARG_COUNT_MIN 1
+#define ARG_COUNT_MAX 2
 
-int main(int argc, char **argv) {
-   int c, i;
-   bool list_entries_flag = true;
-   char file_dump[DEFAULT_SIZE];
-   char buffer[DEFAULT_SIZE];
-   char image[DEFAULT_SIZE];
-   char dir[DEFAULT_SIZE];
-   uint32_t *dir_blocks;
+typedef enum stats_format {
+   STATS_NONE, STATS_TEXT, STATS_JSON
+} stats_format;
+
+static const struct option long_options[] = {
+   { "stats", optional_argument, NULL, 's' },
+   { "index", optional_argument, NULL, 'i' },
+   { NULL, 0, NULL, 0 }
+};
+
+typedef enum mode {
+   MODE_LIST, MODE_DUMP, MODE_EXTRACT, MODE_BATCH, MODE_RECURSIVE,
+   MODE_RESTORE, MODE_USAGE, MODE_FIND,
+   MODE_GREP, MODE_CHECKSUM, MODE_VERIFY
+} mode;
+
+/*
+ * Returns a copy of the path argument |arg|, made absolute if it isn't,
+ * to be freed by the caller. Exits if memory ran out.
+ */
+static char *absolute_arg(const char *arg) {
+   char *path = malloc(strlen(arg) + 2);
+
+   if (!path) {
+      fprintf(stderr, "\nError: out of memory\n");
+      exit(1);
+   }
+   strcpy(path, arg[0] != '/' ? "/" : "");
+   strcat(path, arg);
+   return path;
+}
+
+/*
+ * Parses the decimal argument |arg| into |*value|, which must lie in
+ * [|min|, |max|]. Returns 0 on success, -1 if |arg| is malformed or out of
+ * range.
+ */
+static int parse_count(const char *arg, unsigned long min, unsigned long max,
+      unsigned long *value) {
+   char *end;
+
+   // strtoul() would take a sign or leading blanks
+   if (!isdigit((unsigned char) *arg))
+      return -1;
+   errno = 0;
+   *value = strtoul(arg, &end, 10);
+   return *end || errno == ERANGE || *value < min || *value > max ? -1 : 0;
+}
 
-   strcpy(dir, "/");
+/*
+ * Parses a -r range of the form offset[:length] into |*offset| and
+ * |*length|, the latter being -1 (to the end of the file) if omitted.
+ * Returns 0 on success, -1 if |arg| is malformed.
+ */
+static int parse_range(const char *arg, off_t *offset, off_t *length) {
+   char *end;
+
+   *offset = strtoll(arg, &end, 10);
+   *length = -1;
+   if (end == arg)
+      return -1;
+   if (*end == ':') {
+      arg = end + 1;
+      *length = strtoll(arg, &end, 10);
+      if (end == arg || *length < 0)
+         return -1;
+   }
+   return *end ? -1 : 0;
+}
+
+/*
+ * Prints the usage report of |fs| computed with |threads| threads. Returns
+ * the exit status.
+ */
+static int run_usage(ext2_fs *fs, int threads) {
+   usage_report report;
+
+   if (compute_usage(fs, threads, &report)) {
+      fprintf(stderr, "\nError: out of memory\n");
+      return 1;
+   }
+
+   print_usage(&report, stdout);
+   free_usage(&report);
+   return 0;
+}
+
+/*
+ * Scans the inode tables of |fs| for inodes matching |query| with
+ * |threads| threads and prints their paths. Returns the exit status: 0 if
+ * anything matched, 1 otherwise.
+ */
+static int run_find(ext2_fs *fs, const scan_query *query, int threads) {
+   uint32_t *matches;
+   size_t count;
+   int err;
 
-   if ((c = getopt(argc, argv, "l:")) != -1) {
+   if (scan_inodes(fs, query, threads, &matches, &count)) {
+      fprintf(stderr, "\nError: out of memory\n");
+      return 1;
+   }
+
+   err = print_matches(fs, matches, count, stdout);
+   free(matches);
+   if (err)
+      fprintf(stderr, "\nError: out of memory\n");
+   return err || !count ? 1 : 0;
+}
+
+/*
+ * Searches every file of |fs| for the |count| |patterns| with |threads|
+ * threads and prints where they occur. Returns the exit status: 0 if
+ * anything matched, 1 otherwise.
+ */
+static int run_grep(ext2_fs *fs, const grep_pattern *patterns, size_t count,
+      int threads) {
+   long found = grep_image(fs, patterns, count, threads, stdout);
+
+   if (found < 0)
+      fprintf(stderr, "\nError: out of memory\n");
+   return found > 0 ? 0 : 1;
+}
+
+/*
+ * Resolves the paths listed in the file |list| ("-" for stdin) in one batch.
+ * Returns the exit status: 0 if every path was found, 1 otherwise.
+ */
+static int run_batch(ext2_fs *fs, char *list) {
+   FILE *in = strcmp(list, "-") ? fopen(list, "r") : stdin;
+   long missing;
+
+   if (!in) {
+      fprintf(stderr, "\nError: Could not find file %s\n", list);
+      return 1;
+   }
+
+   missing = resolve_batch(fs, in, stdout);
+   if (missing < 0)
+      fprintf(stderr, "\nError: out of memory\n");
+
+   if (in != stdin)
+      fclose(in);
+   return missing ? 1 : 0;
+}
+
+/*
+ * Prints the CRC32C of every regular file of |fs|, or only of those listed
+ * in the file |list| ("-" for stdin) if it isn't NULL, and with |manifest|
+ * set checks them against the manifest |list| instead. Returns the exit
+ * status: 0 if every file was found (and matched), 1 otherwise.
+ */
+static int run_checksum(ext2_fs *fs, char *list, bool manifest,
+      int threads) {
+   FILE *in = NULL;
+   long failures;
+
+   if (list) {
+      in = strcmp(list, "-") ? fopen(list, "r") : stdin;
+      if (!in) {
+         fprintf(stderr, "\nError: Could not find file %s\n", list);
+         return 1;
+      }
+   }
+
+   if (manifest)
+      failures = verify_manifest(fs, in, threads, stdout);
+   else if (in)
+      failures = checksum_list(fs, in, threads, stdout);
+   else
+      failures = checksum_tree(fs, threads, stdout);
+   if (failures < 0)
+      fprintf(stderr, "\nError: out of memory\n");
+
+   if (in && in != stdin)
+      fclose(in);
+   return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+   int c, i, status = 0;
+   int out_fd = STDOUT_FILENO;
+   mode run_mode = MODE_LIST;
+   bool use_mmap = false;
+   stats_format print_stats = STATS_NONE;
+   bool ordered = false;
+   int threads = sysconf(_SC_NPROCESSORS_ONLN);
+   long failures;
+   sort_key key = SORT_NONE;
+   name_filter filter;
+   bool use_filter = false;
+   size_t cache_blocks = CACHE_DEFAULT_BLOCKS;
+   scan_query query;
+   grep_pattern *patterns = NULL;
+   size_t pattern_count = 0;
+   bool use_range = false;
+   off_t range_offset, range_length;
+   bool use_index = false;
+   char *index_path = NULL;
+   char *default_index = NULL;
+   char *file_dump = NULL;
+   char *file_path = NULL; /* copy of the file argument, split in place */
+   char *image = NULL;
+   char *dir = "/";
+   char *dir_path = NULL; /* |dir| when built from an argument */
+   char *dest = NULL, *name, *save;
+   unsigned long count;
+   uint32_t dir_ino;
+   ext2_fs *fs;
+
+   while ((c = getopt_long(argc, argv, "l:x:b:R:X:u:f:G:H:V:j:oS:g:mc:sr:i", long_options,
+         NULL)) != -1) {
       switch (c) {
       case 'l':
-         if (argc != ARG_COUNT_L)
+         image = optarg;
+         run_mode = MODE_DUMP;
+         break;
+      case 'x':
+         image = optarg;
+         run_mode = MODE_EXTRACT;
+         break;
+      case 'b':
+         image = optarg;
+         run_mode = MODE_BATCH;
+         break;
+      case 'R':
+         image = optarg;
+         run_mode = MODE_RECURSIVE;
+         break;
+      case 'X':
+         image = optarg;
+         run_mode = MODE_RESTORE;
+         break;
+      case 'u':
+         image = optarg;
+         run_mode = MODE_USAGE;
+         break;
+      case 'f':
+         image = optarg;
+         run_mode = MODE_FIND;
+         break;
+      case 'G':
+         image = optarg;
+         run_mode = MODE_GREP;
+         break;
+      case 'H':
+         image = optarg;
+         run_mode = MODE_CHECKSUM;
+         break;
+      case 'V':
+         image = optarg;
+         run_mode = MODE_VERIFY;
+         break;
+      case 'j':
+         if (parse_count(optarg, 1, INT_MAX, &count))
+            print_error_msg_and_exit(1);
+         threads = count;
+         break;
+      case 'o':
+         ordered = true;
+         break;
+      case 'S':
+         key = parse_sort_key(optarg);
+         if (key == SORT_NONE)
+            print_error_msg_and_exit(1);
+         break;
+      case 'g':
+         filter_init(&filter, optarg);
+         use_filter = true;
+         break;
+      case 'm':
+         use_mmap = true;
+         break;
+      case 'c':
+         if (parse_count(optarg, 0, ULONG_MAX, &count))
             print_error_msg_and_exit(1);
+         cache_blocks = count;
+         break;
+      case 'r':
+         if (parse_range(optarg, &range_offset, &range_length))
+            print_error_msg_and_exit(1);
+         use_range = true;
+         break;
+      case 'i':
+         use_index = true;
+         index_path = optarg;
+         break;
+      case 's':
+         if (!optarg || !strcmp(optarg, "text"))
+            print_stats = STATS_TEXT;
+         else if (!strcmp(optarg, "json"))
+            print_stats = STATS_JSON;
+         else
+            print_error_msg_and_exit(1);
+         break;
+      default:
+         print_error_msg_and_exit(1);
+      }
+   }
 
-         strcpy(image, optarg);
-         strcpy(file_dump, argv[argc - 1]);
-         strcpy(dir, file_dump);
-
-         // manipulate dir to the last directory right before the filename
-         for (i = strlen(dir) - 1; dir[i] != '/' && i > 0; i--)
-            ;
-         dir[i] = NULL;
-
-         if (!i)
-            strcpy(dir, "/");
-         else if (dir[0] != '/') {
-            strcpy(buffer, "/");
-            strcat(buffer, dir);
-            strcpy(dir, buffer);
-         }
+   // ranges only apply to reading a single file
+   if (use_range && run_mode != MODE_DUMP && run_mode != MODE_EXTRACT)
+      print_error_msg_and_exit(1);
 
-         // manipulate file_dump to just the filename
-         strcpy(buffer, file_dump);
-         char *pch = strtok(buffer, "/");
-         while (pch) {
-            strcpy(file_dump, pch);
-            pch = strtok(NULL, "/");
+   if (run_mode == MODE_BATCH) {
+      if (argc - optind != ARG_COUNT_L)
+         print_error_msg_and_exit(1);
+   }
+   else if (run_mode == MODE_USAGE) {
+      if (argc - optind)
+         print_error_msg_and_exit(1);
+   }
+   else if (run_mode == MODE_CHECKSUM || run_mode == MODE_VERIFY) {
+      if (argc - optind > ARG_COUNT_L
+            || (run_mode == MODE_VERIFY && argc - optind != ARG_COUNT_L))
+         print_error_msg_and_exit(1);
+   }
+   else if (run_mode == MODE_FIND) {
+      // every remaining argument narrows the query
+      query_init(&query);
+      for (i = optind; i < argc; i++)
+         if (parse_predicate(&query, argv[i])) {
+            fprintf(stderr, "\nError: invalid predicate %s\n", argv[i]);
+            print_error_msg_and_exit(1);
+         }
+   }
+   else if (run_mode == MODE_GREP) {
+      if (argc - optind < 1)
+         print_error_msg_and_exit(1);
+      patterns = malloc((argc - optind) * sizeof(grep_pattern));
+      if (!patterns) {
+         fprintf(stderr, "\nError: out of memory\n");
+         exit(1);
+      }
+      for (i = optind; i < argc; i++)
+         if (parse_pattern(argv[i], &patterns[pattern_count++])) {
+            fprintf(stderr, "\nError: invalid pattern %s\n", argv[i]);
+            print_error_msg_and_exit(1);
          }
+   }
+   else if (run_mode == MODE_RECURSIVE || run_mode == MODE_RESTORE) {
+      if (run_mode == MODE_RECURSIVE && argc - optind > ARG_COUNT_L)
+         print_error_msg_and_exit(1);
+      if (run_mode == MODE_RESTORE && argc - optind != ARG_COUNT_X_MAX)
+         print_error_msg_and_exit(1);
 
-         list_entries_flag = false;
-         break;
-      default:
+      // listed paths are always absolute
+      if (argc - optind >= ARG_COUNT_L)
+         dir = dir_path = absolute_arg(argv[optind]);
+   }
+   else if (run_mode != MODE_LIST) {
+      if (run_mode == MODE_DUMP && argc - optind != ARG_COUNT_L)
+         print_error_msg_and_exit(1);
+      if (run_mode == MODE_EXTRACT
+            && (argc - optind < ARG_COUNT_L || argc - optind > ARG_COUNT_X_MAX))
          print_error_msg_and_exit(1);
+
+      // the directory is everything before the last slash, made absolute
+      dir = dir_path = absolute_arg(argv[optind]);
+      name = strrchr(dir, '/');
+      name[name == dir] = '\0';
+
+      // the file is the last component
+      file_dump = argv[optind];
+      file_path = strdup(argv[optind]);
+      if (!file_path) {
+         fprintf(stderr, "\nError: out of memory\n");
+         exit(1);
       }
+      for (name = strtok_r(file_path, "/", &save); name;
+            name = strtok_r(NULL, "/", &save))
+         file_dump = name;
    }
    else {
-      if (argc < ARG_COUNT_MIN || argc > ARG_COUNT_MAX)
+      if (argc - optind < ARG_COUNT_MIN || argc - optind > ARG_COUNT_MAX)
          print_error_msg_and_exit(1);
 
-      strcpy(image, *++argv);
+      image = argv[optind];
 
-      if (*++argv)
-         strcpy(dir, *argv);
+      if (argv[optind + 1])
+         dir = argv[optind + 1];
    }
 
-   fp = fopen(image, "r");
-   if (!fp) {
+   fs = open_image(image, use_mmap, cache_blocks);
+   if (!fs && (errno == EINVAL || errno == ENOTSUP)) {
+      fprintf(stderr, "\nError: %s is not a supported ext2 image\n", image);
+      exit(1);
+   }
+   else if (!fs) {
       fprintf(stderr, "\nError: Could not find file %s\n", image);
       exit(1);
    }
 
-   dir_blocks = find_dir(fp, dir);
-   if (list_entries_flag)
-      list_entries(dir_blocks);
-   else
-      dump_file(dir_blocks, file_dump);
+   // a missing or stale index is rebuilt; without one, read the image
+   if (use_index) {
+      if (!index_path) {
+         default_index = malloc(strlen(image) + sizeof(SIDECAR_SUFFIX));
+         if (!default_index) {
+            fprintf(stderr, "\nError: out of memory\n");
+            exit(1);
+         }
+         strcpy(default_index, image);
+         strcat(default_index, SIDECAR_SUFFIX);
+         index_path = default_index;
+      }
+      if (sidecar_open(fs, index_path, 1))
+         fprintf(stderr, "\nWarning: could not use index %s: %s\n",
+               index_path, strerror(errno));
+   }
 
-   free(dir_blocks);
-   fclose(fp);
+   dir_ino = run_mode == MODE_BATCH || run_mode == MODE_USAGE
+         || run_mode == MODE_FIND || run_mode == MODE_GREP
+         || run_mode == MODE_CHECKSUM || run_mode == MODE_VERIFY ? 0
+         : find_dir(fs, dir);
+   switch (run_mode) {
+   case MODE_LIST:
+      list_entries(fs, dir_ino, key, use_filter ? &filter : NULL);
+      break;
+   case MODE_DUMP:
+      if (use_range) {
+         fflush(stdout);
+         read_range(fs, dir_ino, file_dump, range_offset, range_length,
+               STDOUT_FILENO);
+      }
+      else
+         dump_file(fs, dir_ino, file_dump);
+      break;
+   case MODE_EXTRACT:
+      dest = argv[optind + 1];
+      if (dest)
+         out_fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (out_fd < 0) {
+         fprintf(stderr, "\nError: Could not create file %s\n", dest);
+         exit(1);
+      }
+      if (use_range)
+         read_range(fs, dir_ino, file_dump, range_offset, range_length,
+               out_fd);
+      else
+         extract_file(fs, dir_ino, file_dump, out_fd);
+      if (dest)
+         close(out_fd);
+      break;
+   case MODE_BATCH:
+      status = run_batch(fs, argv[optind]);
+      break;
+   case MODE_RECURSIVE:
+      if (walk_tree(fs, dir_ino, dir, threads, ordered,
+            use_filter ? &filter : NULL, stdout)) {
+         fprintf(stderr, "\nError: out of memory\n");
+         status = 1;
+      }
+      break;
+   case MODE_RESTORE:
+      failures = restore_tree(fs, dir_ino, argv[optind + 1], threads);
+      if (failures < 0)
+         fprintf(stderr, "\nError: out of memory\n");
+      else if (failures)
+         fprintf(stderr, "\nError: %ld entries could not be restored\n",
+               failures);
+      status = failures ? 1 : 0;
+      break;
+   case MODE_USAGE:
+      status = run_usage(fs, threads);
+      break;
+   case MODE_FIND:
+      status = run_find(fs, &query, threads);
+      break;
+   case MODE_CHECKSUM:
+   case MODE_VERIFY:
+      status = run_checksum(fs, argc > optind ? argv[optind] : NULL,
+            run_mode == MODE_VERIFY, threads);
+      break;
+   case MODE_GREP:
+      status = run_grep(fs, patterns, pattern_count, threads);
+      free(patterns);
+      break;
+   }
 
-   return 0;
+   if (print_stats != STATS_NONE)
+      stats_print(fs, stderr, print_stats == STATS_JSON);
+
+   close_image(fs);
+   free(default_index);
+   free(dir_path);
+   free(file_path);
+
+   return status;
 }
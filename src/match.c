@@ -0,0 +1,138 @@
+/*
+ * match.c
+ *
+ * Vectorized name comparison and glob filters, see match.h
+ */
+
+#include <fnmatch.h>
+#include <string.h>
+#include "match.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+static int equal_scalar(const char *a, const char *b, size_t len) {
+   return !memcmp(a, b, len);
+}
+
+#ifdef HAVE_X86_KERNELS
+/*
+ * The kernels never read past |len|: the name field of the last entry in a
+ * block may end right at the end of the buffer
+ */
+__attribute__((target("sse2")))
+static int equal_sse2(const char *a, const char *b, size_t len) {
+   __m128i x, y;
+
+   for (; len >= 16; a += 16, b += 16, len -= 16) {
+      x = _mm_loadu_si128((const __m128i *) a);
+      y = _mm_loadu_si128((const __m128i *) b);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+         return 0;
+   }
+   return !memcmp(a, b, len);
+}
+
+__attribute__((target("avx2")))
+static int equal_avx2(const char *a, const char *b, size_t len) {
+   __m256i x, y;
+
+   for (; len >= 32; a += 32, b += 32, len -= 32) {
+      x = _mm256_loadu_si256((const __m256i *) a);
+      y = _mm256_loadu_si256((const __m256i *) b);
+      if ((unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y))
+            != 0xffffffffu)
+         return 0;
+   }
+   return equal_sse2(a, b, len);
+}
+#endif
+
+static int (*equal_kernel)(const char *, const char *, size_t) = equal_scalar;
+static const char *kernel_name = "scalar";
+
+/*
+ * Picks the widest kernel the CPU supports before main() runs, so the
+ * choice never races with the worker threads
+ */
+__attribute__((constructor))
+static void pick_kernel(void) {
+#ifdef HAVE_X86_KERNELS
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      equal_kernel = equal_avx2;
+      kernel_name = "avx2";
+   }
+   else if (__builtin_cpu_supports("sse2")) {
+      equal_kernel = equal_sse2;
+      kernel_name = "sse2";
+   }
+#endif
+}
+
+int names_equal(const char *a, const char *b, size_t len) {
+   return equal_kernel(a, b, len);
+}
+
+const char *match_kernel(void) {
+   return kernel_name;
+}
+
+uint32_t find_in_block(const uint8_t *block, size_t block_size,
+      const char *name, size_t len) {
+   size_t pos = 0;
+   const ext2_dir_entry *entry;
+
+   while (pos + sizeof(ext2_dir_entry) <= block_size) {
+      entry = (const ext2_dir_entry *) (block + pos);
+      if (entry->rec_len < sizeof(ext2_dir_entry)
+            || entry->rec_len > block_size - pos)
+         return 0;
+
+      // the length byte rules out almost every entry without a compare
+      if (entry->name_len == len && entry->inode
+            && sizeof(ext2_dir_entry) + len <= entry->rec_len
+            && equal_kernel(entry->name, name, len))
+         return entry->inode;
+      pos += entry->rec_len;
+   }
+   return 0;
+}
+
+void filter_init(name_filter *filter, const char *pattern) {
+   size_t len = strlen(pattern);
+
+   filter->pattern = pattern;
+   filter->prefix_len = strcspn(pattern, "*?[\\");
+   filter->literal = filter->prefix_len == len;
+   filter->prefix_only = filter->prefix_len == len - 1
+         && pattern[len - 1] == '*';
+}
+
+int filter_match(const name_filter *filter, const char *name, size_t len) {
+   char buf[EXT2_NAME_LEN + 1];
+
+   if (filter->literal)
+      return len == filter->prefix_len
+            && equal_kernel(name, filter->pattern, len);
+
+   if (len < filter->prefix_len
+         || !equal_kernel(name, filter->pattern, filter->prefix_len))
+      return 0;
+
+   // like the shell, a leading wildcard doesn't match hidden names
+   if (!filter->prefix_len && len && name[0] == '.')
+      return 0;
+   if (filter->prefix_only)
+      return 1;
+
+   // the rest of the pattern needs a terminated copy of the name
+   if (len > EXT2_NAME_LEN)
+      return 0;
+   memcpy(buf, name, len);
+   buf[len] = '\0';
+   return !fnmatch(filter->pattern + filter->prefix_len,
+         buf + filter->prefix_len, 0);
+}
@@ -0,0 +1,57 @@
+/*
+ * match.h
+ *
+ * Name comparison kernels for directory scans. Names are compared in place
+ * against the name field of the directory entry, without copying them out
+ * or terminating them, 32 bytes at a time with AVX2 or 16 with SSE2 when
+ * the CPU has them (picked once at startup) and with memcmp() otherwise.
+ * Entries are always filtered on name_len before any byte is compared.
+ */
+
+#ifndef MATCH_H_
+#define MATCH_H_
+
+#include "ext2.h"
+
+/*
+ * A compiled glob pattern. The literal part before the first wildcard is
+ * checked with the vector kernels; "prefix*" and wildcard-free patterns
+ * never need anything else.
+ */
+typedef struct name_filter {
+   const char *pattern;
+   size_t prefix_len; /* bytes before the first wildcard */
+   int literal; /* no wildcards at all */
+   int prefix_only; /* literal prefix followed by a single trailing '*' */
+} name_filter;
+
+/*
+ * Returns nonzero if the |len| bytes at |a| and |b| are equal
+ */
+int names_equal(const char *a, const char *b, size_t len);
+
+/*
+ * Returns the name of the kernel picked for this CPU: "avx2", "sse2" or
+ * "scalar"
+ */
+const char *match_kernel(void);
+
+/*
+ * Searches the directory block |block| of |block_size| bytes for the entry
+ * named by the |len| bytes at |name|. Returns its inode or 0.
+ */
+uint32_t find_in_block(const uint8_t *block, size_t block_size,
+      const char *name, size_t len);
+
+/*
+ * Compiles the glob |pattern| (fnmatch() syntax) into |filter|. |pattern|
+ * must outlive the filter.
+ */
+void filter_init(name_filter *filter, const char *pattern);
+
+/*
+ * Returns nonzero if the |len| byte |name| matches |filter|
+ */
+int filter_match(const name_filter *filter, const char *name, size_t len);
+
+#endif /* MATCH_H_ */
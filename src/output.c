@@ -0,0 +1,280 @@
+/*
+ * output.c
+ *
+ * Zero-copy data movement out of the image, see output.h
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "output.h"
+
+/*
+ * Cleared the first time the kernel refuses a primitive. Restore threads
+ * share them, so they are only accessed atomically.
+ */
+static int try_copy_file_range = 1;
+static int try_splice = 1;
+static int try_sendfile = 1;
+
+static int enabled(int *flag) {
+   return __atomic_load_n(flag, __ATOMIC_RELAXED);
+}
+
+static void disable(int *flag) {
+   __atomic_store_n(flag, 0, __ATOMIC_RELAXED);
+}
+
+static int unsupported(int err) {
+   return err == EINVAL || err == ENOSYS || err == EXDEV || err == EBADF
+         || err == EOPNOTSUPP || err == ESPIPE;
+}
+
+static int write_all(int out_fd, const uint8_t *data, size_t len) {
+   ssize_t n;
+
+   while (len) {
+      n = write(out_fd, data, len);
+      if (n < 0) {
+         if (errno == EINTR)
+            continue;
+         return -1;
+      }
+      data += n;
+      len -= n;
+   }
+   return 0;
+}
+
+/*
+ * Fallback copy through user space. Mapped images are written straight out
+ * of the mapping, everything else goes through a bounce buffer.
+ */
+static int copy_buffered(ext2_fs *fs, off_t pos, int out_fd, size_t len) {
+   uint8_t *buffer;
+   ssize_t n;
+   int err = 0;
+
+   if (fs->map && (size_t) pos <= fs->map_size && len <= fs->map_size - pos)
+      return write_all(out_fd, fs->map + pos, len);
+
+   buffer = malloc(COPY_BUFFER_SIZE);
+   if (!buffer)
+      return -1;
+
+   while (len && !err) {
+      n = pread(fs->fd, buffer, len < COPY_BUFFER_SIZE ? len : COPY_BUFFER_SIZE,
+            pos);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n <= 0) {
+         // past the end of the image, pad with zeroes
+         memset(buffer, 0, COPY_BUFFER_SIZE);
+         n = len < COPY_BUFFER_SIZE ? len : COPY_BUFFER_SIZE;
+      }
+      err = write_all(out_fd, buffer, n);
+      pos += n;
+      len -= n;
+   }
+
+   free(buffer);
+   return err;
+}
+
+int copy_range(ext2_fs *fs, off_t pos, int out_fd, size_t len) {
+   struct stat st;
+   ssize_t n;
+   int out_is_pipe = !fstat(out_fd, &st) && S_ISFIFO(st.st_mode);
+
+   // copies go through the image file descriptor even when it is mapped
+   stats_read(&fs->stats, len);
+   stats_device_read(&fs->stats, pos, len);
+
+   while (len && enabled(&try_copy_file_range) && !out_is_pipe) {
+      n = copy_file_range(fs->fd, &pos, out_fd, NULL, len, 0);
+      if (n > 0)
+         len -= n;
+      else if (n < 0 && errno == EINTR)
+         continue;
+      else if (n < 0 && unsupported(errno))
+         disable(&try_copy_file_range);
+      else if (n < 0)
+         return -1;
+      else
+         break;
+   }
+
+   while (len && enabled(&try_splice) && out_is_pipe) {
+      n = splice(fs->fd, &pos, out_fd, NULL, len, SPLICE_F_MORE);
+      if (n > 0)
+         len -= n;
+      else if (n < 0 && errno == EINTR)
+         continue;
+      else if (n < 0 && unsupported(errno))
+         disable(&try_splice);
+      else if (n < 0)
+         return -1;
+      else
+         break;
+   }
+
+   while (len && enabled(&try_sendfile)) {
+      n = sendfile(out_fd, fs->fd, &pos, len);
+      if (n > 0)
+         len -= n;
+      else if (n < 0 && errno == EINTR)
+         continue;
+      else if (n < 0 && unsupported(errno))
+         disable(&try_sendfile);
+      else if (n < 0)
+         return -1;
+      else
+         break;
+   }
+
+   return len ? copy_buffered(fs, pos, out_fd, len) : 0;
+}
+
+static int pwrite_all(int out_fd, const uint8_t *data, size_t len,
+      off_t out_pos) {
+   ssize_t n;
+
+   while (len) {
+      n = pwrite(out_fd, data, len, out_pos);
+      if (n < 0) {
+         if (errno == EINTR)
+            continue;
+         return -1;
+      }
+      data += n;
+      len -= n;
+      out_pos += n;
+   }
+   return 0;
+}
+
+int copy_range_at(ext2_fs *fs, off_t pos, int out_fd, off_t out_pos,
+      size_t len, uint8_t *buf) {
+   ssize_t n;
+   int err = 0;
+
+   // copies go through the image file descriptor even when it is mapped
+   stats_read(&fs->stats, len);
+   stats_device_read(&fs->stats, pos, len);
+
+   while (len && enabled(&try_copy_file_range)) {
+      n = copy_file_range(fs->fd, &pos, out_fd, &out_pos, len, 0);
+      if (n > 0)
+         len -= n;
+      else if (n < 0 && errno == EINTR)
+         continue;
+      else if (n < 0 && unsupported(errno))
+         disable(&try_copy_file_range);
+      else if (n < 0)
+         return -1;
+      else
+         break;
+   }
+
+   if (len && fs->map && (size_t) pos <= fs->map_size
+         && len <= fs->map_size - pos)
+      return pwrite_all(out_fd, fs->map + pos, len, out_pos);
+
+   while (len && !err) {
+      n = pread(fs->fd, buf, len < COPY_BUFFER_SIZE ? len : COPY_BUFFER_SIZE,
+            pos);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n <= 0) {
+         // past the end of the image, pad with zeroes
+         memset(buf, 0, COPY_BUFFER_SIZE);
+         n = len < COPY_BUFFER_SIZE ? len : COPY_BUFFER_SIZE;
+      }
+      err = pwrite_all(out_fd, buf, n, out_pos);
+      pos += n;
+      out_pos += n;
+      len -= n;
+   }
+   return err;
+}
+
+int write_hole(int out_fd, size_t len) {
+   static const uint8_t zeroes[4096];
+   struct stat st;
+   size_t n;
+
+   if (!fstat(out_fd, &st) && S_ISREG(st.st_mode)
+         && lseek(out_fd, len, SEEK_CUR) != (off_t) -1)
+      return 0;
+
+   for (; len; len -= n) {
+      n = len < sizeof(zeroes) ? len : sizeof(zeroes);
+      if (write_all(out_fd, zeroes, n))
+         return -1;
+   }
+   return 0;
+}
+
+int finish_output(int out_fd) {
+   struct stat st;
+   off_t end;
+
+   if (fstat(out_fd, &st) || !S_ISREG(st.st_mode))
+      return 0;
+
+   end = lseek(out_fd, 0, SEEK_CUR);
+   return end == (off_t) -1 ? -1 : ftruncate(out_fd, end);
+}
+
+int out_open(out_buffer *ob, int out_fd, size_t capacity) {
+   ob->fd = out_fd;
+   ob->len = 0;
+   ob->capacity = capacity;
+   ob->data = malloc(capacity);
+   return ob->data ? 0 : -1;
+}
+
+int out_flush(out_buffer *ob) {
+   size_t len = ob->len;
+
+   ob->len = 0;
+   return len ? write_all(ob->fd, ob->data, len) : 0;
+}
+
+int out_write(out_buffer *ob, const void *data, size_t len) {
+   // large writes skip the copy into the buffer
+   if (len >= ob->capacity)
+      return out_flush(ob) || write_all(ob->fd, data, len) ? -1 : 0;
+
+   if (len > ob->capacity - ob->len && out_flush(ob))
+      return -1;
+
+   memcpy(ob->data + ob->len, data, len);
+   ob->len += len;
+   return 0;
+}
+
+int out_zeroes(out_buffer *ob, size_t len) {
+   size_t n;
+
+   for (; len; len -= n) {
+      if (ob->len == ob->capacity && out_flush(ob))
+         return -1;
+      n = ob->capacity - ob->len < len ? ob->capacity - ob->len : len;
+      memset(ob->data + ob->len, 0, n);
+      ob->len += n;
+   }
+   return 0;
+}
+
+int out_close(out_buffer *ob) {
+   int err = out_flush(ob);
+
+   free(ob->data);
+   ob->data = NULL;
+   return err;
+}
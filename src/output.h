@@ -0,0 +1,95 @@
+/*
+ * output.h
+ *
+ * Moves file data out of the image. Ranges of the image are handed to the
+ * kernel with copy_file_range(), splice() or sendfile() so the bytes never
+ * pass through user space; when none of them apply to the descriptors in
+ * use, the data is copied through a buffer (or straight out of the mapping
+ * for memory-mapped images). Output that has to be produced in user space
+ * goes through a buffered stage that flushes with large write() calls.
+ */
+
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <sys/types.h>
+#include "ext2.h"
+
+#define COPY_BUFFER_SIZE (1024 * 1024)
+#define OUT_BUFFER_SIZE (256 * 1024)
+
+/*
+ * Buffered output stage over a file descriptor. Small writes are gathered
+ * into |data| and flushed with one large write(); writes at least as large
+ * as the buffer go straight to the descriptor.
+ */
+typedef struct out_buffer {
+   int fd;
+   uint8_t *data;
+   size_t len;
+   size_t capacity;
+} out_buffer;
+
+/*
+ * Copies |len| bytes starting at byte |pos| of the image behind |fs| to the
+ * current position of |out_fd|. Returns 0 on success, -1 on a write
+ * error.
+ */
+int copy_range(ext2_fs *fs, off_t pos, int out_fd, size_t len);
+
+/*
+ * Copies |len| bytes starting at byte |pos| of the image behind |fs| to
+ * offset |out_pos| of |out_fd| without touching either file position, so
+ * several threads can copy into the same or different files at once.
+ * copy_file_range() is used where possible, otherwise the data is written
+ * with pwrite() straight out of the mapping or through |buf|, a caller
+ * owned buffer of COPY_BUFFER_SIZE bytes filled with pread(). Returns 0 on
+ * success, -1 on a write error.
+ */
+int copy_range_at(ext2_fs *fs, off_t pos, int out_fd, off_t out_pos,
+      size_t len, uint8_t *buf);
+
+/*
+ * Emits |len| zero bytes to |out_fd| for a hole in a file. Regular files
+ * get a seek instead so the hole stays sparse; finish_output() fixes up the
+ * final length. Returns 0 on success, -1 on a write error.
+ */
+int write_hole(int out_fd, size_t len);
+
+/*
+ * Truncates a regular |out_fd| to its current position so a trailing hole
+ * is materialized. Returns 0 on success, -1 on error.
+ */
+int finish_output(int out_fd);
+
+/*
+ * Sets up |ob| to write to |out_fd| through a buffer of |capacity| bytes.
+ * Returns 0 on success, -1 if the buffer could not be allocated.
+ */
+int out_open(out_buffer *ob, int out_fd, size_t capacity);
+
+/*
+ * Appends |len| bytes of |data| to |ob|. Returns 0 on success, -1 on a write
+ * error.
+ */
+int out_write(out_buffer *ob, const void *data, size_t len);
+
+/*
+ * Appends |len| zero bytes to |ob|. Returns 0 on success, -1 on a write
+ * error.
+ */
+int out_zeroes(out_buffer *ob, size_t len);
+
+/*
+ * Writes out whatever is buffered in |ob|. Returns 0 on success, -1 on a
+ * write error.
+ */
+int out_flush(out_buffer *ob);
+
+/*
+ * Flushes |ob| and frees its buffer; the descriptor is left open. Returns 0
+ * on success, -1 on a write error.
+ */
+int out_close(out_buffer *ob);
+
+#endif /* OUTPUT_H_ */
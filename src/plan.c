@@ -0,0 +1,206 @@
+/*
+ * plan.c
+ *
+ * Subtree walks and physical order read jobs, see plan.h
+ */
+
+#include <string.h>
+#include "plan.h"
+#include "blockmap.h"
+#include "dir.h"
+#include "inode.h"
+
+static int visit_entry(ext2_dir_entry *entry, void *arg) {
+   dir_walk *walk = arg;
+
+   if (entry->name[0] == '.' && (entry->name_len == 1
+         || (entry->name_len == 2 && entry->name[1] == '.')))
+      return 0;
+   return walk->visit(walk, entry) ? -1 : 0;
+}
+
+int walk_dirs(dir_walk *walk, uint32_t dir_ino, const char *root) {
+   pending_dir dir;
+   ext2_inode *ino;
+   char *path = strdup(root);
+   int status = 0;
+
+   if (!path || walk_push(walk, dir_ino, path)) {
+      free(path);
+      return -1;
+   }
+
+   while (walk->dir_count && !status) {
+      dir = walk->dirs[--walk->dir_count];
+      ino = get_inode(walk->fs, dir.inode);
+      status = walk->enter ? walk->enter(walk, dir.inode, ino, dir.path)
+            : !ino;
+      if (!status) {
+         walk->parent = dir.path;
+         walk->parent_len = strlen(dir.path);
+         status = iterate_dir(walk->fs, ino, visit_entry, walk);
+      }
+      free(dir.path);
+      if (status > 0)
+         status = 0;
+   }
+
+   return status ? -1 : 0;
+}
+
+char *entry_path(const dir_walk *walk, const ext2_dir_entry *entry) {
+   char *path = malloc(walk->parent_len + entry->name_len + 2);
+
+   if (!path)
+      return NULL;
+   memcpy(path, walk->parent, walk->parent_len);
+   path[walk->parent_len] = '/';
+   memcpy(path + walk->parent_len + 1, entry->name, entry->name_len);
+   path[walk->parent_len + 1 + entry->name_len] = '\0';
+   return path;
+}
+
+int walk_push(dir_walk *walk, uint32_t inode, char *path) {
+   if (walk->dir_count == walk->dir_cap) {
+      size_t dir_cap = walk->dir_cap ? walk->dir_cap * 2 : 64;
+      pending_dir *dirs = realloc(walk->dirs, dir_cap * sizeof(pending_dir));
+      if (!dirs)
+         return -1;
+      walk->dirs = dirs;
+      walk->dir_cap = dir_cap;
+   }
+
+   walk->dirs[walk->dir_count].inode = inode;
+   walk->dirs[walk->dir_count].path = path;
+   walk->dir_count++;
+   return 0;
+}
+
+void walk_free(dir_walk *walk) {
+   while (walk->dir_count)
+      free(walk->dirs[--walk->dir_count].path);
+   free(walk->dirs);
+   walk->dirs = NULL;
+   walk->dir_cap = 0;
+}
+
+static int add_job(job_plan *plan, off_t pos, off_t offset, size_t len,
+      uint32_t file) {
+   if (plan->job_count == plan->job_cap) {
+      size_t job_cap = plan->job_cap ? plan->job_cap * 2 : 1024;
+      read_job *jobs = realloc(plan->jobs, job_cap * sizeof(read_job));
+      if (!jobs)
+         return -1;
+      plan->jobs = jobs;
+      plan->job_cap = job_cap;
+   }
+
+   plan->jobs[plan->job_count].pos = pos;
+   plan->jobs[plan->job_count].offset = offset;
+   plan->jobs[plan->job_count].len = len;
+   plan->jobs[plan->job_count].file = file;
+   plan->job_count++;
+   return 0;
+}
+
+int plan_runs(job_plan *plan, ext2_inode *ino, uint32_t file) {
+   off_t size = inode_size(ino), pos, len, chunk;
+   off_t max = BLOCK_POS(plan->fs, plan->chunk_blocks);
+   block_iter it;
+   extent run;
+
+   iter_init(&it, plan->fs, ino);
+   while (iter_next(&it, &run)) {
+      // the last run only covers up to i_size
+      pos = BLOCK_POS(plan->fs, run.logical);
+      len = BLOCK_POS(plan->fs, run.length);
+      if (len > size - pos)
+         len = size - pos;
+      if (!run.physical && !plan->holes)
+         continue;
+
+      // long runs are split so several threads can share one big file
+      for (chunk = 0; chunk < len; chunk += max)
+         if (add_job(plan, run.physical
+               ? BLOCK_POS(plan->fs, run.physical) + chunk : 0, pos + chunk,
+               len - chunk < max ? len - chunk : max, file))
+            return -1;
+   }
+
+   return 0;
+}
+
+static int by_position(const void *a, const void *b) {
+   off_t x = (*(read_job * const *) a)->pos;
+   off_t y = (*(read_job * const *) b)->pos;
+   return (x > y) - (x < y);
+}
+
+/*
+ * Thread started by run_jobs()
+ */
+typedef struct job_runner {
+   job_plan *plan;
+   job_thread work;
+   void *arg;
+} job_runner;
+
+static void *run_thread(void *arg) {
+   job_runner *runner = arg;
+
+   runner->work(runner->plan, runner->arg);
+   return NULL;
+}
+
+int run_jobs(job_plan *plan, int threads, job_thread work, void *arg,
+      size_t stride) {
+   job_runner runners[PLAN_MAX_THREADS];
+   pthread_t ids[PLAN_MAX_THREADS];
+   int i, started;
+   size_t j;
+
+   if (threads < 1)
+      threads = 1;
+   if (threads > PLAN_MAX_THREADS)
+      threads = PLAN_MAX_THREADS;
+
+   plan->order = malloc(plan->job_count * sizeof(read_job *) + 1);
+   if (!plan->order)
+      return -1;
+   for (j = 0; j < plan->job_count; j++)
+      plan->order[j] = &plan->jobs[j];
+
+   // reading in physical order keeps the image streaming sequentially
+   qsort(plan->order, plan->job_count, sizeof(read_job *), by_position);
+
+   // the calling thread works too
+   for (started = 1; started < threads; started++) {
+      runners[started].plan = plan;
+      runners[started].work = work;
+      runners[started].arg = (uint8_t *) arg + started * stride;
+      if (pthread_create(&ids[started], NULL, run_thread, &runners[started]))
+         break;
+   }
+   work(plan, arg);
+   for (i = 1; i < started; i++)
+      pthread_join(ids[i], NULL);
+
+   return plan->out_of_memory ? -1 : started;
+}
+
+read_job *claim_job(job_plan *plan) {
+   size_t i;
+
+   if (plan->out_of_memory)
+      return NULL;
+   i = __atomic_fetch_add(&plan->next_job, 1, __ATOMIC_RELAXED);
+   return i < plan->job_count ? plan->order[i] : NULL;
+}
+
+void free_jobs(job_plan *plan) {
+   free(plan->jobs);
+   free(plan->order);
+   plan->jobs = NULL;
+   plan->order = NULL;
+   plan->job_count = plan->job_cap = 0;
+}
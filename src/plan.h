@@ -0,0 +1,133 @@
+/*
+ * plan.h
+ *
+ * Shared planning for the bulk readers (restore, grep and checksums). A
+ * metadata pass walks a subtree depth first, building the path of every
+ * entry, and turns each file's block map into read jobs; a pool of threads
+ * then takes the jobs in physical block order, one large read apiece, so
+ * the image streams sequentially and a single big file is spread over
+ * every thread like a tree of small ones.
+ */
+
+#ifndef PLAN_H_
+#define PLAN_H_
+
+#include "ext2.h"
+
+#define PLAN_MAX_THREADS 64
+
+typedef struct dir_walk dir_walk;
+
+/*
+ * A directory still to be walked
+ */
+typedef struct pending_dir {
+   uint32_t inode;
+   char *path;
+} pending_dir;
+
+struct dir_walk {
+   ext2_fs *fs;
+   void *arg; /* handed to the callbacks through the walk */
+   /*
+    * Called with each directory as it is taken off the stack, before its
+    * entries, with its inode (NULL if unreadable). Returns 0 to walk it, 1
+    * to skip it, -1 to stop the walk. Optional: by default unreadable
+    * directories are skipped.
+    */
+   int (*enter)(dir_walk *walk, uint32_t dir_ino, ext2_inode *dir,
+         const char *path);
+   /*
+    * Called for every entry of the directory being walked, "." and ".."
+    * excepted. Returns 0 to go on, -1 to stop the walk.
+    */
+   int (*visit)(dir_walk *walk, ext2_dir_entry *entry);
+   const char *parent; /* path of the directory being walked */
+   size_t parent_len;
+   pending_dir *dirs; /* stack of directories to walk */
+   size_t dir_count;
+   size_t dir_cap;
+};
+
+/*
+ * Walks the subtree of directory |dir_ino| depth first, |root| being its
+ * path, calling the callbacks of |walk| for it and for every directory
+ * queued with walk_push(). Returns 0 once the stack is empty, -1 if a
+ * callback stopped the walk or memory ran out.
+ */
+int walk_dirs(dir_walk *walk, uint32_t dir_ino, const char *root);
+
+/*
+ * Returns the path of |entry| in the directory being walked, to be freed
+ * by the caller, or NULL if memory ran out
+ */
+char *entry_path(const dir_walk *walk, const ext2_dir_entry *entry);
+
+/*
+ * Queues directory |inode|, known as |path|, which the walk takes over.
+ * Returns -1 if memory ran out, in which case |path| is left to the caller.
+ */
+int walk_push(dir_walk *walk, uint32_t inode, char *path);
+
+/*
+ * Frees whatever a stopped walk left on its stack
+ */
+void walk_free(dir_walk *walk);
+
+/*
+ * |len| bytes at byte |pos| of the image (a hole if |pos| is 0) hold the
+ * bytes at |offset| of file |file| of the caller's plan
+ */
+typedef struct read_job {
+   off_t pos;
+   off_t offset;
+   size_t len;
+   uint32_t file;
+} read_job;
+
+typedef struct job_plan {
+   ext2_fs *fs;
+   uint32_t chunk_blocks; /* largest single job */
+   int holes; /* plan jobs for holes too */
+   read_job *jobs; /* in planning order, so each file's in logical order */
+   size_t job_count;
+   size_t job_cap;
+   read_job **order; /* the jobs in physical order */
+   size_t next_job; /* claimed by the threads */
+   int out_of_memory;
+} job_plan;
+
+/*
+ * Thread body for run_jobs(), called with the thread's argument
+ */
+typedef void (*job_thread)(job_plan *plan, void *arg);
+
+/*
+ * Queues jobs of at most |chunk_blocks| blocks for the data runs of |ino|
+ * up to its i_size, as file |file|. Holes get jobs only if |holes| is set.
+ * Returns -1 if memory ran out.
+ */
+int plan_runs(job_plan *plan, ext2_inode *ino, uint32_t file);
+
+/*
+ * Sorts the jobs of |plan| in physical order and runs |work| on |threads|
+ * threads (at most PLAN_MAX_THREADS), the calling thread being thread 0.
+ * Thread i is handed |arg| + i * |stride| bytes, so a |stride| of 0 shares
+ * one argument and sizeof(state) gives each thread its own element of an
+ * array. Returns the number of threads that ran, or -1 if memory ran out.
+ */
+int run_jobs(job_plan *plan, int threads, job_thread work, void *arg,
+      size_t stride);
+
+/*
+ * Returns the next job in physical order for a thread of run_jobs(), or
+ * NULL once there are none left or memory ran out
+ */
+read_job *claim_job(job_plan *plan);
+
+/*
+ * Frees the jobs of |plan|
+ */
+void free_jobs(job_plan *plan);
+
+#endif /* PLAN_H_ */
@@ -0,0 +1,222 @@
+/*
+ * readahead.c
+ *
+ * Ring buffered readahead thread, see readahead.h
+ */
+
+#include <string.h>
+#include "readahead.h"
+#include "blockmap.h"
+
+/*
+ * One piece of the file: |len| bytes read into |data|, or a hole
+ */
+typedef struct ra_slot {
+   uint8_t *data;
+   off_t len;
+   int hole;
+} ra_slot;
+
+struct readahead {
+   ext2_fs *fs;
+   ext2_inode *ino;
+   pthread_t thread;
+   pthread_mutex_t lock;
+   pthread_cond_t filled_cond; /* signalled when a slot is filled */
+   pthread_cond_t free_cond; /* signalled when a slot or the window frees */
+   ra_slot slots[RA_SLOTS];
+   int slot_count; /* slots in the ring */
+   off_t slot_size;
+   int head; /* next slot for the caller */
+   int filled; /* slots read and not yet handed out or released */
+   int window; /* slots the thread may fill ahead of the caller */
+   int handed_out; /* the caller still holds slots[head] */
+   int eof;
+   int stop;
+};
+
+/*
+ * Waits for a slot the thread may fill and returns it, or NULL if the
+ * caller has stopped the readahead
+ */
+static ra_slot *claim_slot(readahead *ra) {
+   ra_slot *slot = NULL;
+
+   pthread_mutex_lock(&ra->lock);
+   while (!ra->stop && ra->filled >= ra->window)
+      pthread_cond_wait(&ra->free_cond, &ra->lock);
+   if (!ra->stop)
+      slot = &ra->slots[(ra->head + ra->filled) % ra->slot_count];
+   pthread_mutex_unlock(&ra->lock);
+   return slot;
+}
+
+static void publish_slot(readahead *ra) {
+   pthread_mutex_lock(&ra->lock);
+   ra->filled++;
+   pthread_cond_signal(&ra->filled_cond);
+   pthread_mutex_unlock(&ra->lock);
+}
+
+/*
+ * Readahead thread: reads the runs of the file up to i_size in order,
+ * one slot at a time
+ */
+static void *read_ahead(void *arg) {
+   readahead *ra = arg;
+   ext2_fs *fs = ra->fs;
+   off_t size = inode_size(ra->ino), pos, len, done, chunk;
+   off_t read_size = RA_MIN_READ;
+   block_iter it;
+   extent run;
+   ra_slot *slot;
+   uint8_t *data;
+
+   iter_init(&it, fs, ra->ino);
+   while (iter_next(&it, &run)) {
+      pos = BLOCK_POS(fs, run.logical);
+      len = BLOCK_POS(fs, run.length);
+      if (len > size - pos)
+         len = size - pos;
+
+      for (done = 0; done < len; done += chunk) {
+         if (!(slot = claim_slot(ra)))
+            return NULL;
+
+         // a hole costs no I/O, so it is handed out in one piece
+         slot->hole = !run.physical;
+         chunk = slot->hole ? len : len - done < read_size ? len - done
+               : read_size;
+         slot->len = chunk;
+         if (!slot->hole) {
+            data = fetch_range(fs, BLOCK_POS(fs, run.physical) + done,
+                  slot->data, chunk);
+            if (data != slot->data)
+               memcpy(slot->data, data, chunk);
+
+            // sequential so far: ramp up to full slots
+            if (read_size < ra->slot_size)
+               read_size *= 2;
+         }
+         publish_slot(ra);
+      }
+   }
+
+   pthread_mutex_lock(&ra->lock);
+   ra->eof = 1;
+   pthread_cond_signal(&ra->filled_cond);
+   pthread_mutex_unlock(&ra->lock);
+   return NULL;
+}
+
+/*
+ * Sizes the ring of |ra| for a file of |size| bytes: no slot larger than
+ * the file, and no more slots than the reads needed to cover it
+ */
+static void size_ring(readahead *ra, off_t size) {
+   off_t read_size = RA_MIN_READ, left = size;
+
+   ra->slot_size = RA_SLOT_SIZE;
+   while (ra->slot_size / 2 >= size && ra->slot_size > RA_MIN_READ)
+      ra->slot_size /= 2;
+
+   // the reads double from RA_MIN_READ up to the slot size
+   for (ra->slot_count = 0; left > 0 && ra->slot_count < RA_SLOTS;
+         ra->slot_count++) {
+      left -= read_size;
+      if (read_size < ra->slot_size)
+         read_size *= 2;
+   }
+   if (ra->slot_count < RA_MIN_WINDOW)
+      ra->slot_count = RA_MIN_WINDOW;
+}
+
+readahead *ra_start(ext2_fs *fs, ext2_inode *ino) {
+   readahead *ra;
+   off_t size = inode_size(ino);
+   int i;
+
+   if (size < RA_MIN_FILE || !(ra = calloc(1, sizeof(readahead))))
+      return NULL;
+
+   size_ring(ra, size);
+   for (i = 0; i < ra->slot_count; i++) {
+      ra->slots[i].data = malloc(ra->slot_size);
+      if (!ra->slots[i].data)
+         goto fail;
+   }
+
+   ra->fs = fs;
+   ra->ino = ino;
+   ra->window = RA_MIN_WINDOW;
+   pthread_mutex_init(&ra->lock, NULL);
+   pthread_cond_init(&ra->filled_cond, NULL);
+   pthread_cond_init(&ra->free_cond, NULL);
+   if (!pthread_create(&ra->thread, NULL, read_ahead, ra))
+      return ra;
+
+   pthread_cond_destroy(&ra->free_cond);
+   pthread_cond_destroy(&ra->filled_cond);
+   pthread_mutex_destroy(&ra->lock);
+
+fail:
+   for (i = 0; i < ra->slot_count; i++)
+      free(ra->slots[i].data);
+   free(ra);
+   return NULL;
+}
+
+int ra_next(readahead *ra, const uint8_t **data, off_t *len) {
+   ra_slot *slot;
+   int released;
+
+   pthread_mutex_lock(&ra->lock);
+
+   // the slot handed out last time can be refilled now
+   released = ra->handed_out;
+   if (released) {
+      ra->head = (ra->head + 1) % ra->slot_count;
+      ra->filled--;
+      ra->handed_out = 0;
+      pthread_cond_signal(&ra->free_cond);
+   }
+
+   // caught up with the thread: let it read further ahead from now on
+   if (released && !ra->filled && !ra->eof && ra->window < ra->slot_count) {
+      ra->window = ra->window * 2 < ra->slot_count ? ra->window * 2
+            : ra->slot_count;
+      pthread_cond_signal(&ra->free_cond);
+   }
+   while (!ra->filled && !ra->eof)
+      pthread_cond_wait(&ra->filled_cond, &ra->lock);
+
+   if (!ra->filled) {
+      pthread_mutex_unlock(&ra->lock);
+      return 0;
+   }
+
+   slot = &ra->slots[ra->head];
+   ra->handed_out = 1;
+   pthread_mutex_unlock(&ra->lock);
+
+   *data = slot->hole ? NULL : slot->data;
+   *len = slot->len;
+   return 1;
+}
+
+void ra_stop(readahead *ra) {
+   int i;
+
+   pthread_mutex_lock(&ra->lock);
+   ra->stop = 1;
+   pthread_cond_signal(&ra->free_cond);
+   pthread_mutex_unlock(&ra->lock);
+   pthread_join(ra->thread, NULL);
+
+   pthread_cond_destroy(&ra->free_cond);
+   pthread_cond_destroy(&ra->filled_cond);
+   pthread_mutex_destroy(&ra->lock);
+   for (i = 0; i < ra->slot_count; i++)
+      free(ra->slots[i].data);
+   free(ra);
+}
@@ -0,0 +1,49 @@
+/*
+ * readahead.h
+ *
+ * Asynchronous readahead for sequential file dumps. A background thread
+ * walks the file's block runs and reads them into a ring of buffers while
+ * the caller writes out the previous ones, so output and image I/O
+ * overlap. Reads start small and double up to the slot size, and the
+ * number of slots the thread may fill ahead of the caller (the window)
+ * doubles every time the caller finds the ring empty. The ring is sized to
+ * the file, and files of a few reads or less aren't worth a thread.
+ */
+
+#ifndef READAHEAD_H_
+#define READAHEAD_H_
+
+#include <sys/types.h>
+#include "ext2.h"
+
+#define RA_SLOTS 8 /* most slots in the ring */
+#define RA_SLOT_SIZE (2 * 1024 * 1024) /* largest slot */
+#define RA_MIN_READ (128 * 1024) /* size of the first read */
+#define RA_MIN_WINDOW 2
+#define RA_MIN_FILE (4 * RA_MIN_READ) /* smallest file read ahead */
+
+typedef struct readahead readahead;
+
+/*
+ * Starts reading the data of |ino| of |fs| ahead on a background thread.
+ * Returns NULL if the file is smaller than RA_MIN_FILE or the buffers or
+ * the thread could not be set up, in which case the caller should read
+ * synchronously.
+ */
+readahead *ra_start(ext2_fs *fs, ext2_inode *ino);
+
+/*
+ * Hands out the next piece of the file in order, waiting for it if it
+ * hasn't been read yet: |*len| bytes at |*data|, or a hole of |*len| zero
+ * bytes if |*data| is NULL. The piece stays valid until the next call.
+ * Returns 1 if a piece was handed out, 0 at the end of the file.
+ */
+int ra_next(readahead *ra, const uint8_t **data, off_t *len);
+
+/*
+ * Stops the background thread, even halfway through the file, and frees
+ * |ra|
+ */
+void ra_stop(readahead *ra);
+
+#endif /* READAHEAD_H_ */
@@ -0,0 +1,288 @@
+/*
+ * restore.c
+ *
+ * Parallel subtree extraction, see restore.h
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "restore.h"
+#include "blockmap.h"
+#include "inode.h"
+#include "output.h"
+#include "plan.h"
+
+/*
+ * A directory created by the metadata pass, whose mode is set once its
+ * entries are in place
+ */
+typedef struct made_dir {
+   char *path;
+   uint16_t mode;
+} made_dir;
+
+typedef struct restore_plan {
+   ext2_fs *fs;
+   dir_walk walk;
+   job_plan jobs; /* copy jobs, |file| indexing |files| */
+   char **files; /* host path of each created file */
+   size_t file_count;
+   size_t file_cap;
+   made_dir *made; /* in creation order, so parents before children */
+   size_t made_count;
+   size_t made_cap;
+   long failures;
+} restore_plan;
+
+static void report(const char *path) {
+   fprintf(stderr, "\nError: %s: %s\n", path, strerror(errno));
+}
+
+static int add_made_dir(restore_plan *plan, char *path, uint16_t mode) {
+   if (plan->made_count == plan->made_cap) {
+      size_t made_cap = plan->made_cap ? plan->made_cap * 2 : 64;
+      made_dir *made = realloc(plan->made, made_cap * sizeof(made_dir));
+      if (!made)
+         return -1;
+      plan->made = made;
+      plan->made_cap = made_cap;
+   }
+
+   plan->made[plan->made_count].path = path;
+   plan->made[plan->made_count].mode = mode;
+   plan->made_count++;
+   return 0;
+}
+
+/*
+ * Recreates the symbolic link |path| for |ino|. Failures are reported and
+ * counted.
+ */
+static void plan_symlink(restore_plan *plan, ext2_inode *ino,
+      const char *path) {
+   char target[PATH_MAX];
+
+   if (read_symlink(plan->fs, ino, target, sizeof(target)) < 0) {
+      fprintf(stderr, "\nError: %s: unreadable symbolic link\n", path);
+      plan->failures++;
+   }
+   else if (symlink(target, path)) {
+      report(path);
+      plan->failures++;
+   }
+}
+
+/*
+ * Names the file types that aren't restored
+ */
+static const char *special_type(uint16_t mode) {
+   if (S_ISCHR(mode))
+      return "character device";
+   if (S_ISBLK(mode))
+      return "block device";
+   if (S_ISFIFO(mode))
+      return "FIFO";
+   if (S_ISSOCK(mode))
+      return "socket";
+   return "unknown file type";
+}
+
+/*
+ * Creates the host file |path| for |ino| at its final size and queues copy
+ * jobs for its data runs. Holes need no job. Returns -1 if memory ran out.
+ */
+static int plan_file(restore_plan *plan, ext2_inode *ino, char *path) {
+   int fd;
+
+   fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, ino->i_mode & 07777);
+   if (fd < 0 || ftruncate(fd, inode_size(ino))) {
+      report(path);
+      plan->failures++;
+      if (fd >= 0)
+         close(fd);
+      free(path);
+      return 0;
+   }
+   close(fd);
+
+   if (plan->file_count == plan->file_cap) {
+      size_t file_cap = plan->file_cap ? plan->file_cap * 2 : 1024;
+      char **files = realloc(plan->files, file_cap * sizeof(char *));
+      if (!files) {
+         free(path);
+         return -1;
+      }
+      plan->files = files;
+      plan->file_cap = file_cap;
+   }
+   plan->files[plan->file_count++] = path;
+
+   return plan_runs(&plan->jobs, ino, plan->file_count - 1);
+}
+
+static int plan_entry(dir_walk *walk, ext2_dir_entry *entry) {
+   restore_plan *plan = walk->arg;
+   ext2_inode *ino = get_inode(plan->fs, entry->inode);
+   char *path = entry_path(walk, entry);
+
+   if (!path)
+      return -1;
+
+   if (!ino) {
+      fprintf(stderr, "\nError: %s: unreadable inode %u\n", path,
+            entry->inode);
+      plan->failures++;
+      free(path);
+      return 0;
+   }
+
+   if (S_ISLNK(ino->i_mode)) {
+      plan_symlink(plan, ino, path);
+      free(path);
+      return 0;
+   }
+
+   if (!S_ISDIR(ino->i_mode) && !S_ISREG(ino->i_mode)) {
+      fprintf(stderr, "\nError: %s: %s not restored\n", path,
+            special_type(ino->i_mode));
+      plan->failures++;
+      free(path);
+      return 0;
+   }
+
+   if (S_ISREG(ino->i_mode))
+      return plan_file(plan, ino, path);
+
+   if (walk_push(walk, entry->inode, path)) {
+      free(path);
+      return -1;
+   }
+   return 0;
+}
+
+/*
+ * Recreates directory |dir_ino|, known as |path|, before its entries are
+ * planned
+ */
+static int plan_dir(dir_walk *walk, uint32_t dir_ino, ext2_inode *dir,
+      const char *path) {
+   restore_plan *plan = walk->arg;
+   char *made;
+
+   if (!dir) {
+      fprintf(stderr, "\nError: %s: unreadable inode %u\n", path, dir_ino);
+      plan->failures++;
+      return 1;
+   }
+
+   // keep the owner's bits while the directory is being filled, its own
+   // mode is set by restore_modes()
+   if (mkdir(path, (dir->i_mode & 07777) | S_IRWXU)) {
+      if (errno == EEXIST)
+         return 0;
+      report(path);
+      plan->failures++;
+      return 1;
+   }
+
+   made = strdup(path);
+   if (!made || add_made_dir(plan, made, dir->i_mode & 07777)) {
+      free(made);
+      return -1;
+   }
+   return 0;
+}
+
+/*
+ * Gives the created directories their modes, children before parents so
+ * that removing a write or search bit doesn't lock out the entries below
+ */
+static void restore_modes(restore_plan *plan) {
+   made_dir *dir;
+
+   while (plan->made_count) {
+      dir = &plan->made[--plan->made_count];
+      if (chmod(dir->path, dir->mode)) {
+         report(dir->path);
+         plan->failures++;
+      }
+      free(dir->path);
+   }
+}
+
+/*
+ * Copy thread: claims jobs in physical order until none are left
+ */
+static void copy_jobs(job_plan *jobs, void *arg) {
+   restore_plan *plan = arg;
+   uint8_t *buf = malloc(COPY_BUFFER_SIZE);
+   uint32_t open_file = 0;
+   unsigned long start;
+   read_job *job;
+   int fd = -1;
+
+   if (!buf) {
+      jobs->out_of_memory = 1;
+      return;
+   }
+
+   while ((job = claim_job(jobs))) {
+      start = stats_now();
+
+      // small files are usually a single job, big ones come in chunks
+      if (fd < 0 || job->file != open_file) {
+         if (fd >= 0)
+            close(fd);
+         open_file = job->file;
+         fd = open(plan->files[open_file], O_WRONLY);
+      }
+
+      if (fd < 0 || copy_range_at(plan->fs, job->pos, fd, job->offset,
+            job->len, buf)) {
+         report(plan->files[job->file]);
+         __atomic_fetch_add(&plan->failures, 1, __ATOMIC_RELAXED);
+      }
+      stats_record(&plan->fs->stats, STATS_READ, start);
+   }
+
+   if (fd >= 0)
+      close(fd);
+   free(buf);
+}
+
+long restore_tree(ext2_fs *fs, uint32_t dir_ino, const char *dest,
+      int threads) {
+   restore_plan plan = { 0 };
+   int status;
+   size_t f;
+
+   plan.fs = fs;
+   plan.walk.fs = fs;
+   plan.walk.arg = &plan;
+   plan.walk.enter = plan_dir;
+   plan.walk.visit = plan_entry;
+   plan.jobs.fs = fs;
+   plan.jobs.chunk_blocks = RESTORE_CHUNK_BLOCKS;
+
+   // metadata pass, then the copy
+   status = walk_dirs(&plan.walk, dir_ino, dest);
+   if (!status)
+      status = run_jobs(&plan.jobs, threads, copy_jobs, &plan, 0) < 0 ? -1 : 0;
+   if (!status)
+      restore_modes(&plan);
+
+   walk_free(&plan.walk);
+   free_jobs(&plan.jobs);
+   while (plan.made_count)
+      free(plan.made[--plan.made_count].path);
+   for (f = 0; f < plan.file_count; f++)
+      free(plan.files[f]);
+   free(plan.made);
+   free(plan.files);
+
+   return status ? -1 : plan.failures;
+}
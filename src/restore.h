@@ -0,0 +1,32 @@
+/*
+ * restore.h
+ *
+ * Extraction of a whole subtree of the image into a host directory. The
+ * work is split in two phases: a single metadata pass walks the subtree,
+ * recreates its directories, creates every regular file at its final size
+ * and turns the files' block maps into copy jobs; then a pool of threads
+ * copies the jobs, in physical block order, with positional reads and
+ * writes.
+ */
+
+#ifndef RESTORE_H_
+#define RESTORE_H_
+
+#include "ext2.h"
+
+#define RESTORE_CHUNK_BLOCKS 8192 /* largest single copy job */
+
+/*
+ * Recreates everything below the directory with inode number |dir_ino|
+ * inside the host directory |dest| (created if missing), copying file
+ * contents with |threads| threads. Holes stay sparse, symbolic links are
+ * recreated and files keep their permission bits. Directories are filled
+ * with the owner's rwx added, and get their own modes once everything is
+ * copied, deepest first. Device nodes, FIFOs and sockets are skipped.
+ * Entries that are skipped or can't be created or written are reported on
+ * stderr. Returns the number of such failures, or -1 if memory ran out.
+ */
+long restore_tree(ext2_fs *fs, uint32_t dir_ino, const char *dest,
+      int threads);
+
+#endif /* RESTORE_H_ */
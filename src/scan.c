@@ -0,0 +1,506 @@
+/*
+ * scan.c
+ *
+ * Predicate scans over the inode tables, see scan.h
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "scan.h"
+#include "blockmap.h"
+#include "inode.h"
+#include "plan.h"
+
+#define SCAN_DAY 86400
+#define SCAN_MAX_SIZE ((off_t) (~0ULL >> 1))
+
+/*
+ * Matches found in one group, kept per group so that concatenating them
+ * in group order gives increasing inode numbers
+ */
+typedef struct group_matches {
+   uint32_t *inodes;
+   uint32_t count;
+} group_matches;
+
+typedef struct scan_job {
+   ext2_fs *fs;
+   const scan_query *query;
+   group_matches *groups;
+   uint32_t first_ino; /* first inode that isn't reserved */
+   uint32_t next_group; /* claimed by the threads */
+   int out_of_memory;
+} scan_job;
+
+void query_init(scan_query *query) {
+   memset(query, 0, sizeof(scan_query));
+   query->max_size = SCAN_MAX_SIZE;
+   query->max_mtime = ~0u;
+   query->max_ctime = ~0u;
+   query->perm = -1;
+   query->uid = -1;
+   query->gid = -1;
+}
+
+/*
+ * Parses a size with an optional K, M or G suffix. Sizes that don't fit an
+ * off_t are rejected.
+ */
+static int parse_size(const char *arg, off_t *size) {
+   char *end;
+   long long n;
+   int shift = 0;
+
+   errno = 0;
+   n = strtoll(arg, &end, 10);
+   if (end == arg || n < 0 || errno == ERANGE)
+      return -1;
+   switch (*end) {
+   case 'K':
+      shift = 10;
+      end++;
+      break;
+   case 'M':
+      shift = 20;
+      end++;
+      break;
+   case 'G':
+      shift = 30;
+      end++;
+      break;
+   }
+   if (*end || (off_t) n > SCAN_MAX_SIZE >> shift)
+      return -1;
+   *size = (off_t) n << shift;
+   return 0;
+}
+
+/*
+ * Parses a time in seconds since the epoch or as a YYYY-MM-DD date (UTC),
+ * storing in |*span| how many seconds it covers: 1, or a whole day
+ */
+static int parse_time(const char *arg, uint32_t *t, uint32_t *span) {
+   struct tm tm;
+   char *end;
+   long long n;
+   int len;
+
+   memset(&tm, 0, sizeof(tm));
+   if (sscanf(arg, "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+         &len) == 3 && !arg[len]) {
+      tm.tm_year -= 1900;
+      tm.tm_mon--;
+      n = timegm(&tm);
+      *span = SCAN_DAY;
+   }
+   else {
+      n = strtoll(arg, &end, 10);
+      if (end == arg || *end)
+         return -1;
+      *span = 1;
+   }
+
+   if (n < 0 || n > 0xffffffffLL)
+      return -1;
+   *t = n;
+   return 0;
+}
+
+/*
+ * Narrows the inclusive range [|*lo|, |*hi|] by |op| applied to the time
+ * in |arg|
+ */
+static int narrow_time(char op, const char *arg, uint32_t *lo, uint32_t *hi) {
+   uint32_t t, span, last;
+
+   if (parse_time(arg, &t, &span))
+      return -1;
+   last = t + (span - 1) < t ? ~0u : t + (span - 1);
+
+   switch (op) {
+   case '>':
+      if (last == ~0u)
+         return -1;
+      if (last + 1 > *lo)
+         *lo = last + 1;
+      return 0;
+   case '<':
+      if (!t)
+         return -1;
+      if (t - 1 < *hi)
+         *hi = t - 1;
+      return 0;
+   case '=':
+      if (t > *lo)
+         *lo = t;
+      if (last < *hi)
+         *hi = last;
+      return 0;
+   }
+   return -1;
+}
+
+/*
+ * Narrows the inclusive range [|*lo|, |*hi|] by |op| applied to the size
+ * in |arg|
+ */
+static int narrow_size(char op, const char *arg, off_t *lo, off_t *hi) {
+   off_t size;
+
+   if (parse_size(arg, &size))
+      return -1;
+
+   switch (op) {
+   case '>':
+      if (size == SCAN_MAX_SIZE)
+         return -1;
+      if (size + 1 > *lo)
+         *lo = size + 1;
+      return 0;
+   case '<':
+      if (!size)
+         return -1;
+      if (size - 1 < *hi)
+         *hi = size - 1;
+      return 0;
+   case '=':
+      if (size > *lo)
+         *lo = size;
+      if (size < *hi)
+         *hi = size;
+      return 0;
+   }
+   return -1;
+}
+
+static int parse_number(const char *arg, int base, long *n) {
+   char *end;
+
+   *n = strtol(arg, &end, base);
+   return end == arg || *end || *n < 0 ? -1 : 0;
+}
+
+static int is_key(const char *arg, size_t len, const char *key) {
+   return strlen(key) == len && !strncmp(arg, key, len);
+}
+
+int parse_predicate(scan_query *query, const char *arg) {
+   static const char types[] = "fdlcbps";
+   static const uint16_t modes[] = { S_IFREG, S_IFDIR, S_IFLNK, S_IFCHR,
+         S_IFBLK, S_IFIFO, S_IFSOCK };
+   size_t len = strcspn(arg, "<=>&");
+   const char *value = arg + len + 1;
+   char op = arg[len];
+   const char *type;
+   long n;
+
+   if (!op)
+      return -1;
+
+   if (is_key(arg, len, "size"))
+      return narrow_size(op, value, &query->min_size, &query->max_size);
+   if (is_key(arg, len, "mtime"))
+      return narrow_time(op, value, &query->min_mtime, &query->max_mtime);
+   if (is_key(arg, len, "ctime"))
+      return narrow_time(op, value, &query->min_ctime, &query->max_ctime);
+
+   if (is_key(arg, len, "type") && op == '=') {
+      type = value[0] && !value[1] ? strchr(types, value[0]) : NULL;
+      if (!type)
+         return -1;
+      query->type = modes[type - types];
+      return 0;
+   }
+   if (is_key(arg, len, "perm") && op == '=') {
+      if (parse_number(value, 8, &n) || n > 07777)
+         return -1;
+      query->perm = n;
+      return 0;
+   }
+   if (is_key(arg, len, "mode") && op == '&') {
+      if (parse_number(value, 8, &n) || !n || n > 0xffff)
+         return -1;
+      query->mode_any = n;
+      return 0;
+   }
+   if (is_key(arg, len, "uid") && op == '=')
+      return parse_number(value, 10, &query->uid);
+   if (is_key(arg, len, "gid") && op == '=')
+      return parse_number(value, 10, &query->gid);
+   return -1;
+}
+
+int query_match(const scan_query *query, const ext2_inode *ino) {
+   off_t size = inode_size((ext2_inode *) ino);
+   uint32_t uid = ino->i_uid | (uint32_t) ino->osd2.linux2.l_i_uid_high << 16;
+   uint32_t gid = ino->i_gid | (uint32_t) ino->osd2.linux2.l_i_gid_high << 16;
+
+   return size >= query->min_size && size <= query->max_size
+         && ino->i_mtime >= query->min_mtime
+         && ino->i_mtime <= query->max_mtime
+         && ino->i_ctime >= query->min_ctime
+         && ino->i_ctime <= query->max_ctime
+         && (!query->type || (ino->i_mode & S_IFMT) == query->type)
+         && (!query->mode_any || (ino->i_mode & query->mode_any))
+         && (query->perm < 0 || (ino->i_mode & 07777) == query->perm)
+         && (query->uid < 0 || uid == query->uid)
+         && (query->gid < 0 || gid == query->gid);
+}
+
+/*
+ * Returns one past the highest set bit among the first |nbits| of |map|,
+ * 0 if none is set
+ */
+static uint32_t bitmap_end(const uint8_t *map, uint32_t nbits) {
+   uint32_t byte = (nbits + 7) / 8;
+   uint8_t bits;
+
+   while (byte--) {
+      bits = map[byte];
+      if (byte == nbits / 8)
+         bits &= (1 << nbits % 8) - 1;
+      if (bits)
+         return byte * 8 + 32 - __builtin_clz(bits);
+   }
+   return 0;
+}
+
+/*
+ * Tests the used inodes of group |group|, |bitmap| holding a block and
+ * |table| a whole inode table. Returns -1 if memory ran out.
+ */
+static int scan_group(scan_job *job, uint32_t group, uint8_t *bitmap,
+      uint8_t *table) {
+   ext2_fs *fs = job->fs;
+   ext2_group_desc *desc = &fs->groups[group];
+   uint32_t per_group = fs->sb.s_inodes_per_group;
+   uint32_t first = group * per_group + 1, end, i, cap = 0;
+   group_matches *found = &job->groups[group];
+   const uint8_t *map, *inodes;
+   ext2_inode *ino;
+   uint32_t *grown;
+
+   if (desc->bg_free_inodes_count >= per_group)
+      return 0;
+
+   map = fetch_range(fs, BLOCK_POS(fs, desc->bg_inode_bitmap), bitmap,
+         (per_group + 7) / 8);
+   end = bitmap_end(map, per_group);
+   if (!end)
+      return 0;
+
+   // one sequential read up to the last used inode
+   inodes = fetch_range(fs, BLOCK_POS(fs, desc->bg_inode_table), table,
+         (size_t) end * fs->inode_size);
+
+   for (i = 0; i < end; i++) {
+      if (!(map[i / 8] >> i % 8 & 1)
+            || (first + i < job->first_ino && first + i != EXT2_ROOT_INO))
+         continue;
+
+      ino = (ext2_inode *) (inodes + (size_t) i * fs->inode_size);
+      if (!query_match(job->query, ino))
+         continue;
+
+      if (found->count == cap) {
+         cap = cap ? cap * 2 : 64;
+         grown = realloc(found->inodes, cap * sizeof(uint32_t));
+         if (!grown)
+            return -1;
+         found->inodes = grown;
+      }
+      found->inodes[found->count++] = first + i;
+   }
+   return 0;
+}
+
+/*
+ * Worker thread: claims groups until none are left
+ */
+static void *scan_groups(void *arg) {
+   scan_job *job = arg;
+   ext2_fs *fs = job->fs;
+   uint8_t *bitmap = malloc(fs->block_size);
+   uint8_t *table = malloc((size_t) fs->sb.s_inodes_per_group
+         * fs->inode_size);
+   uint32_t group;
+
+   if (!bitmap || !table)
+      job->out_of_memory = 1;
+
+   while (!job->out_of_memory && (group = __atomic_fetch_add(
+         &job->next_group, 1, __ATOMIC_RELAXED)) < fs->group_count)
+      if (scan_group(job, group, bitmap, table))
+         job->out_of_memory = 1;
+
+   free(bitmap);
+   free(table);
+   return NULL;
+}
+
+int scan_inodes(ext2_fs *fs, const scan_query *query, int threads,
+      uint32_t **matches, size_t *count) {
+   pthread_t workers[SCAN_MAX_THREADS];
+   scan_job job = { 0 };
+   uint32_t g;
+   size_t total = 0;
+   int i, started;
+
+   *matches = NULL;
+   *count = 0;
+   job.fs = fs;
+   job.query = query;
+   job.first_ino = fs->sb.s_rev_level >= EXT2_DYNAMIC_REV
+         ? fs->sb.s_first_ino : EXT2_GOOD_OLD_FIRST_INO;
+   job.groups = calloc(fs->group_count, sizeof(group_matches));
+   if (!job.groups)
+      return -1;
+
+   if (threads < 1)
+      threads = 1;
+   if (threads > SCAN_MAX_THREADS)
+      threads = SCAN_MAX_THREADS;
+
+   // the calling thread scans too
+   for (started = 1; started < threads; started++)
+      if (pthread_create(&workers[started], NULL, scan_groups, &job))
+         break;
+   scan_groups(&job);
+   for (i = 1; i < started; i++)
+      pthread_join(workers[i], NULL);
+
+   for (g = 0; g < fs->group_count; g++)
+      total += job.groups[g].count;
+   if (!job.out_of_memory && total)
+      *matches = malloc(total * sizeof(uint32_t));
+   if (!job.out_of_memory && (*matches || !total))
+      for (g = 0; g < fs->group_count; g++) {
+         memcpy(*matches + *count, job.groups[g].inodes,
+               job.groups[g].count * sizeof(uint32_t));
+         *count += job.groups[g].count;
+      }
+
+   for (g = 0; g < fs->group_count; g++)
+      free(job.groups[g].inodes);
+   free(job.groups);
+
+   if (job.out_of_memory || (total && !*matches)) {
+      free(*matches);
+      *matches = NULL;
+      *count = 0;
+      return -1;
+   }
+   return 0;
+}
+
+/*
+ * State of print_matches()
+ */
+typedef struct match_walk {
+   ext2_fs *fs;
+   FILE *out;
+   uint8_t *wanted; /* bitmap of the matches */
+   uint8_t *found; /* matches printed so far */
+   uint8_t *visited; /* directories queued so far */
+   int filetype; /* entries carry their file type */
+} match_walk;
+
+#define TEST_BIT(map, n) ((map)[((n) - 1) / 8] >> ((n) - 1) % 8 & 1)
+#define SET_BIT(map, n) ((map)[((n) - 1) / 8] |= 1 << ((n) - 1) % 8)
+
+static void print_match(match_walk *walk, const char *path, size_t len,
+      uint32_t ino_num) {
+   ext2_inode *ino = get_inode(walk->fs, ino_num);
+
+   fprintf(walk->out, "%.*s\t%u\t%c\t%lld\n", (int) len, path, ino_num,
+         inode_type(ino), ino ? (long long) inode_size(ino) : 0LL);
+}
+
+static int visit_entry(dir_walk *tree, ext2_dir_entry *entry) {
+   match_walk *walk = tree->arg;
+   uint32_t ino_num = entry->inode;
+   ext2_inode *ino;
+   int wanted, is_dir;
+   char *path;
+
+   if (ino_num > walk->fs->sb.s_inodes_count)
+      return 0;
+
+   // with the filetype feature, only directories and matches cost an inode
+   wanted = TEST_BIT(walk->wanted, ino_num);
+   if (walk->filetype)
+      is_dir = entry->file_type == EXT2_FT_DIR;
+   else {
+      ino = get_inode(walk->fs, ino_num);
+      is_dir = ino && S_ISDIR(ino->i_mode);
+   }
+   if (!wanted && (!is_dir || TEST_BIT(walk->visited, ino_num)))
+      return 0;
+
+   path = entry_path(tree, entry);
+   if (!path)
+      return -1;
+
+   if (wanted) {
+      print_match(walk, path, tree->parent_len + 1 + entry->name_len,
+            ino_num);
+      SET_BIT(walk->found, ino_num);
+   }
+   if (!is_dir || TEST_BIT(walk->visited, ino_num)) {
+      free(path);
+      return 0;
+   }
+
+   SET_BIT(walk->visited, ino_num);
+   if (walk_push(tree, ino_num, path)) {
+      free(path);
+      return -1;
+   }
+   return 0;
+}
+
+int print_matches(ext2_fs *fs, const uint32_t *matches, size_t count,
+      FILE *out) {
+   size_t bitmap_size = fs->sb.s_inodes_count / 8 + 1, i;
+   match_walk walk = { 0 };
+   dir_walk tree = { 0 };
+   int err = 0;
+
+   tree.fs = fs;
+   tree.arg = &walk;
+   tree.visit = visit_entry;
+   walk.fs = fs;
+   walk.out = out;
+   walk.filetype = !!(fs->sb.s_feature_incompat
+         & EXT2_FEATURE_INCOMPAT_FILETYPE);
+   walk.wanted = calloc(bitmap_size, 1);
+   walk.found = calloc(bitmap_size, 1);
+   walk.visited = calloc(bitmap_size, 1);
+   if (!walk.wanted || !walk.found || !walk.visited)
+      err = -1;
+
+   for (i = 0; !err && i < count; i++)
+      SET_BIT(walk.wanted, matches[i]);
+
+   // the root has no entry naming it
+   if (!err && TEST_BIT(walk.wanted, EXT2_ROOT_INO)) {
+      print_match(&walk, "/", 1, EXT2_ROOT_INO);
+      SET_BIT(walk.found, EXT2_ROOT_INO);
+   }
+   if (!err && count) {
+      SET_BIT(walk.visited, EXT2_ROOT_INO);
+      err = walk_dirs(&tree, EXT2_ROOT_INO, "");
+   }
+
+   for (i = 0; !err && i < count; i++)
+      if (!TEST_BIT(walk.found, matches[i]))
+         print_match(&walk, "-", 1, matches[i]);
+
+   walk_free(&tree);
+   free(walk.wanted);
+   free(walk.found);
+   free(walk.visited);
+   return err;
+}
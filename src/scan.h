@@ -0,0 +1,86 @@
+/*
+ * scan.h
+ *
+ * Inode table scans with predicates, for finding files by their attributes
+ * rather than by name. Block groups are shared out between threads; each
+ * group's inode bitmap is read first, groups without a used inode are
+ * skipped outright, and the inode table is read in one sequential read
+ * that stops after the last used inode. Only inodes marked used are
+ * tested. Paths are worked out afterwards, and only for the matches, by a
+ * single walk of the directory tree.
+ */
+
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include "ext2.h"
+
+#define SCAN_MAX_THREADS 64
+
+/*
+ * Conditions an inode must all meet to match. Ranges are inclusive.
+ */
+typedef struct scan_query {
+   off_t min_size;
+   off_t max_size;
+   uint32_t min_mtime;
+   uint32_t max_mtime;
+   uint32_t min_ctime;
+   uint32_t max_ctime;
+   uint16_t type; /* S_IFMT bits of i_mode, or 0 for any type */
+   uint16_t mode_any; /* at least one of these mode bits must be set */
+   int perm; /* exact permission bits (07777), or -1 */
+   long uid; /* owner, or -1 */
+   long gid; /* group, or -1 */
+} scan_query;
+
+/*
+ * Sets |query| to match every inode
+ */
+void query_init(scan_query *query);
+
+/*
+ * Narrows |query| by the predicate |arg|, one of
+ *
+ *    size<N size=N size>N     N in bytes, with an optional K, M or G suffix
+ *    mtime<T mtime=T mtime>T  T in seconds since the epoch, or YYYY-MM-DD
+ *    ctime<T ctime=T ctime>T
+ *    type=C                   C one of f d l c b p s
+ *    perm=OCTAL               exact permission bits
+ *    mode&OCTAL               any of the given mode bits, e.g. 06000
+ *    uid=N gid=N
+ *
+ * Predicates on the same field combine, e.g. size>1K size<1M. Returns 0 on
+ * success, -1 if |arg| isn't a valid predicate.
+ */
+int parse_predicate(scan_query *query, const char *arg);
+
+/*
+ * Returns nonzero if |ino| meets every condition of |query|
+ */
+int query_match(const scan_query *query, const ext2_inode *ino);
+
+/*
+ * Scans every in-use inode of |fs| with |threads| threads and stores the
+ * numbers of those matching |query|, in increasing order, in a malloc'd
+ * array at |*matches| and their count in |*count|. Reserved inodes other
+ * than the root are never matched. Returns 0 on success, -1 if memory ran
+ * out.
+ */
+int scan_inodes(ext2_fs *fs, const scan_query *query, int threads,
+      uint32_t **matches, size_t *count);
+
+/*
+ * Writes one line per name of each of the |count| inodes in |matches|, in
+ * the format of batch resolution:
+ *
+ *    <path> <inode> <type> <size>
+ *
+ * directory by directory as the tree is walked, followed by a line with
+ * "-" as the path for each match no directory links to. Returns 0 on
+ * success, -1 if memory ran out.
+ */
+int print_matches(ext2_fs *fs, const uint32_t *matches, size_t count,
+      FILE *out);
+
+#endif /* SCAN_H_ */
@@ -0,0 +1,775 @@
+/*
+ * sidecar.c
+ *
+ * Persistent image index, see sidecar.h
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sidecar.h"
+#include "checksum.h"
+#include "dir.h"
+#include "inode.h"
+#include "match.h"
+
+#define SIDECAR_MAGIC "E2RIDX\r\n"
+#define SIDECAR_VERSION 4
+#define SIDECAR_NO_RUNS 0xffffffffu /* runs not stored for this inode */
+#define SIDECAR_NO_BLOCKS 0xffffffffu /* i_block not stored either */
+
+/* sections start on 8 byte boundaries */
+#define SIDECAR_ALIGN(pos) (((pos) + 7) & ~(off_t) 7)
+
+/*
+ * Start of the index file, followed by the inode records sorted by inode
+ * number, the directory entries, the hash slots, the runs, the i_block
+ * copies and the names, each section aligned by SIDECAR_ALIGN()
+ */
+typedef struct sidecar_header {
+   char magic[8];
+   uint32_t version;
+   uint32_t record_size; /* sizeof(index_record), catches layout changes */
+   uint32_t block_size;
+   /* superblock fields the index must match */
+   uint32_t s_wtime;
+   uint32_t s_mtime;
+   uint32_t s_blocks_count;
+   uint32_t s_free_blocks_count;
+   uint32_t s_free_inodes_count;
+   uint8_t s_uuid[16];
+   uint32_t inode_count;
+   uint32_t entry_count;
+   uint32_t slot_count; /* a power of two */
+   uint32_t run_count;
+   uint32_t names_size;
+   uint32_t block_count; /* i_block copies */
+   uint32_t sum; /* CRC32C of the header, taken with this field 0 */
+   uint32_t reserved;
+   off_t file_size;
+} sidecar_header;
+
+/*
+ * An indexed inode: the fields of its inode that readers use, and where
+ * its runs are. Files and directories have runs; other inodes keep a copy
+ * of their i_block instead, which holds a fast symlink's target, a slow
+ * one's block or a device's numbers.
+ */
+typedef struct index_record {
+   uint32_t ino;
+   uint16_t mode; /* i_mode */
+   uint16_t links_count;
+   off_t size;
+   uint32_t uid; /* with the high 16 bits */
+   uint32_t gid;
+   uint32_t atime;
+   uint32_t ctime;
+   uint32_t mtime;
+   uint32_t blocks; /* i_blocks */
+   uint32_t flags;
+   uint32_t file_acl;
+   uint32_t first_run; /* or SIDECAR_NO_RUNS */
+   uint32_t run_count;
+   uint32_t first_block; /* index of the i_block copy, or SIDECAR_NO_BLOCKS */
+   uint32_t sum; /* CRC32C of the record, taken with this field 0, and its
+                    runs or i_block copy */
+} index_record;
+
+typedef uint32_t block_copy[EXT2_N_BLOCKS];
+
+typedef struct sidecar_entry {
+   uint32_t parent; /* inode number of the directory holding the entry */
+   uint32_t ino;
+   uint32_t hash;
+   uint32_t name; /* offset into the names */
+   uint32_t name_len;
+   uint32_t sum; /* CRC32C of the entry, taken with this field 0, and name */
+} sidecar_entry;
+
+struct sidecar {
+   uint8_t *map;
+   size_t size;
+   const sidecar_header *header;
+   const index_record *inodes;
+   const sidecar_entry *entries;
+   const uint32_t *slots; /* entry index + 1, 0 for an empty slot */
+   const extent *runs;
+   const block_copy *blocks;
+   const char *names;
+   ext2_inode *copies; /* inodes rebuilt from their records, by record */
+   uint8_t *copied; /* COPY_* state of each of |copies| */
+   pthread_mutex_t lock; /* taken to fill in a copy */
+};
+
+/* states of a copy */
+#define COPY_UNCHECKED 0
+#define COPY_FILLED 1
+#define COPY_DAMAGED 2 /* its record is out of bounds or fails its checksum */
+
+/*
+ * Offsets of the sections of an index file
+ */
+typedef struct sidecar_layout {
+   off_t inodes;
+   off_t entries;
+   off_t slots;
+   off_t runs;
+   off_t blocks;
+   off_t names;
+   off_t end;
+} sidecar_layout;
+
+static void get_layout(const sidecar_header *h, sidecar_layout *l) {
+   l->inodes = SIDECAR_ALIGN((off_t) sizeof(sidecar_header));
+   l->entries = SIDECAR_ALIGN(l->inodes
+         + (off_t) h->inode_count * sizeof(index_record));
+   l->slots = SIDECAR_ALIGN(l->entries
+         + (off_t) h->entry_count * sizeof(sidecar_entry));
+   l->runs = SIDECAR_ALIGN(l->slots + (off_t) h->slot_count * sizeof(uint32_t));
+   l->blocks = SIDECAR_ALIGN(l->runs + (off_t) h->run_count * sizeof(extent));
+   l->names = SIDECAR_ALIGN(l->blocks
+         + (off_t) h->block_count * sizeof(block_copy));
+   l->end = SIDECAR_ALIGN(l->names + (off_t) h->names_size);
+}
+
+static uint32_t hash_entry(uint32_t parent, const char *name, size_t len) {
+   uint32_t h = 2166136261u ^ parent * 2654435761u;
+
+   while (len--)
+      h = (h ^ (uint8_t) *name++) * 16777619u;
+   return h;
+}
+
+static uint32_t header_sum(const sidecar_header *h) {
+   sidecar_header copy = *h;
+
+   copy.sum = 0;
+   return crc32c(0, &copy, sizeof(sidecar_header));
+}
+
+/*
+ * Returns the checksum of |rec| and the runs or i_block copy it points to
+ * in |runs| and |blocks|, which the caller has bounds-checked
+ */
+static uint32_t record_sum(const index_record *rec, const extent *runs,
+      const block_copy *blocks) {
+   index_record copy = *rec;
+   uint32_t crc;
+
+   copy.sum = 0;
+   crc = crc32c(0, &copy, sizeof(index_record));
+   if (rec->first_run != SIDECAR_NO_RUNS)
+      crc = crc32c(crc, runs + rec->first_run,
+            (size_t) rec->run_count * sizeof(extent));
+   if (rec->first_block != SIDECAR_NO_BLOCKS)
+      crc = crc32c(crc, blocks + rec->first_block, sizeof(block_copy));
+   return crc;
+}
+
+/*
+ * Returns the checksum of |e| and its name, found at |names| + e->name
+ */
+static uint32_t entry_sum(const sidecar_entry *e, const char *names) {
+   sidecar_entry copy = *e;
+
+   copy.sum = 0;
+   return crc32c(crc32c(0, &copy, sizeof(sidecar_entry)), names + e->name,
+         e->name_len);
+}
+
+/*
+ * Stores in |h| the superblock fields of |fs| an index must match
+ */
+static void stamp_header(ext2_fs *fs, sidecar_header *h) {
+   memcpy(h->magic, SIDECAR_MAGIC, sizeof(h->magic));
+   h->version = SIDECAR_VERSION;
+   h->record_size = sizeof(index_record);
+   h->block_size = fs->block_size;
+   h->s_wtime = fs->sb.s_wtime;
+   h->s_mtime = fs->sb.s_mtime;
+   h->s_blocks_count = fs->sb.s_blocks_count;
+   h->s_free_blocks_count = fs->sb.s_free_blocks_count;
+   h->s_free_inodes_count = fs->sb.s_free_inodes_count;
+   memcpy(h->s_uuid, fs->sb.s_uuid, sizeof(h->s_uuid));
+}
+
+/*
+ * State of sidecar_build() while it walks the tree
+ */
+typedef struct builder {
+   ext2_fs *fs;
+   uint8_t *seen; /* bitmap of the inodes already recorded */
+   index_record *inodes;
+   uint32_t inode_count;
+   uint32_t inode_cap;
+   sidecar_entry *entries;
+   uint32_t entry_count;
+   uint32_t entry_cap;
+   extent *runs;
+   uint32_t run_count;
+   uint32_t run_cap;
+   block_copy *blocks;
+   uint32_t block_count;
+   uint32_t block_cap;
+   char *names;
+   uint32_t names_len;
+   uint32_t names_cap;
+   uint32_t *dirs; /* directories still to scan */
+   uint32_t dir_count;
+   uint32_t dir_cap;
+   uint32_t parent; /* directory being scanned */
+} builder;
+
+/*
+ * Makes room for one more element of |size| bytes in |items|, which holds
+ * |count| out of |*cap|. Returns the array, moved if it had to grow, or
+ * NULL if memory ran out or it would outgrow the 32-bit counts of the
+ * format.
+ */
+static void *reserve(void *items, uint32_t count, uint32_t *cap, size_t size) {
+   uint32_t new_cap;
+
+   if (count < *cap)
+      return items;
+
+   new_cap = *cap ? *cap * 2 : 64;
+   if (new_cap <= *cap) {
+      errno = EFBIG;
+      return NULL;
+   }
+   items = realloc(items, (size_t) new_cap * size);
+   if (items)
+      *cap = new_cap;
+   return items;
+}
+
+/*
+ * Records inode |ino_num| and the runs of its data the first time it is
+ * reached, queueing it for a scan if it is a directory. Returns 0 on
+ * success, -1 if memory ran out.
+ */
+static int add_inode(builder *b, uint32_t ino_num) {
+   ext2_inode *ino;
+   index_record *rec;
+   block_iter it;
+   extent run, *runs;
+   block_copy *blocks;
+   uint32_t *dirs;
+   char type;
+
+   if (!ino_num || ino_num > b->fs->sb.s_inodes_count
+         || b->seen[(ino_num - 1) / 8] & 1 << (ino_num - 1) % 8)
+      return 0;
+   b->seen[(ino_num - 1) / 8] |= 1 << (ino_num - 1) % 8;
+
+   ino = get_inode(b->fs, ino_num);
+   rec = ino ? reserve(b->inodes, b->inode_count, &b->inode_cap,
+         sizeof(index_record)) : NULL;
+   if (!rec)
+      return -1;
+   b->inodes = rec;
+
+   rec = &b->inodes[b->inode_count++];
+   memset(rec, 0, sizeof(index_record));
+   rec->ino = ino_num;
+   rec->mode = ino->i_mode;
+   rec->links_count = ino->i_links_count;
+   rec->size = inode_size(ino);
+   rec->uid = ino->i_uid | (uint32_t) ino->osd2.linux2.l_i_uid_high << 16;
+   rec->gid = ino->i_gid | (uint32_t) ino->osd2.linux2.l_i_gid_high << 16;
+   rec->atime = ino->i_atime;
+   rec->ctime = ino->i_ctime;
+   rec->mtime = ino->i_mtime;
+   rec->blocks = ino->i_blocks;
+   rec->flags = ino->i_flags;
+   rec->file_acl = ino->i_file_acl;
+   rec->first_run = SIDECAR_NO_RUNS;
+   rec->first_block = SIDECAR_NO_BLOCKS;
+
+   // only files and directories have block pointers in i_block, a fast
+   // symlink keeps its target there and a device its numbers
+   type = inode_type(ino);
+   if (type != 'f' && type != 'd') {
+      blocks = reserve(b->blocks, b->block_count, &b->block_cap,
+            sizeof(block_copy));
+      if (!blocks)
+         return -1;
+      b->blocks = blocks;
+      memcpy(b->blocks[b->block_count], ino->i_block, sizeof(block_copy));
+      rec->first_block = b->block_count++;
+      return 0;
+   }
+
+   rec->first_run = b->run_count;
+   iter_init(&it, b->fs, ino);
+   while (iter_next(&it, &run)) {
+      runs = reserve(b->runs, b->run_count, &b->run_cap, sizeof(extent));
+      if (!runs)
+         return -1;
+      b->runs = runs;
+      b->runs[b->run_count++] = run;
+      rec->run_count++;
+   }
+
+   if (type == 'd') {
+      dirs = reserve(b->dirs, b->dir_count, &b->dir_cap, sizeof(uint32_t));
+      if (!dirs)
+         return -1;
+      b->dirs = dirs;
+      b->dirs[b->dir_count++] = ino_num;
+   }
+   return 0;
+}
+
+static int add_entry(ext2_dir_entry *entry, void *arg) {
+   builder *b = arg;
+   sidecar_entry *e;
+
+   e = reserve(b->entries, b->entry_count, &b->entry_cap,
+         sizeof(sidecar_entry));
+   if (!e)
+      return -1;
+   b->entries = e;
+
+   while (b->names_len + entry->name_len > b->names_cap) {
+      uint32_t names_cap = b->names_cap ? b->names_cap * 2 : 4096;
+      char *names;
+
+      if (names_cap <= b->names_cap) {
+         errno = EFBIG;
+         return -1;
+      }
+      names = realloc(b->names, names_cap);
+      if (!names)
+         return -1;
+      b->names = names;
+      b->names_cap = names_cap;
+   }
+
+   e = &b->entries[b->entry_count++];
+   e->parent = b->parent;
+   e->ino = entry->inode;
+   e->hash = hash_entry(b->parent, entry->name, entry->name_len);
+   e->name = b->names_len;
+   e->name_len = entry->name_len;
+   memcpy(b->names + b->names_len, entry->name, entry->name_len);
+   b->names_len += entry->name_len;
+
+   return add_inode(b, entry->inode);
+}
+
+static int compare_ino(const void *a, const void *b) {
+   uint32_t x = ((const index_record *) a)->ino;
+   uint32_t y = ((const index_record *) b)->ino;
+
+   return x < y ? -1 : x > y;
+}
+
+/*
+ * Lays out the index collected by |b| in one buffer, the way it is stored.
+ * Returns NULL if memory ran out.
+ */
+static uint8_t *pack_index(builder *b, sidecar_header *h) {
+   sidecar_layout l;
+   uint32_t *slots, i, slot, mask;
+   uint8_t *file;
+
+   qsort(b->inodes, b->inode_count, sizeof(index_record), compare_ino);
+
+   // keep the table at most half full
+   for (h->slot_count = 16; h->slot_count / 2 < b->entry_count;)
+      h->slot_count *= 2;
+   h->inode_count = b->inode_count;
+   h->entry_count = b->entry_count;
+   h->run_count = b->run_count;
+   h->block_count = b->block_count;
+   h->names_size = b->names_len;
+   get_layout(h, &l);
+   h->file_size = l.end;
+
+   file = calloc(1, l.end);
+   if (!file)
+      return NULL;
+
+   for (i = 0; i < b->inode_count; i++)
+      b->inodes[i].sum = record_sum(&b->inodes[i], b->runs, b->blocks);
+   for (i = 0; i < b->entry_count; i++)
+      b->entries[i].sum = entry_sum(&b->entries[i], b->names);
+
+   memcpy(file + l.inodes, b->inodes,
+         (size_t) b->inode_count * sizeof(index_record));
+   memcpy(file + l.entries, b->entries,
+         (size_t) b->entry_count * sizeof(sidecar_entry));
+   memcpy(file + l.runs, b->runs, (size_t) b->run_count * sizeof(extent));
+   memcpy(file + l.blocks, b->blocks,
+         (size_t) b->block_count * sizeof(block_copy));
+   memcpy(file + l.names, b->names, b->names_len);
+
+   slots = (uint32_t *) (file + l.slots);
+   mask = h->slot_count - 1;
+   for (i = 0; i < b->entry_count; i++) {
+      for (slot = b->entries[i].hash & mask; slots[slot];)
+         slot = (slot + 1) & mask;
+      slots[slot] = i + 1;
+   }
+
+   h->sum = header_sum(h);
+   memcpy(file, h, sizeof(sidecar_header));
+   return file;
+}
+
+/*
+ * Writes |size| bytes at |data| to a temporary file and renames it to
+ * |path|. Returns 0 on success, -1 with errno set otherwise.
+ */
+static int write_index(const char *path, const uint8_t *data, size_t size) {
+   size_t len = strlen(path);
+   char *tmp = malloc(len + 5);
+   ssize_t n;
+   int fd, err = 0;
+
+   if (!tmp)
+      return -1;
+   memcpy(tmp, path, len);
+   strcpy(tmp + len, ".tmp");
+
+   fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0) {
+      free(tmp);
+      return -1;
+   }
+
+   while (size && !err) {
+      n = write(fd, data, size);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n < 0)
+         err = -1;
+      else {
+         data += n;
+         size -= n;
+      }
+   }
+
+   if (close(fd) && !err)
+      err = -1;
+   if (!err && rename(tmp, path))
+      err = -1;
+   if (err) {
+      int saved = errno;
+      unlink(tmp);
+      errno = saved;
+   }
+   free(tmp);
+   return err;
+}
+
+int sidecar_build(ext2_fs *fs, const char *path) {
+   builder b;
+   sidecar_header h;
+   uint8_t *file = NULL;
+   int err = -1;
+
+   memset(&b, 0, sizeof(builder));
+   memset(&h, 0, sizeof(sidecar_header));
+   b.fs = fs;
+   b.seen = calloc(fs->sb.s_inodes_count / 8 + 1, 1);
+   if (!b.seen)
+      return -1;
+
+   // scan directories depth first, recording every inode once
+   if (add_inode(&b, EXT2_ROOT_INO))
+      goto out;
+   while (b.dir_count) {
+      b.parent = b.dirs[--b.dir_count];
+      if (iterate_dir(fs, get_inode(fs, b.parent), add_entry, &b))
+         goto out;
+   }
+
+   stamp_header(fs, &h);
+   file = pack_index(&b, &h);
+   if (file)
+      err = write_index(path, file, h.file_size);
+
+out:
+   free(file);
+   free(b.seen);
+   free(b.inodes);
+   free(b.entries);
+   free(b.runs);
+   free(b.blocks);
+   free(b.names);
+   free(b.dirs);
+   return err;
+}
+
+/*
+ * Checks the header of |sc|: the format, its checksum, the superblock stamp
+ * and the size of every section. Records and entries are checked against
+ * their own checksums as they are used, so opening the index costs nothing
+ * per record. Returns 0 if |sc| can be used with |fs|, -1 with errno set
+ * otherwise.
+ */
+static int validate(ext2_fs *fs, struct sidecar *sc) {
+   const sidecar_header *h = sc->header;
+   sidecar_header expected;
+   sidecar_layout l;
+
+   if (sc->size < sizeof(sidecar_header)
+         || memcmp(h->magic, SIDECAR_MAGIC, sizeof(h->magic))
+         || h->version != SIDECAR_VERSION
+         || h->record_size != sizeof(index_record)
+         || h->sum != header_sum(h)) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   memset(&expected, 0, sizeof(sidecar_header));
+   stamp_header(fs, &expected);
+   if (h->block_size != expected.block_size
+         || h->s_wtime != expected.s_wtime || h->s_mtime != expected.s_mtime
+         || h->s_blocks_count != expected.s_blocks_count
+         || h->s_free_blocks_count != expected.s_free_blocks_count
+         || h->s_free_inodes_count != expected.s_free_inodes_count
+         || memcmp(h->s_uuid, expected.s_uuid, sizeof(h->s_uuid))) {
+      errno = ESTALE;
+      return -1;
+   }
+
+   get_layout(h, &l);
+   if (h->file_size != (off_t) sc->size || l.end != h->file_size
+         || !h->slot_count || h->slot_count & (h->slot_count - 1)
+         || h->slot_count / 2 < h->entry_count) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   sc->inodes = (const index_record *) (sc->map + l.inodes);
+   sc->entries = (const sidecar_entry *) (sc->map + l.entries);
+   sc->slots = (const uint32_t *) (sc->map + l.slots);
+   sc->runs = (const extent *) (sc->map + l.runs);
+   sc->blocks = (const block_copy *) (sc->map + l.blocks);
+   sc->names = (const char *) (sc->map + l.names);
+   return 0;
+}
+
+/*
+ * Maps the index at |path| and attaches it to |fs| if it is valid
+ */
+static int load_index(ext2_fs *fs, const char *path) {
+   struct sidecar *sc;
+   struct stat st;
+   void *map;
+   int fd, err;
+
+   fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return -1;
+   if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+      close(fd);
+      errno = EINVAL;
+      return -1;
+   }
+
+   map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+      return -1;
+
+   sc = calloc(1, sizeof(struct sidecar));
+   if (!sc) {
+      munmap(map, st.st_size);
+      return -1;
+   }
+   sc->map = map;
+   sc->size = st.st_size;
+   sc->header = map;
+
+   // untouched copies cost no memory: calloc() maps large blocks lazily
+   if (validate(fs, sc) || !(sc->copies = calloc(
+         sc->header->inode_count + 1, sizeof(ext2_inode)))
+         || !(sc->copied = calloc(sc->header->inode_count + 1, 1))) {
+      err = errno;
+      munmap(map, st.st_size);
+      free(sc->copies);
+      free(sc);
+      errno = err;
+      return -1;
+   }
+   pthread_mutex_init(&sc->lock, NULL);
+
+   sidecar_close(fs);
+   fs->sidecar = sc;
+   return 0;
+}
+
+int sidecar_open(ext2_fs *fs, const char *path, int build) {
+   if (!load_index(fs, path))
+      return 0;
+   if (!build || (errno != ENOENT && errno != ESTALE && errno != EINVAL))
+      return -1;
+
+   // build from the image itself, not from whatever is attached
+   sidecar_close(fs);
+   if (sidecar_build(fs, path))
+      return -1;
+   return load_index(fs, path);
+}
+
+void sidecar_close(ext2_fs *fs) {
+   if (!fs->sidecar)
+      return;
+
+   munmap(fs->sidecar->map, fs->sidecar->size);
+   pthread_mutex_destroy(&fs->sidecar->lock);
+   free(fs->sidecar->copies);
+   free(fs->sidecar->copied);
+   free(fs->sidecar);
+   fs->sidecar = NULL;
+}
+
+/*
+ * Returns the record of inode |ino_num| in |sc|, or NULL
+ */
+static const index_record *find_record(struct sidecar *sc,
+      uint32_t ino_num) {
+   uint32_t lo = 0, hi = sc->header->inode_count, mid;
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (sc->inodes[mid].ino < ino_num)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   if (lo == sc->header->inode_count || sc->inodes[lo].ino != ino_num)
+      return NULL;
+   return &sc->inodes[lo];
+}
+
+/*
+ * Returns nonzero if the runs or i_block copy |rec| points to lie inside
+ * their sections of |sc|
+ */
+static int in_bounds(struct sidecar *sc, const index_record *rec) {
+   if (rec->first_run != SIDECAR_NO_RUNS
+         && (rec->first_run > sc->header->run_count
+         || rec->run_count > sc->header->run_count - rec->first_run))
+      return 0;
+   return rec->first_block == SIDECAR_NO_BLOCKS
+         || rec->first_block < sc->header->block_count;
+}
+
+/*
+ * Rebuilds in |ino|, zeroed, the inode that |rec| was taken from, as far
+ * as readers look at it
+ */
+static void fill_inode(struct sidecar *sc, const index_record *rec,
+      ext2_inode *ino) {
+   ino->i_mode = rec->mode;
+   ino->i_links_count = rec->links_count;
+   ino->i_size = (uint32_t) rec->size;
+   if (S_ISREG(rec->mode))
+      ino->i_dir_acl = (uint32_t) (rec->size >> 32);
+   ino->i_uid = (uint16_t) rec->uid;
+   ino->osd2.linux2.l_i_uid_high = rec->uid >> 16;
+   ino->i_gid = (uint16_t) rec->gid;
+   ino->osd2.linux2.l_i_gid_high = rec->gid >> 16;
+   ino->i_atime = rec->atime;
+   ino->i_ctime = rec->ctime;
+   ino->i_mtime = rec->mtime;
+   ino->i_blocks = rec->blocks;
+   ino->i_flags = rec->flags;
+   ino->i_file_acl = rec->file_acl;
+   if (rec->first_block != SIDECAR_NO_BLOCKS)
+      memcpy(ino->i_block, sc->blocks[rec->first_block], sizeof(block_copy));
+}
+
+ext2_inode *sidecar_inode(ext2_fs *fs, uint32_t ino_num) {
+   struct sidecar *sc = fs->sidecar;
+   const index_record *rec;
+   size_t index;
+   uint8_t state;
+
+   if (!sc || !(rec = find_record(sc, ino_num)))
+      return NULL;
+
+   // filled in once, after checking the record, then only read
+   index = rec - sc->inodes;
+   state = __atomic_load_n(&sc->copied[index], __ATOMIC_ACQUIRE);
+   if (state == COPY_UNCHECKED) {
+      pthread_mutex_lock(&sc->lock);
+      state = sc->copied[index];
+      if (state == COPY_UNCHECKED) {
+         state = in_bounds(sc, rec)
+               && rec->sum == record_sum(rec, sc->runs, sc->blocks)
+               ? COPY_FILLED : COPY_DAMAGED;
+         if (state == COPY_FILLED)
+            fill_inode(sc, rec, &sc->copies[index]);
+         __atomic_store_n(&sc->copied[index], state, __ATOMIC_RELEASE);
+      }
+      pthread_mutex_unlock(&sc->lock);
+   }
+   // a damaged record is left alone, the inode table is read instead
+   return state == COPY_FILLED ? &sc->copies[index] : NULL;
+}
+
+int sidecar_lookup(ext2_fs *fs, uint32_t dir_ino, const char *name,
+      size_t len, uint32_t *ino_num) {
+   struct sidecar *sc = fs->sidecar;
+   const sidecar_header *h;
+   const index_record *dir;
+   const sidecar_entry *e;
+   uint32_t hash, slot, mask, probes;
+
+   if (!sc || !(dir = find_record(sc, dir_ino)) || !S_ISDIR(dir->mode))
+      return 0;
+
+   h = sc->header;
+   hash = hash_entry(dir_ino, name, len);
+   mask = h->slot_count - 1;
+   for (slot = hash & mask, probes = 0; sc->slots[slot];
+         slot = (slot + 1) & mask) {
+      // a damaged table answers nothing, the image is read instead
+      if (sc->slots[slot] > h->entry_count || ++probes > h->slot_count)
+         return 0;
+      e = &sc->entries[sc->slots[slot] - 1];
+      if (e->name > h->names_size || e->name_len > h->names_size - e->name)
+         return 0;
+      if (e->hash == hash && e->parent == dir_ino && e->name_len == len
+            && names_equal(sc->names + e->name, name, len)) {
+         if (e->sum != entry_sum(e, sc->names))
+            return 0;
+         *ino_num = e->ino;
+         return 1;
+      }
+   }
+
+   // a damaged slot could hide the entry, so only the image says it's
+   // missing
+   return 0;
+}
+
+const extent *sidecar_runs(ext2_fs *fs, ext2_inode *ino, uint32_t *count) {
+   struct sidecar *sc = fs->sidecar;
+   const index_record *rec;
+   size_t index;
+
+   // only copies handed out by sidecar_inode() point into |copies|, and
+   // only for records checked against their checksum
+   if (!sc || ino < sc->copies || ino >= sc->copies + sc->header->inode_count)
+      return NULL;
+   index = ino - sc->copies;
+   if (&sc->copies[index] != ino)
+      return NULL;
+   rec = &sc->inodes[index];
+   if (rec->first_run == SIDECAR_NO_RUNS)
+      return NULL;
+
+   *count = rec->run_count;
+   return sc->runs + rec->first_run;
+}
@@ -0,0 +1,79 @@
+/*
+ * sidecar.h
+ *
+ * Persistent index of a read-only image, kept in a file next to it (by
+ * default <image>.idx). It holds the inode fields readers use (mode, size,
+ * owner, times, link count, flags) of every inode reachable from the root,
+ * the block runs of every file and directory, and a hash table of every
+ * directory entry keyed by (parent inode, name). The file is mapped
+ * read-only and used in place: once attached to a handle, get_inode(),
+ * dir_lookup() and block_iter answer from it without touching inode
+ * tables, directory blocks or pointer blocks.
+ *
+ * An index is only used if it was built from the same image as it is now:
+ * the superblock's uuid, write and mount times, block count and free
+ * counts must match. The header, each inode record (with its runs) and each
+ * directory entry (with its name) carry their own checksum. Opening the
+ * index only reads and checks the header; a record or entry is checked the
+ * first time it is used, and one that fails is ignored in favor of the
+ * image, as is anything a lookup finds out of bounds.
+ */
+
+#ifndef SIDECAR_H_
+#define SIDECAR_H_
+
+#include "ext2.h"
+#include "blockmap.h"
+
+#define SIDECAR_SUFFIX ".idx"
+
+struct sidecar;
+
+/*
+ * Walks the whole tree of |fs| from the root and writes its index to
+ * |path|, replacing any index already there only once the new one is
+ * complete. Returns 0 on success, -1 with errno set otherwise.
+ */
+int sidecar_build(ext2_fs *fs, const char *path);
+
+/*
+ * Maps the index at |path| and attaches it to |fs|. If it is missing,
+ * stale or damaged and |build| is nonzero, it is rebuilt first. Fails with
+ * ENOENT if there is no index, ESTALE if it belongs to another image or to
+ * an earlier state of this one, and EINVAL if it is damaged. Must be called
+ * before |fs| is used from several threads.
+ */
+int sidecar_open(ext2_fs *fs, const char *path, int build);
+
+/*
+ * Detaches and unmaps the index of |fs|, if any. Called by close_image().
+ */
+void sidecar_close(ext2_fs *fs);
+
+/*
+ * Returns inode |ino_num| of |fs| rebuilt from its record, which
+ * sidecar_runs() recognizes, or NULL if the index doesn't hold it, its
+ * record fails its checksum or there is no index. Only the fields readers
+ * use are filled in; i_block is left zero for files and directories, whose
+ * runs replace it. Called by get_inode() before it loads any inode table.
+ */
+ext2_inode *sidecar_inode(ext2_fs *fs, uint32_t ino_num);
+
+/*
+ * Looks up the |len| bytes at |name| in directory |dir_ino| of |fs|,
+ * storing the inode number found in |*ino_num|. Returns 1 if the index
+ * found it, 0 if it didn't or |dir_ino| isn't an indexed directory, in
+ * which case the directory itself has to be searched.
+ */
+int sidecar_lookup(ext2_fs *fs, uint32_t dir_ino, const char *name,
+      size_t len, uint32_t *ino_num);
+
+/*
+ * Returns the runs of |ino| if it is a file or directory returned by
+ * sidecar_inode(), storing their number in |*count|.
+ * The runs cover the file up to i_size, as iter_next() returns them.
+ * Returns NULL otherwise.
+ */
+const extent *sidecar_runs(ext2_fs *fs, ext2_inode *ino, uint32_t *count);
+
+#endif /* SIDECAR_H_ */
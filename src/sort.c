@@ -0,0 +1,157 @@
+/*
+ * sort.c
+ *
+ * Multikey quicksort and radix sort over index permutations, see sort.h
+ */
+
+#include <string.h>
+#include "sort.h"
+
+typedef struct sort_item {
+   const unsigned char *name;
+   uint32_t index;
+} sort_item;
+
+sort_key parse_sort_key(const char *name) {
+   if (!strcmp(name, "name"))
+      return SORT_NAME;
+   if (!strcmp(name, "size"))
+      return SORT_SIZE;
+   if (!strcmp(name, "inode"))
+      return SORT_INODE;
+   if (!strcmp(name, "type"))
+      return SORT_TYPE;
+   return SORT_NONE;
+}
+
+static void swap_items(sort_item *a, sort_item *b) {
+   sort_item t = *a;
+   *a = *b;
+   *b = t;
+}
+
+/*
+ * Insertion sort of |n| items whose first |depth| characters are equal
+ */
+static void insertion_sort(sort_item *items, size_t n, size_t depth) {
+   size_t i, j;
+
+   for (i = 1; i < n; i++)
+      for (j = i; j && strcmp((const char *) items[j - 1].name + depth,
+            (const char *) items[j].name + depth) > 0; j--)
+         swap_items(&items[j - 1], &items[j]);
+}
+
+static unsigned char median_of_three(unsigned char a, unsigned char b,
+      unsigned char c) {
+   if (a < b)
+      return b < c ? b : a < c ? c : a;
+   return a < c ? a : b < c ? c : b;
+}
+
+/*
+ * Multikey quicksort of |n| items whose first |depth| characters are equal.
+ * Items are split three ways on their character at |depth|; only the equal
+ * part moves on to the next character.
+ */
+static void multikey_sort(sort_item *items, size_t n, size_t depth) {
+   size_t lt, i, gt;
+   unsigned char pivot, c;
+
+   while (n > SORT_INSERTION_MAX) {
+      pivot = median_of_three(items[0].name[depth], items[n / 2].name[depth],
+            items[n - 1].name[depth]);
+
+      for (lt = 0, i = 0, gt = n; i < gt;) {
+         c = items[i].name[depth];
+         if (c < pivot)
+            swap_items(&items[lt++], &items[i++]);
+         else if (c > pivot)
+            swap_items(&items[i], &items[--gt]);
+         else
+            i++;
+      }
+
+      multikey_sort(items, lt, depth);
+      // names that ended at |depth| are all equal
+      if (pivot)
+         multikey_sort(items + lt, gt - lt, depth + 1);
+
+      items += gt;
+      n -= gt;
+   }
+
+   insertion_sort(items, n, depth);
+}
+
+int sort_names(const char *names, const uint32_t *offsets, uint32_t *order,
+      size_t count) {
+   sort_item *items = malloc(count * sizeof(sort_item));
+   size_t i;
+
+   if (!items && count)
+      return -1;
+
+   for (i = 0; i < count; i++) {
+      items[i].name = (const unsigned char *) names + offsets[i];
+      items[i].index = i;
+   }
+
+   multikey_sort(items, count, 0);
+
+   for (i = 0; i < count; i++)
+      order[i] = items[i].index;
+
+   free(items);
+   return 0;
+}
+
+int sort_keys(const off_t *keys, uint32_t *order, size_t count) {
+   uint32_t *src = order, *dst, *t;
+   size_t counts[256], i, sum, n;
+   unsigned long long differ = 0, first;
+   int shift;
+
+   if (count < 2)
+      return 0;
+
+   // bytes that are the same in every key don't need a pass
+   first = keys[order[0]];
+   for (i = 1; i < count; i++)
+      differ |= (unsigned long long) keys[order[i]] ^ first;
+   if (!differ)
+      return 0;
+
+   dst = malloc(count * sizeof(uint32_t));
+   if (!dst)
+      return -1;
+
+   for (shift = 0; shift < 64; shift += 8) {
+      if (!(differ >> shift & 0xff))
+         continue;
+
+      memset(counts, 0, sizeof(counts));
+      for (i = 0; i < count; i++)
+         counts[(unsigned long long) keys[src[i]] >> shift & 0xff]++;
+      for (i = 0, sum = 0; i < 256; i++) {
+         n = counts[i];
+         counts[i] = sum;
+         sum += n;
+      }
+      for (i = 0; i < count; i++)
+         dst[counts[(unsigned long long) keys[src[i]] >> shift & 0xff]++] =
+               src[i];
+
+      t = src;
+      src = dst;
+      dst = t;
+   }
+
+   if (src != order) {
+      memcpy(order, src, count * sizeof(uint32_t));
+      free(src);
+   }
+   else
+      free(dst);
+   return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * sort.h
+ *
+ * Sorting for large listings. Entries are never moved: a permutation of
+ * their indexes is sorted instead. Names are ordered with a multikey
+ * quicksort, which looks at each character of a shared prefix only once
+ * instead of re-comparing whole strings, and numeric keys with a stable
+ * LSD radix sort that skips the bytes every key has in common.
+ */
+
+#ifndef SORT_H_
+#define SORT_H_
+
+#include <sys/types.h>
+#include "ext2.h"
+
+#define SORT_INSERTION_MAX 16 /* below this many items use insertion sort */
+
+typedef enum sort_key {
+   SORT_NONE, SORT_NAME, SORT_SIZE, SORT_INODE, SORT_TYPE
+} sort_key;
+
+/*
+ * Parses a sort key name ("name", "size", "inode" or "type"). Returns
+ * SORT_NONE for anything else.
+ */
+sort_key parse_sort_key(const char *name);
+
+/*
+ * Stores in |order| the indexes 0..|count|-1 sorted by the NUL terminated
+ * strings at |names| + |offsets|[i], in byte order. Returns 0 on success,
+ * -1 if memory ran out.
+ */
+int sort_names(const char *names, const uint32_t *offsets, uint32_t *order,
+      size_t count);
+
+/*
+ * Stably reorders the |count| indexes in |order| by |keys|[index], which
+ * must not be negative. Returns 0 on success, -1 if memory ran out.
+ */
+int sort_keys(const off_t *keys, uint32_t *order, size_t count);
+
+#endif /* SORT_H_ */
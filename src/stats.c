@@ -0,0 +1,153 @@
+/*
+ * stats.c
+ *
+ * I/O counters and latency histograms, see stats.h
+ */
+
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+#include "ext2.h"
+#include "cache.h"
+
+static const char *op_names[STATS_OPS] = { "resolve", "list", "read" };
+
+void stats_read(io_stats *stats, size_t size) {
+   STATS_ADD(stats->read_calls, 1);
+   STATS_ADD(stats->bytes_read, size);
+}
+
+void stats_device_read(io_stats *stats, off_t pos, size_t size) {
+   STATS_ADD(stats->device_reads, 1);
+   STATS_ADD(stats->device_bytes, size);
+   if (__atomic_exchange_n(&stats->next_pos, pos + (off_t) size,
+         __ATOMIC_RELAXED) != pos)
+      STATS_ADD(stats->seeks, 1);
+}
+
+unsigned long stats_now(void) {
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return now.tv_sec * 1000000UL + now.tv_nsec / 1000;
+}
+
+void stats_record(io_stats *stats, stats_op op, unsigned long start) {
+   latency_hist *hist = &stats->latency[op];
+   unsigned long us = stats_now() - start, max;
+   int bucket = us ? 64 - __builtin_clzl(us) : 0;
+
+   if (bucket >= STATS_BUCKETS)
+      bucket = STATS_BUCKETS - 1;
+
+   STATS_ADD(hist->count, 1);
+   STATS_ADD(hist->total_us, us);
+   STATS_ADD(hist->buckets[bucket], 1);
+
+   max = __atomic_load_n(&hist->max_us, __ATOMIC_RELAXED);
+   while (us > max && !__atomic_compare_exchange_n(&hist->max_us, &max, us,
+         1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+}
+
+/*
+ * Returns the upper bound in microseconds of the bucket holding the
+ * |pct|th percentile of |hist|
+ */
+static unsigned long percentile(const latency_hist *hist, int pct) {
+   unsigned long seen = 0, rank = (hist->count * pct + 99) / 100;
+   int i;
+
+   for (i = 0; i < STATS_BUCKETS; i++) {
+      seen += hist->buckets[i];
+      if (seen >= rank)
+         break;
+   }
+   return 1UL << i;
+}
+
+/*
+ * Returns the peak resident set size of the process in KiB
+ */
+static long peak_memory(void) {
+   struct rusage usage;
+
+   return getrusage(RUSAGE_SELF, &usage) ? 0 : usage.ru_maxrss;
+}
+
+static void print_text(ext2_fs *fs, FILE *out) {
+   const io_stats *stats = &fs->stats;
+   const latency_hist *hist;
+   int op, i;
+
+   if (fs->map)
+      fprintf(out, "\ncache: image is memory-mapped\n");
+   else
+      cache_print_stats(fs->cache, out);
+   fprintf(out, "io: %lu reads (%lu bytes), %lu device reads (%lu bytes), "
+         "%lu seeks\n", stats->read_calls, stats->bytes_read,
+         stats->device_reads, stats->device_bytes, stats->seeks);
+   fprintf(out, "metadata: %lu inode fetches, %lu directory block fetches\n",
+         stats->inode_fetches, stats->dir_block_fetches);
+
+   for (op = 0; op < STATS_OPS; op++) {
+      hist = &stats->latency[op];
+      if (!hist->count)
+         continue;
+
+      fprintf(out, "%s: %lu calls, mean %lu us, max %lu us, p50 < %lu us, "
+            "p99 < %lu us\n", op_names[op], hist->count,
+            hist->total_us / hist->count, hist->max_us, percentile(hist, 50),
+            percentile(hist, 99));
+      for (i = 0; i < STATS_BUCKETS; i++)
+         if (hist->buckets[i])
+            fprintf(out, "   < %10lu us: %lu\n", 1UL << i, hist->buckets[i]);
+   }
+
+   fprintf(out, "peak memory: %ld KiB\n", peak_memory());
+}
+
+static void print_json(ext2_fs *fs, FILE *out) {
+   const io_stats *stats = &fs->stats;
+   const latency_hist *hist;
+   cache_stats cache = cache_get_stats(fs->cache);
+   int op, i, first;
+
+   fprintf(out, "{\"read_calls\":%lu,\"bytes_read\":%lu,\"device_reads\":%lu,"
+         "\"device_bytes\":%lu,\"seeks\":%lu,\"inode_fetches\":%lu,"
+         "\"dir_block_fetches\":%lu,", stats->read_calls, stats->bytes_read,
+         stats->device_reads, stats->device_bytes, stats->seeks,
+         stats->inode_fetches, stats->dir_block_fetches);
+   fprintf(out, "\"mmap\":%s,\"cache\":{\"enabled\":%s,\"hits\":%lu,"
+         "\"misses\":%lu,\"evictions\":%lu,\"promotions\":%lu},",
+         fs->map ? "true" : "false", fs->cache ? "true" : "false", cache.hits,
+         cache.misses, cache.evictions, cache.promotions);
+
+   fprintf(out, "\"latency\":{");
+   for (op = 0; op < STATS_OPS; op++) {
+      hist = &stats->latency[op];
+      fprintf(out, "%s\"%s\":{\"count\":%lu,\"total_us\":%lu,\"max_us\":%lu,"
+            "\"p50_us\":%lu,\"p99_us\":%lu,\"buckets\":{", op ? "," : "",
+            op_names[op], hist->count, hist->total_us, hist->max_us,
+            hist->count ? percentile(hist, 50) : 0,
+            hist->count ? percentile(hist, 99) : 0);
+
+      // keyed by each bucket's upper bound in microseconds
+      for (i = 0, first = 1; i < STATS_BUCKETS; i++)
+         if (hist->buckets[i]) {
+            fprintf(out, "%s\"%lu\":%lu", first ? "" : ",", 1UL << i,
+                  hist->buckets[i]);
+            first = 0;
+         }
+      fprintf(out, "}}");
+   }
+
+   fprintf(out, "},\"peak_rss_kb\":%ld}\n", peak_memory());
+}
+
+void stats_print(ext2_fs *fs, FILE *out, int json) {
+   if (json)
+      print_json(fs, out);
+   else
+      print_text(fs, out);
+}
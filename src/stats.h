@@ -0,0 +1,81 @@
+/*
+ * stats.h
+ *
+ * I/O counters and per-operation latency histograms of an open image.
+ * Every ext2_fs carries an io_stats that the read paths update as they go;
+ * the counters are bumped with relaxed atomics so parallel walks and
+ * restores can share them. Latencies are kept in power-of-two microsecond
+ * buckets.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#define STATS_BUCKETS 32 /* bucket i holds latencies below 2^i us */
+
+/*
+ * Adds |n| to the counter |field| from any thread
+ */
+#define STATS_ADD(field, n) __atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED)
+
+typedef enum stats_op {
+   STATS_RESOLVE, /* path resolution */
+   STATS_LIST, /* scanning and listing a directory */
+   STATS_READ, /* dumping, extracting or restoring a file */
+   STATS_OPS
+} stats_op;
+
+typedef struct latency_hist {
+   unsigned long count;
+   unsigned long total_us;
+   unsigned long max_us;
+   unsigned long buckets[STATS_BUCKETS];
+} latency_hist;
+
+typedef struct io_stats {
+   unsigned long read_calls; /* reads requested through read_data() & co. */
+   unsigned long bytes_read;
+   unsigned long device_reads; /* reads that reached the image file */
+   unsigned long device_bytes;
+   unsigned long seeks; /* device reads not starting where the last ended */
+   off_t next_pos; /* where the last device read ended */
+   unsigned long inode_fetches;
+   unsigned long dir_block_fetches;
+   latency_hist latency[STATS_OPS];
+} io_stats;
+
+struct ext2_fs;
+
+/*
+ * Counts a read of |size| bytes requested by a caller
+ */
+void stats_read(io_stats *stats, size_t size);
+
+/*
+ * Counts a read of |size| bytes at |pos| issued against the image file,
+ * and a seek if it doesn't continue the previous one
+ */
+void stats_device_read(io_stats *stats, off_t pos, size_t size);
+
+/*
+ * Returns a monotonic timestamp in microseconds, to pass to stats_record()
+ */
+unsigned long stats_now(void);
+
+/*
+ * Adds the time elapsed since |start| (from stats_now()) to the histogram
+ * of |op|
+ */
+void stats_record(io_stats *stats, stats_op op, unsigned long start);
+
+/*
+ * Prints the counters, cache statistics, latency histograms and peak
+ * memory of |fs| to |out|, as text or, if |json| is nonzero, as a single
+ * JSON object
+ */
+void stats_print(struct ext2_fs *fs, FILE *out, int json);
+
+#endif /* STATS_H_ */
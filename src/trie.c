@@ -0,0 +1,178 @@
+/*
+ * trie.c
+ *
+ * Path component trie, see trie.h
+ */
+
+#include <string.h>
+#include "trie.h"
+
+#define TRIE_MIN_SLOTS 64
+
+static uint32_t hash_child(uint32_t parent, const char *name, size_t len) {
+   uint32_t h = 2166136261u ^ parent;
+   size_t i;
+
+   // FNV-1a over the parent index and the name
+   for (i = 0; i < len; i++)
+      h = (h ^ (uint8_t) name[i]) * 16777619u;
+   return h ^ (h >> 15);
+}
+
+/*
+ * Returns the slot holding the child of |parent| named |name|, or the empty
+ * slot where it would go
+ */
+static uint32_t *find_slot(path_trie *trie, uint32_t parent, const char *name,
+      size_t len) {
+   uint32_t i = hash_child(parent, name, len) & trie->slot_mask;
+   trie_node *node;
+
+   for (;; i = (i + 1) & trie->slot_mask) {
+      if (!trie->slots[i])
+         return &trie->slots[i];
+
+      node = &trie->nodes[trie->slots[i] - 1];
+      if (node->parent == parent && node->name_len == len
+            && !memcmp(trie->names + node->name, name, len))
+         return &trie->slots[i];
+   }
+}
+
+static int grow_slots(path_trie *trie) {
+   uint32_t *old = trie->slots;
+   uint32_t old_mask = trie->slot_mask, i;
+   trie_node *node;
+
+   trie->slot_mask = old_mask * 2 + 1;
+   trie->slots = calloc(trie->slot_mask + 1, sizeof(uint32_t));
+   if (!trie->slots) {
+      trie->slots = old;
+      trie->slot_mask = old_mask;
+      return -1;
+   }
+
+   for (i = 0; i <= old_mask; i++) {
+      if (!old[i])
+         continue;
+      node = &trie->nodes[old[i] - 1];
+      *find_slot(trie, node->parent, trie->names + node->name, node->name_len) =
+            old[i];
+   }
+
+   free(old);
+   return 0;
+}
+
+/*
+ * Appends a child named |name| under |parent| and returns its index
+ */
+static uint32_t add_child(path_trie *trie, uint32_t parent, const char *name,
+      size_t len) {
+   trie_node *node;
+   uint32_t idx;
+
+   if ((trie->count + 1) * 2 > trie->slot_mask + 1 && grow_slots(trie))
+      return TRIE_NONE;
+
+   if (trie->count == trie->capacity) {
+      size_t capacity = trie->capacity * 2;
+      trie_node *nodes = realloc(trie->nodes, capacity * sizeof(trie_node));
+      if (!nodes)
+         return TRIE_NONE;
+      trie->nodes = nodes;
+      trie->capacity = capacity;
+   }
+
+   while (trie->names_len + len > trie->names_cap) {
+      char *names = realloc(trie->names, trie->names_cap * 2);
+      if (!names)
+         return TRIE_NONE;
+      trie->names = names;
+      trie->names_cap *= 2;
+   }
+
+   idx = trie->count++;
+   node = &trie->nodes[idx];
+   memset(node, 0, sizeof(trie_node));
+   node->parent = parent;
+   node->first_child = TRIE_NONE;
+   node->name = trie->names_len;
+   node->name_len = len;
+   memcpy(trie->names + trie->names_len, name, len);
+   trie->names_len += len;
+
+   node->next_sibling = trie->nodes[parent].first_child;
+   trie->nodes[parent].first_child = idx;
+   trie->nodes[parent].child_count++;
+
+   *find_slot(trie, parent, name, len) = idx + 1;
+   return idx;
+}
+
+path_trie *trie_create(void) {
+   path_trie *trie = calloc(1, sizeof(path_trie));
+
+   if (!trie)
+      return NULL;
+
+   trie->capacity = 64;
+   trie->names_cap = 1024;
+   trie->slot_mask = TRIE_MIN_SLOTS - 1;
+   trie->nodes = malloc(trie->capacity * sizeof(trie_node));
+   trie->names = malloc(trie->names_cap);
+   trie->slots = calloc(TRIE_MIN_SLOTS, sizeof(uint32_t));
+   if (!trie->nodes || !trie->names || !trie->slots) {
+      trie_destroy(trie);
+      return NULL;
+   }
+
+   // the root has no name and is never found through the hash table
+   memset(&trie->nodes[TRIE_ROOT], 0, sizeof(trie_node));
+   trie->nodes[TRIE_ROOT].first_child = TRIE_NONE;
+   trie->nodes[TRIE_ROOT].inode = EXT2_ROOT_INO;
+   trie->count = 1;
+   return trie;
+}
+
+void trie_destroy(path_trie *trie) {
+   if (!trie)
+      return;
+
+   free(trie->nodes);
+   free(trie->names);
+   free(trie->slots);
+   free(trie);
+}
+
+uint32_t trie_insert(path_trie *trie, const char *path) {
+   uint32_t node = TRIE_ROOT, child;
+   const char *end;
+   size_t len;
+
+   while (*path) {
+      while (*path == '/')
+         path++;
+      for (end = path; *end && *end != '/'; end++)
+         ;
+
+      len = end - path;
+      if (len && !(len == 1 && *path == '.')) {
+         child = trie_child(trie, node, path, len);
+         if (child == TRIE_NONE)
+            child = add_child(trie, node, path, len);
+         if (child == TRIE_NONE)
+            return TRIE_NONE;
+         node = child;
+      }
+      path = end;
+   }
+
+   return node;
+}
+
+uint32_t trie_child(path_trie *trie, uint32_t parent, const char *name,
+      size_t len) {
+   uint32_t slot = *find_slot(trie, parent, name, len);
+   return slot ? slot - 1 : TRIE_NONE;
+}
@@ -0,0 +1,65 @@
+/*
+ * trie.h
+ *
+ * Prefix trie over path components. Every distinct directory prefix of the
+ * inserted paths is stored once, so a batch of paths sharing parents can be
+ * resolved by reading each of those parents a single time. Children are
+ * found through one hash table keyed on (parent node, name) so lookups stay
+ * O(1) however many siblings a directory has.
+ */
+
+#ifndef TRIE_H_
+#define TRIE_H_
+
+#include "ext2.h"
+
+#define TRIE_ROOT 0
+#define TRIE_NONE ((uint32_t) -1)
+
+typedef struct trie_node {
+   uint32_t parent;
+   uint32_t first_child;
+   uint32_t next_sibling;
+   uint32_t child_count;
+   uint32_t name; /* offset of the component in the trie's name arena */
+   uint32_t name_len;
+   uint32_t inode; /* set while resolving, 0 if not (yet) found */
+} trie_node;
+
+typedef struct path_trie {
+   trie_node *nodes;
+   size_t count;
+   size_t capacity;
+   char *names;
+   size_t names_len;
+   size_t names_cap;
+   uint32_t *slots; /* node index + 1, 0 for an empty slot */
+   uint32_t slot_mask;
+} path_trie;
+
+/*
+ * Creates a trie holding only the root directory. Returns NULL if memory ran
+ * out.
+ */
+path_trie *trie_create(void);
+
+/*
+ * Frees |trie| and all of its nodes
+ */
+void trie_destroy(path_trie *trie);
+
+/*
+ * Inserts the '/'-separated |path| (empty components and "." are ignored)
+ * and returns the index of its final node, TRIE_ROOT for "/" or TRIE_NONE if
+ * memory ran out
+ */
+uint32_t trie_insert(path_trie *trie, const char *path);
+
+/*
+ * Returns the index of the child of |parent| named by the |len| bytes at
+ * |name|, or TRIE_NONE if there is no such child
+ */
+uint32_t trie_child(path_trie *trie, uint32_t parent, const char *name,
+      size_t len);
+
+#endif /* TRIE_H_ */
@@ -0,0 +1,426 @@
+/*
+ * usage.c
+ *
+ * Bitmap based usage report, see usage.h
+ */
+
+#include <string.h>
+#include "usage.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+typedef unsigned long long bitmap_word;
+
+/*
+ * What one thread found in one group. Runs touching either end of the
+ * group are kept apart in |lead| and |trail| so they can be joined with the
+ * neighbouring groups; only the runs inside the group are bucketed here.
+ */
+typedef struct group_scan {
+   group_usage usage;
+   uint32_t lead; /* free blocks at the start of the group */
+   uint32_t trail; /* free blocks at its end */
+   uint32_t largest_inner; /* longest run touching neither end */
+   uint32_t run_counts[USAGE_BUCKETS];
+   uint32_t run_blocks[USAGE_BUCKETS];
+} group_scan;
+
+typedef struct usage_job {
+   ext2_fs *fs;
+   group_scan *scans;
+   uint32_t next_group; /* claimed by the threads */
+   int out_of_memory;
+} usage_job;
+
+static uint32_t count_scalar(const bitmap_word *words, size_t count) {
+   uint32_t bits = 0;
+
+   while (count--)
+      bits += __builtin_popcountll(*words++);
+   return bits;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("popcnt")))
+static uint32_t count_popcnt(const bitmap_word *words, size_t count) {
+   uint32_t bits = 0;
+
+   while (count--)
+      bits += __builtin_popcountll(*words++);
+   return bits;
+}
+
+/*
+ * Counts each nibble through a 16 entry table and sums the bytes of every
+ * 64-bit lane with a sum of absolute differences
+ */
+__attribute__((target("avx2,popcnt")))
+static uint32_t count_avx2(const bitmap_word *words, size_t count) {
+   const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2,
+         3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+   const __m256i low = _mm256_set1_epi8(0x0f);
+   __m256i sums = _mm256_setzero_si256(), v, bytes;
+   uint32_t bits;
+
+   for (; count >= 4; words += 4, count -= 4) {
+      v = _mm256_loadu_si256((const __m256i *) words);
+      bytes = _mm256_add_epi8(
+            _mm256_shuffle_epi8(table, _mm256_and_si256(v, low)),
+            _mm256_shuffle_epi8(table,
+                  _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+      sums = _mm256_add_epi64(sums,
+            _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+   }
+
+   bits = _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+         + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+   while (count--)
+      bits += __builtin_popcountll(*words++);
+   return bits;
+}
+#endif
+
+static uint32_t (*count_kernel)(const bitmap_word *, size_t) = count_scalar;
+static const char *kernel_name = "scalar";
+
+/*
+ * Picks the widest kernel the CPU supports before main() runs, so the
+ * choice never races with the worker threads
+ */
+__attribute__((constructor))
+static void pick_kernel(void) {
+#ifdef HAVE_X86_KERNELS
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+      count_kernel = count_avx2;
+      kernel_name = "avx2";
+   }
+   else if (__builtin_cpu_supports("popcnt")) {
+      count_kernel = count_popcnt;
+      kernel_name = "popcnt";
+   }
+#endif
+}
+
+const char *usage_kernel(void) {
+   return kernel_name;
+}
+
+/*
+ * Returns the 64 bits of |map| from bit 64 * |index| on, zero past |nbits|
+ */
+static bitmap_word load_word(const uint8_t *map, uint32_t index,
+      uint32_t nbits) {
+   uint32_t bits = nbits - index * 64;
+   bitmap_word word = 0;
+
+   if (bits >= 64) {
+      memcpy(&word, map + index * 8, 8);
+      return word;
+   }
+   memcpy(&word, map + index * 8, (bits + 7) / 8);
+   return word & ((1ULL << bits) - 1);
+}
+
+/*
+ * Returns the number of set bits among the first |nbits| of |map|
+ */
+static uint32_t count_bits(const uint8_t *map, uint32_t nbits) {
+   uint32_t words = nbits / 64;
+   bitmap_word tail[1];
+
+   // |map| comes from a block buffer or the mapping, so it is aligned
+   if (nbits % 64 == 0)
+      return count_kernel((const bitmap_word *) map, words);
+
+   tail[0] = load_word(map, words, nbits);
+   return count_kernel((const bitmap_word *) map, words)
+         + count_scalar(tail, 1);
+}
+
+static int bucket_of(uint32_t len) {
+   return 31 - __builtin_clz(len);
+}
+
+/*
+ * Files the run of |len| free blocks at bit |start| of a group of |nbits|
+ */
+static void end_run(group_scan *scan, uint32_t start, uint32_t len,
+      uint32_t nbits) {
+   int inner = 1;
+
+   scan->usage.free_runs++;
+   if (len > scan->usage.largest_run)
+      scan->usage.largest_run = len;
+
+   if (!start) {
+      scan->lead = len;
+      inner = 0;
+   }
+   if (start + len == nbits) {
+      scan->trail = len;
+      inner = 0;
+   }
+   if (inner) {
+      scan->run_counts[bucket_of(len)]++;
+      scan->run_blocks[bucket_of(len)] += len;
+      if (len > scan->largest_inner)
+         scan->largest_inner = len;
+   }
+}
+
+/*
+ * Splits the clear bits among the first |nbits| of the block bitmap |map|
+ * into runs, a 64-bit word at a time: fully used and fully free words are
+ * taken whole, mixed ones are walked run by run with count trailing zeros
+ */
+static void scan_runs(const uint8_t *map, uint32_t nbits, group_scan *scan) {
+   uint32_t pos, bits, b, n, run = 0, start = 0;
+   bitmap_word word, clear, rest;
+
+   for (pos = 0; pos < nbits; pos += bits) {
+      bits = nbits - pos < 64 ? nbits - pos : 64;
+      word = load_word(map, pos / 64, nbits);
+      clear = bits < 64 ? ~word & ((1ULL << bits) - 1) : ~word;
+
+      if (!clear) {
+         if (run)
+            end_run(scan, start, run, nbits);
+         run = 0;
+         continue;
+      }
+      if (bits == 64 && clear == ~0ULL) {
+         if (!run)
+            start = pos;
+         run += 64;
+         continue;
+      }
+
+      for (b = 0; b < bits; b += n) {
+         rest = clear >> b;
+         if (rest & 1) {
+            n = __builtin_ctzll(~rest);
+            if (n > bits - b)
+               n = bits - b;
+            if (!run)
+               start = pos + b;
+            run += n;
+         }
+         else {
+            if (run)
+               end_run(scan, start, run, nbits);
+            run = 0;
+            n = rest ? (uint32_t) __builtin_ctzll(rest) : bits - b;
+         }
+      }
+   }
+
+   if (run)
+      end_run(scan, start, run, nbits);
+}
+
+/*
+ * Counts the bitmaps of group |group| into |scan|, |bitmap| holding a block
+ */
+static void scan_group(ext2_fs *fs, uint32_t group, uint8_t *bitmap,
+      group_scan *scan) {
+   ext2_group_desc *desc = &fs->groups[group];
+   uint32_t first = fs->sb.s_first_data_block
+         + group * fs->sb.s_blocks_per_group;
+   const uint8_t *map;
+
+   memset(scan, 0, sizeof(group_scan));
+
+   // the last group stops at the end of the filesystem
+   scan->usage.blocks = fs->sb.s_blocks_count - first;
+   if (scan->usage.blocks > fs->sb.s_blocks_per_group)
+      scan->usage.blocks = fs->sb.s_blocks_per_group;
+   if (first >= fs->sb.s_blocks_count)
+      scan->usage.blocks = 0;
+   scan->usage.inodes = fs->sb.s_inodes_per_group;
+
+   if (scan->usage.blocks) {
+      map = fetch_range(fs, BLOCK_POS(fs, desc->bg_block_bitmap), bitmap,
+            (scan->usage.blocks + 7) / 8);
+      scan->usage.free_blocks = scan->usage.blocks
+            - count_bits(map, scan->usage.blocks);
+      scan_runs(map, scan->usage.blocks, scan);
+   }
+
+   map = fetch_range(fs, BLOCK_POS(fs, desc->bg_inode_bitmap), bitmap,
+         (scan->usage.inodes + 7) / 8);
+   scan->usage.free_inodes = scan->usage.inodes
+         - count_bits(map, scan->usage.inodes);
+}
+
+/*
+ * Worker thread: claims groups until none are left
+ */
+static void *scan_groups(void *arg) {
+   usage_job *job = arg;
+   uint8_t *bitmap = malloc(job->fs->block_size);
+   uint32_t group;
+
+   if (!bitmap) {
+      job->out_of_memory = 1;
+      return NULL;
+   }
+
+   while ((group = __atomic_fetch_add(&job->next_group, 1, __ATOMIC_RELAXED))
+         < job->fs->group_count)
+      scan_group(job->fs, group, bitmap, &job->scans[group]);
+
+   free(bitmap);
+   return NULL;
+}
+
+static void add_run(usage_report *report, uint32_t len) {
+   if (!len)
+      return;
+
+   report->total.free_runs++;
+   if (len > report->total.largest_run)
+      report->total.largest_run = len;
+   report->run_counts[bucket_of(len)]++;
+   report->run_blocks[bucket_of(len)] += len;
+}
+
+/*
+ * Adds up the groups in order, joining the free runs that cross from one
+ * group into the next
+ */
+static void merge_groups(usage_report *report, group_scan *scans) {
+   group_usage *total = &report->total;
+   uint32_t g, carry = 0;
+   int b;
+
+   for (g = 0; g < report->group_count; g++) {
+      group_scan *scan = &scans[g];
+
+      report->groups[g] = scan->usage;
+      total->blocks += scan->usage.blocks;
+      total->free_blocks += scan->usage.free_blocks;
+      total->inodes += scan->usage.inodes;
+      total->free_inodes += scan->usage.free_inodes;
+
+      if (scan->usage.free_blocks == scan->usage.blocks) {
+         carry += scan->usage.blocks;
+         continue;
+      }
+
+      add_run(report, carry + scan->lead);
+      for (b = 0; b < USAGE_BUCKETS; b++) {
+         report->run_counts[b] += scan->run_counts[b];
+         report->run_blocks[b] += scan->run_blocks[b];
+         total->free_runs += scan->run_counts[b];
+      }
+      if (scan->largest_inner > total->largest_run)
+         total->largest_run = scan->largest_inner;
+      carry = scan->trail;
+   }
+
+   add_run(report, carry);
+}
+
+int compute_usage(ext2_fs *fs, int threads, usage_report *report) {
+   pthread_t workers[USAGE_MAX_THREADS];
+   usage_job job = { 0 };
+   int i, started;
+
+   memset(report, 0, sizeof(usage_report));
+   report->group_count = fs->group_count;
+   report->sb_free_blocks = fs->sb.s_free_blocks_count;
+   report->sb_free_inodes = fs->sb.s_free_inodes_count;
+   report->groups = calloc(fs->group_count, sizeof(group_usage));
+   job.fs = fs;
+   job.scans = calloc(fs->group_count, sizeof(group_scan));
+   if (!report->groups || !job.scans) {
+      free(job.scans);
+      free_usage(report);
+      return -1;
+   }
+
+   if (threads < 1)
+      threads = 1;
+   if (threads > USAGE_MAX_THREADS)
+      threads = USAGE_MAX_THREADS;
+   if ((uint32_t) threads > fs->group_count)
+      threads = fs->group_count ? fs->group_count : 1;
+
+   // the calling thread scans too
+   for (started = 1; started < threads; started++)
+      if (pthread_create(&workers[started], NULL, scan_groups, &job))
+         break;
+   scan_groups(&job);
+   for (i = 1; i < started; i++)
+      pthread_join(workers[i], NULL);
+
+   if (job.out_of_memory) {
+      free(job.scans);
+      free_usage(report);
+      return -1;
+   }
+
+   merge_groups(report, job.scans);
+   free(job.scans);
+   return 0;
+}
+
+/*
+ * Rounded up, as df does
+ */
+static int percent(uint32_t part, uint32_t whole) {
+   return whole ? (int) (((off_t) part * 100 + whole - 1) / whole) : 0;
+}
+
+static void print_row(FILE *out, const char *label, const group_usage *u) {
+   fprintf(out, "%8s %10u %10u %10u %4d%% %10u %10u %10u %8u %8u\n", label,
+         u->blocks, u->blocks - u->free_blocks, u->free_blocks,
+         percent(u->blocks - u->free_blocks, u->blocks), u->inodes,
+         u->inodes - u->free_inodes, u->free_inodes, u->free_runs,
+         u->largest_run);
+}
+
+void print_usage(const usage_report *report, FILE *out) {
+   char label[2 * 10 + 2]; /* "<u32>-<u32>" and its terminator */
+   uint32_t g;
+   int b;
+
+   fprintf(out, "%8s %10s %10s %10s %5s %10s %10s %10s %8s %8s\n", "group",
+         "blocks", "used", "free", "use", "inodes", "used", "free", "runs",
+         "largest");
+   for (g = 0; g < report->group_count; g++) {
+      snprintf(label, sizeof(label), "%u", g);
+      print_row(out, label, &report->groups[g]);
+   }
+   print_row(out, "total", &report->total);
+
+   fprintf(out, "\nsuperblock: %u free blocks, %u free inodes%s\n",
+         report->sb_free_blocks, report->sb_free_inodes,
+         report->sb_free_blocks != report->total.free_blocks
+               || report->sb_free_inodes != report->total.free_inodes
+               ? " (bitmaps differ)" : "");
+
+   fprintf(out, "\nfree runs by length (blocks):\n");
+   for (b = 0; b < USAGE_BUCKETS; b++) {
+      if (!report->run_counts[b])
+         continue;
+      if (b)
+         snprintf(label, sizeof(label), "%u-%u", 1u << b,
+               (uint32_t) ((2ULL << b) - 1));
+      else
+         snprintf(label, sizeof(label), "1");
+      fprintf(out, "%22s %10u runs %12lld blocks %5.1f%%\n", label,
+            report->run_counts[b], (long long) report->run_blocks[b],
+            report->total.free_blocks ? report->run_blocks[b] * 100.0
+                  / report->total.free_blocks : 0.0);
+   }
+}
+
+void free_usage(usage_report *report) {
+   free(report->groups);
+   report->groups = NULL;
+}
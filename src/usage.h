@@ -0,0 +1,67 @@
+/*
+ * usage.h
+ *
+ * Space and inode usage computed from the block and inode bitmaps, in the
+ * manner of df. Each group's bitmaps are read with one positional read
+ * apiece and counted with a popcount kernel (AVX2, POPCNT or scalar,
+ * picked once at startup); free blocks are also split into runs, a word at
+ * a time, to measure how fragmented the free space is. Groups are shared
+ * out between threads, and runs crossing a group boundary are joined when
+ * the groups are merged.
+ */
+
+#ifndef USAGE_H_
+#define USAGE_H_
+
+#include "ext2.h"
+
+#define USAGE_MAX_THREADS 64
+#define USAGE_BUCKETS 32 /* free run lengths, bucket n holding [2^n, 2^n+1) */
+
+/*
+ * Counts for one group, or the whole image
+ */
+typedef struct group_usage {
+   uint32_t blocks;
+   uint32_t free_blocks;
+   uint32_t inodes;
+   uint32_t free_inodes;
+   uint32_t free_runs; /* runs of free blocks */
+   uint32_t largest_run; /* longest of them, in blocks */
+} group_usage;
+
+typedef struct usage_report {
+   group_usage *groups;
+   uint32_t group_count;
+   group_usage total; /* runs joined across group boundaries */
+   uint32_t run_counts[USAGE_BUCKETS]; /* free runs per length bucket */
+   off_t run_blocks[USAGE_BUCKETS]; /* free blocks in those runs */
+   uint32_t sb_free_blocks; /* what the superblock claims, for comparison */
+   uint32_t sb_free_inodes;
+} usage_report;
+
+/*
+ * Fills |report| for the image |fs| using |threads| threads. Returns 0 on
+ * success, -1 if memory ran out. The report must be released with
+ * free_usage().
+ */
+int compute_usage(ext2_fs *fs, int threads, usage_report *report);
+
+/*
+ * Prints a per-group table, the totals and the free run histogram of
+ * |report| to |out|
+ */
+void print_usage(const usage_report *report, FILE *out);
+
+/*
+ * Releases what compute_usage() allocated in |report|
+ */
+void free_usage(usage_report *report);
+
+/*
+ * Returns the name of the popcount kernel picked for this CPU: "avx2",
+ * "popcnt" or "scalar"
+ */
+const char *usage_kernel(void);
+
+#endif /* USAGE_H_ */
@@ -0,0 +1,424 @@
+/*
+ * walk.c
+ *
+ * Parallel recursive tree walk, see walk.h
+ */
+
+#include <string.h>
+#include "walk.h"
+#include "blockmap.h"
+#include "dir.h"
+#include "inode.h"
+
+/*
+ * One directory to scan. Its lines are collected in |text|; in ordered
+ * mode the subdirectory tasks are kept along with the offset in |text|
+ * right after each subdirectory's own line, where its contents go.
+ */
+typedef struct walk_task {
+   uint32_t inode;
+   char *path;
+   size_t path_len;
+   char *text;
+   size_t text_len;
+   size_t text_cap;
+   struct walk_task **children;
+   size_t *child_at;
+   size_t child_count;
+   size_t child_cap;
+} walk_task;
+
+/*
+ * A worker's tasks, in [head, tail). The owner pushes and pops at the tail,
+ * thieves take from the head.
+ */
+typedef struct task_deque {
+   pthread_mutex_t lock;
+   walk_task **tasks;
+   size_t head;
+   size_t tail;
+   size_t capacity;
+} task_deque;
+
+typedef struct walker {
+   ext2_fs *fs;
+   FILE *out;
+   int ordered;
+   const name_filter *filter;
+   int threads;
+   task_deque *deques;
+   pthread_mutex_t out_lock;
+   pthread_mutex_t idle_lock; /* guards the counters below */
+   pthread_cond_t idle_cond;
+   long pending; /* tasks created but not finished */
+   long queued; /* tasks waiting in a deque */
+   int failed;
+} walker;
+
+typedef struct worker {
+   walker *walk;
+   int id;
+   pthread_t thread;
+} worker;
+
+/*
+ * State of the directory scan running in one worker
+ */
+typedef struct scan_state {
+   worker *self;
+   walk_task *task;
+} scan_state;
+
+static walk_task *new_task(uint32_t inode, const char *path, size_t path_len) {
+   walk_task *task = calloc(1, sizeof(walk_task));
+
+   if (!task)
+      return NULL;
+
+   task->path = malloc(path_len + 1);
+   if (!task->path) {
+      free(task);
+      return NULL;
+   }
+
+   memcpy(task->path, path, path_len);
+   task->path[path_len] = '\0';
+   task->path_len = path_len;
+   task->inode = inode;
+   return task;
+}
+
+/*
+ * Extends the path of |task| with "/" and the |len| byte |name|
+ */
+static int append_path(walk_task *task, const char *name, size_t len) {
+   char *path = realloc(task->path, task->path_len + len + 2);
+
+   if (!path)
+      return -1;
+
+   path[task->path_len] = '/';
+   memcpy(path + task->path_len + 1, name, len);
+   task->path_len += len + 1;
+   path[task->path_len] = '\0';
+   task->path = path;
+   return 0;
+}
+
+static void free_task(walk_task *task) {
+   free(task->path);
+   free(task->text);
+   free(task->children);
+   free(task->child_at);
+   free(task);
+}
+
+static int push_task(task_deque *deque, walk_task *task) {
+   pthread_mutex_lock(&deque->lock);
+
+   if (deque->tail == deque->capacity) {
+      // slide the live tasks down before growing
+      if (deque->head) {
+         memmove(deque->tasks, deque->tasks + deque->head,
+               (deque->tail - deque->head) * sizeof(walk_task *));
+         deque->tail -= deque->head;
+         deque->head = 0;
+      }
+      else {
+         size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+         walk_task **tasks = realloc(deque->tasks,
+               capacity * sizeof(walk_task *));
+         if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+         }
+         deque->tasks = tasks;
+         deque->capacity = capacity;
+      }
+   }
+
+   deque->tasks[deque->tail++] = task;
+   pthread_mutex_unlock(&deque->lock);
+   return 0;
+}
+
+/*
+ * Takes the newest task of |deque| (|steal| zero) or its oldest one
+ */
+static walk_task *take_task(task_deque *deque, int steal) {
+   walk_task *task = NULL;
+
+   pthread_mutex_lock(&deque->lock);
+   if (deque->head < deque->tail)
+      task = steal ? deque->tasks[deque->head++] : deque->tasks[--deque->tail];
+   if (deque->head == deque->tail)
+      deque->head = deque->tail = 0;
+   pthread_mutex_unlock(&deque->lock);
+   return task;
+}
+
+/*
+ * Queues |task| on the deque of |self| and wakes an idle worker
+ */
+static int schedule(worker *self, walk_task *task) {
+   walker *walk = self->walk;
+
+   if (push_task(&walk->deques[self->id], task))
+      return -1;
+
+   pthread_mutex_lock(&walk->idle_lock);
+   walk->pending++;
+   walk->queued++;
+   pthread_cond_signal(&walk->idle_cond);
+   pthread_mutex_unlock(&walk->idle_lock);
+   return 0;
+}
+
+static int append_text(walk_task *task, const char *text, size_t len) {
+   while (task->text_len + len > task->text_cap) {
+      size_t text_cap = task->text_cap ? task->text_cap * 2 : 4096;
+      char *more = realloc(task->text, text_cap);
+      if (!more)
+         return -1;
+      task->text = more;
+      task->text_cap = text_cap;
+   }
+
+   memcpy(task->text + task->text_len, text, len);
+   task->text_len += len;
+   return 0;
+}
+
+static int add_child(walk_task *task, walk_task *child) {
+   if (task->child_count == task->child_cap) {
+      size_t child_cap = task->child_cap ? task->child_cap * 2 : 16;
+      walk_task **children = realloc(task->children,
+            child_cap * sizeof(walk_task *));
+      size_t *child_at;
+
+      if (!children)
+         return -1;
+      task->children = children;
+
+      child_at = realloc(task->child_at, child_cap * sizeof(size_t));
+      if (!child_at)
+         return -1;
+      task->child_at = child_at;
+      task->child_cap = child_cap;
+   }
+
+   task->children[task->child_count] = child;
+   task->child_at[task->child_count++] = task->text_len;
+   return 0;
+}
+
+static int visit_entry(ext2_dir_entry *entry, void *arg) {
+   scan_state *scan = arg;
+   walker *walk = scan->self->walk;
+   walk_task *task = scan->task, *child;
+   char line[EXT2_NAME_LEN + 64];
+   ext2_inode *ino;
+   int len, listed;
+   char type;
+
+   if (entry->name[0] == '.' && (entry->name_len == 1
+         || (entry->name_len == 2 && entry->name[1] == '.')))
+      return 0;
+
+   listed = !walk->filter || filter_match(walk->filter, entry->name,
+         entry->name_len);
+   ino = get_inode(walk->fs, entry->inode);
+   type = inode_type(ino);
+
+   if (listed) {
+      len = snprintf(line, sizeof(line), "/%.*s\t%u\t%c\t%lld\n",
+            (int) entry->name_len, entry->name, entry->inode, type,
+            (long long) (ino ? inode_size(ino) : 0));
+      if (append_text(task, task->path, task->path_len)
+            || append_text(task, line, len))
+         return -1;
+   }
+
+   if (type != 'd')
+      return 0;
+
+   child = new_task(entry->inode, task->path, task->path_len);
+   if (!child || append_path(child, entry->name, entry->name_len)) {
+      if (child)
+         free_task(child);
+      return -1;
+   }
+
+   if (walk->ordered && add_child(task, child)) {
+      free_task(child);
+      return -1;
+   }
+
+   if (schedule(scan->self, child)) {
+      // in ordered mode the parent already owns it
+      if (!walk->ordered)
+         free_task(child);
+      return -1;
+   }
+   return 0;
+}
+
+/*
+ * Scans the directory of |task|, queueing its subdirectories, and writes
+ * the directory's lines out unless the walk is ordered
+ */
+static void run_task(worker *self, walk_task *task) {
+   walker *walk = self->walk;
+   scan_state scan = { self, task };
+   unsigned long start = stats_now();
+   ext2_inode *ino = get_inode(walk->fs, task->inode);
+
+   if (inode_type(ino) == 'd' && iterate_dir(walk->fs, ino, visit_entry,
+         &scan))
+      walk->failed = 1;
+   stats_record(&walk->fs->stats, STATS_LIST, start);
+
+   if (!walk->ordered) {
+      pthread_mutex_lock(&walk->out_lock);
+      fwrite(task->text, 1, task->text_len, walk->out);
+      pthread_mutex_unlock(&walk->out_lock);
+      free_task(task);
+   }
+}
+
+/*
+ * Returns the next task for |self|: its own newest one, else the oldest one
+ * of another worker. Blocks while other workers are still busy and may
+ * queue more, and returns NULL once every task has finished.
+ */
+static walk_task *next_task(worker *self) {
+   walker *walk = self->walk;
+   walk_task *task;
+   int i, done;
+
+   for (;;) {
+      task = take_task(&walk->deques[self->id], 0);
+      for (i = 1; !task && i < walk->threads; i++)
+         task = take_task(&walk->deques[(self->id + i) % walk->threads], 1);
+
+      pthread_mutex_lock(&walk->idle_lock);
+      if (task) {
+         walk->queued--;
+         pthread_mutex_unlock(&walk->idle_lock);
+         return task;
+      }
+
+      while (!walk->queued && walk->pending)
+         pthread_cond_wait(&walk->idle_cond, &walk->idle_lock);
+      done = !walk->pending;
+      pthread_mutex_unlock(&walk->idle_lock);
+
+      if (done)
+         return NULL;
+   }
+}
+
+static void *work(void *arg) {
+   worker *self = arg;
+   walker *walk = self->walk;
+   walk_task *task;
+
+   while ((task = next_task(self))) {
+      run_task(self, task);
+
+      pthread_mutex_lock(&walk->idle_lock);
+      if (!--walk->pending)
+         pthread_cond_broadcast(&walk->idle_cond);
+      pthread_mutex_unlock(&walk->idle_lock);
+   }
+   return NULL;
+}
+
+/*
+ * Writes the held back output of |task| and its subtree in depth-first
+ * order and frees them
+ */
+static void write_ordered(walk_task *task, FILE *out) {
+   size_t i, pos = 0;
+
+   for (i = 0; i < task->child_count; i++) {
+      fwrite(task->text + pos, 1, task->child_at[i] - pos, out);
+      pos = task->child_at[i];
+      write_ordered(task->children[i], out);
+   }
+   fwrite(task->text + pos, 1, task->text_len - pos, out);
+   free_task(task);
+}
+
+int walk_tree(ext2_fs *fs, uint32_t dir_ino, const char *path, int threads,
+      int ordered, const name_filter *filter, FILE *out) {
+   walker walk = { 0 };
+   worker *workers;
+   walk_task *root;
+   size_t path_len = strlen(path);
+   int i, started = 1;
+
+   if (threads < 1)
+      threads = 1;
+   if (threads > WALK_MAX_THREADS)
+      threads = WALK_MAX_THREADS;
+
+   // lines are built as <path>/<name>, so drop trailing slashes
+   while (path_len && path[path_len - 1] == '/')
+      path_len--;
+
+   walk.fs = fs;
+   walk.out = out;
+   walk.ordered = ordered;
+   walk.filter = filter;
+   walk.threads = threads;
+   walk.deques = calloc(threads, sizeof(task_deque));
+   workers = calloc(threads, sizeof(worker));
+   root = new_task(dir_ino, path, path_len);
+   if (!walk.deques || !workers || !root) {
+      free(walk.deques);
+      free(workers);
+      if (root)
+         free_task(root);
+      return -1;
+   }
+
+   pthread_mutex_init(&walk.out_lock, NULL);
+   pthread_mutex_init(&walk.idle_lock, NULL);
+   pthread_cond_init(&walk.idle_cond, NULL);
+   for (i = 0; i < threads; i++) {
+      pthread_mutex_init(&walk.deques[i].lock, NULL);
+      workers[i].walk = &walk;
+      workers[i].id = i;
+   }
+
+   if (schedule(&workers[0], root)) {
+      free_task(root);
+      walk.failed = 1;
+   }
+   else {
+      // the calling thread is worker 0
+      for (; started < threads; started++)
+         if (pthread_create(&workers[started].thread, NULL, work,
+               &workers[started]))
+            break;
+      work(&workers[0]);
+      for (i = 1; i < started; i++)
+         pthread_join(workers[i].thread, NULL);
+
+      if (ordered)
+         write_ordered(root, out);
+   }
+
+   for (i = 0; i < threads; i++) {
+      pthread_mutex_destroy(&walk.deques[i].lock);
+      free(walk.deques[i].tasks);
+   }
+   pthread_cond_destroy(&walk.idle_cond);
+   pthread_mutex_destroy(&walk.idle_lock);
+   pthread_mutex_destroy(&walk.out_lock);
+   free(walk.deques);
+   free(workers);
+
+   return walk.failed ? -1 : 0;
+}
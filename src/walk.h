@@ -0,0 +1,37 @@
+/*
+ * walk.h
+ *
+ * Parallel recursive tree walk. Every directory is one task; a pool of
+ * worker threads each keeps its own deque of tasks, working depth first
+ * from the bottom of it and stealing the oldest (usually largest) subtree
+ * from the top of another worker's deque when it runs dry.
+ */
+
+#ifndef WALK_H_
+#define WALK_H_
+
+#include "ext2.h"
+#include "match.h"
+
+#define WALK_MAX_THREADS 64
+
+/*
+ * Lists every entry below the directory with inode number |dir_ino|, whose
+ * path is |path|, using |threads| worker threads. One tab separated line is
+ * written to |out| per entry whose name matches |filter| (every entry if
+ * it is NULL; all directories are still descended), in the same format as
+ * batch resolution:
+ *
+ *    <path> <inode> <type> <size>
+ *
+ * Without |ordered| each directory's lines are written as soon as it has
+ * been scanned, so directories come out in whatever order the workers
+ * finish them. With |ordered| the output is held back and written in
+ * depth-first on-disk order (each directory's contents right after its own
+ * line), identical from run to run whatever the thread count. Returns 0 on
+ * success, or -1 if memory ran out or a thread could not be started.
+ */
+int walk_tree(ext2_fs *fs, uint32_t dir_ino, const char *path, int threads,
+      int ordered, const name_filter *filter, FILE *out);
+
+#endif /* WALK_H_ */